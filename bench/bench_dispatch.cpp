@@ -0,0 +1,100 @@
+// Handler lookup microbenchmark: DispatchTable vs. the std::unordered_map it replaced.
+//
+// Runs a guest program once to record the dynamic stream of decoder keys, then
+// replays that stream through both lookup structures.
+//
+//   bench_dispatch <program.rv32> [repeats] < input
+
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "Decoder.hpp"
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+
+using namespace rv32i;
+
+static std::vector<u32> record_keys(Interpreter& cpu, size_t limit)
+{
+    std::vector<u32> keys;
+
+    while (keys.size() < limit)
+    {
+        u32 instr = cpu.load<u32>(cpu.pc());
+
+        auto [info, key] = Decoder::decode(instr, cpu.pc());
+
+        keys.push_back(key);
+
+        if (cpu.dispatch(cpu.state, info, key) != ExecutionStatus::Success)
+            break;
+    }
+
+    return keys;
+}
+
+template<typename Lookup>
+static double time_lookups(const std::vector<u32>& keys, int repeats, Lookup&& lookup)
+{
+    uintptr_t sink = 0;
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < repeats; ++r)
+        for (u32 key : keys)
+            sink ^= reinterpret_cast<uintptr_t>(lookup(key));
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    volatile uintptr_t keep = sink;
+    (void)keep;
+
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+
+    return ns / (double(keys.size()) * repeats);
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <program.rv32> [repeats] < input\n";
+        return 1;
+    }
+
+    const int repeats = argc > 2 ? std::stoi(argv[2]) : 20;
+
+    Interpreter cpu{};
+
+    loadElf(cpu, argv[1], {argv[1]});
+    register_all_handlers(cpu);
+
+    std::vector<u32> keys = record_keys(cpu, 50'000'000);
+
+    std::unordered_map<u32, Handler> map;
+    cpu.handlers().for_each([&](u32 key, Handler h) { map[key] = h; });
+
+    const DispatchTable& table = cpu.handlers();
+
+    double map_ns = time_lookups(keys, repeats, [&](u32 key) -> Handler {
+        auto it = map.find(key);
+        return it == map.end() ? nullptr : it->second;
+    });
+
+    double table_ns = time_lookups(keys, repeats, [&](u32 key) {
+        return table.find(key);
+    });
+
+    std::cout << "\n--- dispatch: " << argv[1] << " ---\n"
+              << "keys replayed : " << keys.size() << " x " << repeats << "\n"
+              << "unordered_map : " << map_ns   << " ns/lookup\n"
+              << "DispatchTable : " << table_ns << " ns/lookup\n"
+              << "speedup       : " << map_ns / table_ns << "x\n";
+
+    return 0;
+}
@@ -0,0 +1,125 @@
+// Guest fork microbenchmark: copy-on-write fork vs. loading the program again.
+//
+// Loads a program and dirties a working set to stand in for whatever the guest
+// initialised, then compares getting a fresh runnable copy of that state by
+// reloading (and redoing the writes) with Interpreter::fork(). Also shows what
+// a fork costs the host before and after it writes part of the working set.
+//
+//   bench_fork <program.rv32> [working set MiB] [copies]
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+
+using namespace rv32i;
+
+static constexpr u32 DATA = 0x40000000;
+
+static std::unique_ptr<Interpreter> load(const char* path, MemoryBackend backend, u32 bytes)
+{
+    auto cpu = std::make_unique<Interpreter>(backend);
+
+    GuestLayout layout;
+    layout.protect = false;
+
+    loadElf(*cpu, path, {path}, layout);
+    register_all_handlers(*cpu);
+
+    for (u32 off = 0; off < bytes; off += 4)
+        cpu->state.memory.StoreU32(DATA + off, off);
+
+    return cpu;
+}
+
+static double us_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static void report(const char* what, double us, const SparseMemory::Usage& u)
+{
+    std::cout << what << ": " << us << " us, host " << u.host_bytes / 1024
+              << " KiB, shared pages " << u.shared << "\n";
+}
+
+static void run(const char* name, const char* path, MemoryBackend backend, u32 bytes, int copies)
+{
+    auto parent = load(path, backend, bytes);
+
+    if (parent->state.memory.backend() != backend)
+    {
+        std::cout << name << ": not available on this host\n";
+        return;
+    }
+
+    std::cout << "\n--- " << name << ": " << parent->state.memory.numPages() << " pages ---\n";
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    std::vector<std::unique_ptr<Interpreter>> reloads;
+
+    for (int i = 0; i < copies; ++i)
+        reloads.push_back(load(path, backend, bytes));
+
+    report("reload        ", us_since(t0) / copies, reloads.back()->state.memory.usage());
+    reloads.clear();
+
+    t0 = std::chrono::steady_clock::now();
+
+    std::vector<std::unique_ptr<Interpreter>> forks;
+
+    for (int i = 0; i < copies; ++i)
+        forks.push_back(parent->fork());
+
+    report("fork          ", us_since(t0) / copies, forks.back()->state.memory.usage());
+
+    // Each fork writes a tenth of the working set
+    t0 = std::chrono::steady_clock::now();
+
+    for (auto& f : forks)
+        for (u32 off = 0; off < bytes / 10; off += SparseMemory::PAGE_SIZE)
+            f->state.memory.StoreU32(DATA + off, ~off);
+
+    report("fork + 10% dirty", us_since(t0) / copies, forks.back()->state.memory.usage());
+    forks.clear();
+
+    // Same writes on the parent itself, undone by a baseline reset
+    parent->markBaseline();
+
+    double reset_us = 0;
+
+    for (int i = 0; i < copies; ++i)
+    {
+        for (u32 off = 0; off < bytes / 10; off += SparseMemory::PAGE_SIZE)
+            parent->state.memory.StoreU32(DATA + off, ~off);
+
+        t0 = std::chrono::steady_clock::now();
+        parent->resetToBaseline();
+        reset_us += us_since(t0);
+    }
+
+    report("reset 10% dirty ", reset_us / copies, parent->state.memory.usage());
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <program.rv32> [working set MiB] [copies]\n";
+        return 1;
+    }
+
+    const u32 mib    = argc > 2 ? u32(std::stoul(argv[2])) : 16;
+    const int copies = argc > 3 ? std::stoi(argv[3]) : 16;
+
+    run("sparse", argv[1], MemoryBackend::Sparse, mib << 20, copies);
+    run("flat",   argv[1], MemoryBackend::Flat,   mib << 20, copies);
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+// Guest I/O throughput: a guest that copies its stdin to its stdout.
+//
+// Writes a file of the given size, then runs a cat-like guest over it with
+// reads and writes of a few sizes, under each output buffering mode, with its
+// stdout going to another file. Reports MiB/s through the guest and the
+// syscalls it made.
+//
+//   bench_io [MiB]
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Encoder.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Opcodes.hpp"
+#include "Runner.hpp"
+
+using namespace rv32i;
+
+static constexpr u32 BASE   = 0x1000;
+static constexpr u32 BUFFER = 0x10000000;
+
+static u32 addi(u8 rd, u8 rs1, s32 imm) { return encode(IEncoding{imm, rs1, 0x0, rd, Opcode::I_TYPE}); }
+static u32 lui(u8 rd, s32 imm)          { return encode(UEncoding{imm, rd, Opcode::U_LUI}); }
+static u32 bge(u8 rs1, u8 rs2, s32 off) { return encode(BEncoding{off, rs2, rs1, 0x5, Opcode::B_TYPE}); }
+static u32 jal(u8 rd, s32 off)          { return encode(JEncoding{off, rd, Opcode::J_TYPE}); }
+static u32 ecall()                      { return 0x00000073u; }
+
+// loop: n = read(0, BUFFER, chunk); if (n <= 0) exit(0); write(1, BUFFER, n)
+static std::vector<u32> cat_program(u32 chunk)
+{
+    const s32 hi = s32((chunk + 0x800) & ~0xFFFu);
+
+    return {
+        lui(11, s32(BUFFER)),                  // 0x00  a1 = BUFFER
+        addi(10, 0, 0),                        // 0x04  loop: a0 = 0
+        lui(12, hi),                           // 0x08
+        addi(12, 12, s32(chunk) - hi),         // 0x0C  a2 = chunk
+        addi(17, 0, 63),                       // 0x10
+        ecall(),                               // 0x14  read
+        bge(0, 10, 24),                        // 0x18  -> 0x30 on EOF
+        addi(12, 10, 0),                       // 0x1C  a2 = n
+        addi(10, 0, 1),                        // 0x20
+        addi(17, 0, 64),                       // 0x24
+        ecall(),                               // 0x28  write
+        jal(0, -0x28),                         // 0x2C  -> loop
+        addi(10, 0, 0),                        // 0x30
+        addi(17, 0, 93),                       // 0x34
+        ecall(),                               // 0x38  exit
+    };
+}
+
+static void run(const char* name, OutputBuffering mode, u32 chunk,
+                const std::string& in_path, const std::string& out_path, u64 bytes)
+{
+    const int in  = ::open(in_path.c_str(), O_RDONLY);
+    const int out = ::open(out_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+
+    const auto t0 = std::chrono::steady_clock::now();
+
+    ExecutionResult res;
+
+    {
+        Interpreter cpu;
+        register_all_handlers(cpu);
+
+        const auto program = cat_program(chunk);
+
+        for (u32 i = 0; i < program.size(); ++i)
+            cpu.state.memory.StoreU32(BASE + 4 * i, program[i]);
+
+        cpu.state.pc           = BASE;
+        cpu.state.io.backend   = std::make_shared<HostFdIo>(in, out);
+        cpu.state.io.buffering = mode;
+
+        res = run_program(cpu, DEFAULT_CYCLE_LIMIT, Engine::Block);
+    }
+
+    const double s = std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count();
+
+    const bool copied = lseek(out, 0, SEEK_END) == off_t(bytes);
+
+    ::close(in);
+    ::close(out);
+
+    std::cout << name << " " << chunk << " B/call: " << double(bytes) / (1 << 20) / s << " MiB/s, "
+              << 2 * bytes / chunk << " guest syscalls"
+              << (res.status == ExecutionStatus::ProgramExit && copied ? "" : "  (copy FAILED)") << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    const u64 mib   = argc > 1 ? std::stoull(argv[1]) : 64;
+    const u64 bytes = mib << 20;
+
+    const std::string base     = "/tmp/rv32i_bench_io_" + std::to_string(getpid());
+    const std::string in_path  = base + ".in";
+    const std::string out_path = base + ".out";
+
+    {
+        std::vector<char> block(1 << 20);
+
+        for (size_t i = 0; i < block.size(); ++i)
+            block[i] = i % 64 == 63 ? '\n' : char('a' + i % 26);
+
+        FILE* f = std::fopen(in_path.c_str(), "wb");
+
+        for (u64 i = 0; i < mib; ++i)
+            std::fwrite(block.data(), 1, block.size(), f);
+
+        std::fclose(f);
+    }
+
+    std::cout << "stdin -> stdout through the guest, " << mib << " MiB\n";
+
+    for (u32 chunk : {64u * 1024, 4096u, 64u})
+    {
+        run("unbuffered", OutputBuffering::None, chunk, in_path, out_path, bytes);
+        run("line      ", OutputBuffering::Line, chunk, in_path, out_path, bytes);
+        run("full      ", OutputBuffering::Full, chunk, in_path, out_path, bytes);
+    }
+
+    std::remove(in_path.c_str());
+    std::remove(out_path.c_str());
+
+    return 0;
+}
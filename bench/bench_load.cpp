@@ -0,0 +1,176 @@
+// Program loading microbenchmark: copying segments vs. mapping them from the file.
+//
+// Writes a synthetic RV32 executable with a large read-only segment, a
+// writable data segment and a BSS, then loads it a number of times both ways
+// and reports the time per load and what the loaded images cost the host,
+// before and after the guests touch a few pages.
+//
+//   bench_load [image MiB] [copies]
+//
+// Resident counts file pages a guest has read; anonymous is what the host had
+// to allocate for the image.
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ElfLoader.hpp"
+#include "Interpreter.hpp"
+
+using namespace rv32i;
+
+static constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+static constexpr u32 TEXT = 0x00010000;
+
+struct Segment
+{
+    u32 vaddr, offset, filesz, memsz, flags;
+};
+
+template <typename T>
+static void put(std::vector<u8>& out, size_t at, T v)
+{
+    std::memcpy(out.data() + at, &v, sizeof(T));
+}
+
+// ELF32 header, program headers, then the segments page aligned in the file
+static void writeImage(const std::string& path, u32 bytes)
+{
+    const u32 text_size = bytes / 4 * 3;
+    const u32 data_size = bytes / 4;
+    const u32 data      = TEXT + text_size + PAGE;
+
+    const Segment segs[] = {
+        {TEXT, PAGE,             text_size, text_size,         5}, // R+X
+        {data, PAGE + text_size, data_size, data_size + bytes, 6}, // RW, BSS as big as the image
+    };
+
+    std::vector<u8> out(PAGE + text_size + data_size);
+
+    std::memcpy(out.data(), "\x7f" "ELF\x01\x01\x01", 7);
+    put<u16>(out, 16, 2);              // ET_EXEC
+    put<u16>(out, 18, 243);            // EM_RISCV
+    put<u32>(out, 20, 1);
+    put<u32>(out, 24, TEXT);           // entry
+    put<u32>(out, 28, 52);             // phoff
+    put<u16>(out, 40, 52);
+    put<u16>(out, 42, 32);
+    put<u16>(out, 44, 2);
+
+    for (size_t i = 0; i < 2; ++i)
+    {
+        const size_t ph = 52 + i * 32;
+
+        put<u32>(out, ph +  0, 1);     // PT_LOAD
+        put<u32>(out, ph +  4, segs[i].offset);
+        put<u32>(out, ph +  8, segs[i].vaddr);
+        put<u32>(out, ph + 12, segs[i].vaddr);
+        put<u32>(out, ph + 16, segs[i].filesz);
+        put<u32>(out, ph + 20, segs[i].memsz);
+        put<u32>(out, ph + 24, segs[i].flags);
+        put<u32>(out, ph + 28, PAGE);
+    }
+
+    for (size_t at = PAGE; at + 4 <= out.size(); at += 4)
+        put<u32>(out, at, u32(at * 2654435761u));
+
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(out.data()), std::streamsize(out.size()));
+}
+
+// Resident KiB, and how much of it is anonymous: file pages the guests only
+// read count as resident but are page cache, shared by every image of the file
+struct Resident
+{
+    long rss = 0, anon = 0;
+};
+
+static Resident resident()
+{
+    Resident r;
+    std::ifstream in("/proc/self/smaps_rollup");
+    std::string line;
+
+    while (std::getline(in, line))
+    {
+        if (line.starts_with("Rss:"))
+            r.rss = std::stol(line.substr(4));
+        else if (line.starts_with("Anonymous:"))
+            r.anon = std::stol(line.substr(10));
+    }
+
+    return r;
+}
+
+static void run(const char* name, const std::string& path, MemoryBackend backend,
+                bool demand, u32 bytes, int copies)
+{
+    GuestLayout layout;
+    layout.demand_paging = demand;
+
+    std::vector<std::unique_ptr<Interpreter>> cpus;
+
+    const Resident r0 = resident();
+    const auto     t0 = std::chrono::steady_clock::now();
+
+    for (int i = 0; i < copies; ++i)
+    {
+        cpus.push_back(std::make_unique<Interpreter>(backend));
+        loadElf(*cpus.back(), path, {path}, layout);
+    }
+
+    const double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+
+    if (cpus.back()->state.memory.backend() != backend)
+    {
+        std::cout << name << ": not available on this host\n";
+        return;
+    }
+
+    const Resident loaded = resident();
+
+    // Every guest reads one page in a hundred and writes one in a thousand
+    u32 sum = 0;
+
+    for (auto& cpu : cpus)
+        for (u32 off = 0; off < bytes; off += PAGE)
+        {
+            if (off / PAGE % 100 == 0)
+                sum += cpu->state.memory.LoadU32(TEXT + off);
+
+            if (off / PAGE % 1000 == 0)
+                cpu->state.memory.StoreU32(TEXT + off, sum);
+        }
+
+    const Resident used = resident();
+
+    std::cout << name << ": " << us / copies << " us/load, per image KiB resident/anonymous: loaded "
+              << (loaded.rss - r0.rss) / copies << "/" << (loaded.anon - r0.anon) / copies << ", used "
+              << (used.rss - r0.rss) / copies << "/" << (used.anon - r0.anon) / copies << "\n";
+}
+
+int main(int argc, char* argv[])
+{
+    const u32 mib    = argc > 1 ? u32(std::stoul(argv[1])) : 32;
+    const int copies = argc > 2 ? std::stoi(argv[2]) : 8;
+
+    const std::string path = "/tmp/rv32i_bench_load_" + std::to_string(getpid()) + ".rv32";
+    writeImage(path, mib << 20);
+
+    std::cout << "image: " << mib << " MiB of segments, " << copies << " copies\n";
+
+    run("sparse copy  ", path, MemoryBackend::Sparse, false, mib << 20, copies);
+    run("sparse mapped", path, MemoryBackend::Sparse, true,  mib << 20, copies);
+    run("flat copy    ", path, MemoryBackend::Flat,   false, mib << 20, copies);
+    run("flat mapped  ", path, MemoryBackend::Flat,   true,  mib << 20, copies);
+
+    std::remove(path.c_str());
+
+    return 0;
+}
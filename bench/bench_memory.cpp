@@ -0,0 +1,119 @@
+// Guest memory microbenchmark: word loads and stores through SparseMemory.
+//
+// Replays sequential, strided and random address streams over a working set
+// against both backends (page map with its TLBs, flat host reservation).
+//
+//   bench_memory [working set MiB] [repeats]
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "Memory.hpp"
+
+using namespace rv32i;
+
+static constexpr u32 BASE = 0x10000000;
+
+static std::vector<u32> sequential(u32 bytes)
+{
+    std::vector<u32> a;
+
+    for (u32 off = 0; off < bytes; off += 4)
+        a.push_back(BASE + off);
+
+    return a;
+}
+
+//> One word per page, walking the pages in order: every access is a new page
+static std::vector<u32> strided(u32 bytes)
+{
+    std::vector<u32> a;
+
+    for (u32 word = 0; word < SparseMemory::PAGE_SIZE; word += 4)
+        for (u32 page = 0; page < bytes; page += SparseMemory::PAGE_SIZE)
+            a.push_back(BASE + page + word);
+
+    return a;
+}
+
+static std::vector<u32> random_words(u32 bytes)
+{
+    std::vector<u32> a = sequential(bytes);
+
+    std::shuffle(a.begin(), a.end(), std::mt19937(12345));
+
+    return a;
+}
+
+template<typename Access>
+static double time_accesses(const std::vector<u32>& addrs, int repeats, Access&& access)
+{
+    auto t0 = std::chrono::steady_clock::now();
+
+    for (int r = 0; r < repeats; ++r)
+        for (u32 addr : addrs)
+            access(addr);
+
+    auto t1 = std::chrono::steady_clock::now();
+
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+
+    return ns / (double(addrs.size()) * repeats);
+}
+
+static void run(const char* name, MemoryBackend backend, u32 bytes, int repeats)
+{
+    SparseMemory m(backend);
+
+    if (m.backend() != backend)
+    {
+        std::cout << name << ": not available on this host\n";
+        return;
+    }
+
+    // Commit the working set first so the loads hit real pages
+    for (u32 off = 0; off < bytes; off += 4)
+        m.StoreU32(BASE + off, off);
+
+    const std::pair<const char*, std::vector<u32>> patterns[] = {
+        {"sequential", sequential(bytes)},
+        {"strided   ", strided(bytes)},
+        {"random    ", random_words(bytes)},
+    };
+
+    u32 sink = 0;
+
+    std::cout << "\n--- " << name << ": " << m.numPages() << " pages ---\n";
+
+    for (const auto& [pattern, addrs] : patterns)
+    {
+        double load_ns = time_accesses(addrs, repeats, [&](u32 addr) {
+            sink += m.LoadU32(addr);
+        });
+
+        double store_ns = time_accesses(addrs, repeats, [&](u32 addr) {
+            m.StoreU32(addr, addr ^ sink);
+        });
+
+        std::cout << pattern << " : load " << load_ns << " ns, store " << store_ns << " ns\n";
+    }
+
+    volatile u32 keep = sink;
+    (void)keep;
+}
+
+int main(int argc, char* argv[])
+{
+    const u32 mib     = argc > 1 ? u32(std::stoul(argv[1])) : 16;
+    const int repeats = argc > 2 ? std::stoi(argv[2]) : 4;
+
+    run("sparse", MemoryBackend::Sparse, mib << 20, repeats);
+    run("flat",   MemoryBackend::Flat,   mib << 20, repeats);
+
+    return 0;
+}
@@ -0,0 +1,111 @@
+// Page sharing across many guests: what the zero page and the page merger save.
+//
+// Loads one program into many page-map guests the copying way (the way a guest
+// built from a stream is loaded), gives each the same initialised table and a
+// zeroed buffer the way a running guest would have, then runs PageMerger over
+// all of them and reports the guest pages the host no longer holds, the time
+// it took, and what a guest's first write into a merged page costs.
+//
+//   bench_merge <program.rv32> [guests] [table KiB]
+
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "ElfLoader.hpp"
+#include "Interpreter.hpp"
+#include "PageMerger.hpp"
+
+using namespace rv32i;
+
+static constexpr u32 TABLE  = 0x40000000;
+static constexpr u32 BUFFER = 0x50000000;
+
+static double us_since(std::chrono::steady_clock::time_point t0)
+{
+    return std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - t0).count();
+}
+
+static size_t private_pages(const std::vector<std::unique_ptr<Interpreter>>& guests)
+{
+    size_t pages = 0;
+
+    for (const auto& g : guests)
+        pages += g->state.memory.privatePages().size();
+
+    return pages;
+}
+
+int main(int argc, char* argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <program.rv32> [guests] [table KiB]\n";
+        return 1;
+    }
+
+    const int guests = argc > 2 ? std::stoi(argv[2]) : 200;
+    const u32 table  = (argc > 3 ? u32(std::stoul(argv[3])) : 256) << 10;
+
+    GuestLayout layout;
+    layout.demand_paging = false;
+
+    std::vector<std::unique_ptr<Interpreter>> cpus;
+
+    for (int i = 0; i < guests; ++i)
+    {
+        auto cpu = std::make_unique<Interpreter>();
+        SparseMemory& m = cpu->state.memory;
+
+        loadElf(*cpu, argv[1], {argv[1]}, layout);
+
+        // The same lookup table everywhere, read-only once built
+        for (u32 off = 0; off < table; off += 4)
+            m.StoreU32(TABLE + off, off * 2654435761u);
+
+        m.protect(TABLE, table, SparseMemory::PERM_R);
+
+        // A buffer the guest zeroed word by word, and one its own
+        for (u32 off = 0; off < table; off += 4)
+            m.StoreU32(BUFFER + off, 0);
+
+        m.StoreU32(BUFFER + table, u32(i) + 1);
+
+        cpus.push_back(std::move(cpu));
+    }
+
+    const size_t before = private_pages(cpus);
+
+    std::cout << guests << " guests, " << before << " private pages ("
+              << before * SparseMemory::PAGE_SIZE / 1024 << " KiB)\n";
+
+    PageMerger merger;
+
+    for (auto& cpu : cpus)
+        merger.add(cpu->state.memory);
+
+    auto t0 = std::chrono::steady_clock::now();
+
+    merger.scan();
+
+    const double scan_us = us_since(t0);
+    const size_t after   = private_pages(cpus);
+
+    std::cout << "scan: " << scan_us / 1000 << " ms for " << merger.stats.scanned << " pages\n"
+              << "zero pages:   " << merger.stats.zero << "\n"
+              << "merged pages: " << merger.stats.merged << "\n"
+              << "saved:        " << merger.stats.savedBytes() / 1024 << " KiB ("
+              << 100.0 * double(before - after) / double(before) << "% of guest pages)\n";
+
+    // What merging costs a guest that writes to what it shares again
+    t0 = std::chrono::steady_clock::now();
+
+    for (auto& cpu : cpus)
+        cpu->state.memory.StoreU32(BUFFER, 1);
+
+    std::cout << "first write into a merged page: " << us_since(t0) * 1000 / guests << " ns\n";
+
+    return 0;
+}
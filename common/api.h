@@ -1,3 +1,40 @@
+#pragma once
+
+#define AT_FDCWD (-100)
+#define O_RDONLY 0
+
+#define PROT_NONE     0
+#define PROT_READ     1
+#define PROT_WRITE    2
+#define MAP_SHARED    0x01
+#define MAP_PRIVATE   0x02
+#define MAP_ANONYMOUS 0x20
+
+// The RISC-V Linux struct stat (64-bit fields on RV32 as well)
+struct kstat
+{
+    unsigned long long dev, ino;
+    unsigned int       mode, nlink, uid, gid;
+    unsigned long long rdev, pad1;
+    long long          size;
+    int                blksize, pad2;
+    long long          blocks;
+    long long          atime, atime_ns, mtime, mtime_ns, ctime, ctime_ns;
+    int                reserved[2];
+};
+
+extern long openat(int dirfd, const char* path, int flags, int mode);
+extern long close(int fd);
 extern long read(int fd, char* data, long maxlen);
 extern long write(int fd, const char* data, long len);
+extern long pread(int fd, char* data, long len, long long offset);
+extern long fstat(int fd, struct kstat* st);
+
+// Raw syscalls: brk returns the new break (the old one if it can't move),
+// mmap takes its offset in pages (mmap2); failures come back as -errno
+extern void* brk(void* addr);
+extern void* mmap(void* addr, long len, int prot, int flags, int fd, long pgoff);
+extern long munmap(void* addr, long len);
+extern long mprotect(void* addr, long len, int prot);
+
 extern __attribute__((noreturn)) void exit(long status);
@@ -1,10 +1,28 @@
+.global openat
+.global close
 .global read
 .global write
+.global pread
+.global fstat
+.global brk
+.global munmap
+.global mmap
+.global mprotect
 .global exit
 .global _start
 
 .section .text
 
+openat:
+    li a7, 56
+    ecall
+    ret
+
+close:
+    li a7, 57
+    ecall
+    ret
+
 read:
     li a7, 63
     ecall
@@ -15,6 +33,36 @@ write:
     ecall
     ret
 
+pread:
+    li a7, 67
+    ecall
+    ret
+
+fstat:
+    li a7, 80
+    ecall
+    ret
+
+brk:
+    li a7, 214
+    ecall
+    ret
+
+munmap:
+    li a7, 215
+    ecall
+    ret
+
+mmap:
+    li a7, 222
+    ecall
+    ret
+
+mprotect:
+    li a7, 226
+    ecall
+    ret
+
 exit:
     li a7, 93
     ecall
@@ -103,3 +103,87 @@ static void write_int_space(int x)
     buf[n++] = ' ';
     write(1, buf, n);
 }
+
+// The heap the way newlib's malloc gets it: sbrk on top of brk, as libgloss
+// does. heap_alloc keeps freed small blocks on a list and gives big ones
+// their own mmap, which goes straight back on heap_free.
+
+#define HEAP_MMAP_THRESHOLD (128 * 1024)
+
+struct heap_block
+{
+    unsigned long      size; // header included; low bit set if it was mmapped
+    struct heap_block* next;
+};
+
+static char*              heap_break;
+static struct heap_block* heap_free_list;
+
+static void* sbrk(long increment)
+{
+    if (!heap_break)
+        heap_break = brk(0);
+
+    char* want = heap_break + increment;
+
+    if (brk(want) != want)
+        return (void*)-1;
+
+    char* old = heap_break;
+    heap_break = want;
+
+    return old;
+}
+
+static void* heap_alloc(unsigned long n)
+{
+    unsigned long size = (n + sizeof(struct heap_block) + 15) & ~15ul;
+
+    if (size >= HEAP_MMAP_THRESHOLD)
+    {
+        size = (size + 4095) & ~4095ul;
+
+        struct heap_block* b = mmap(0, (long)size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+        if ((unsigned long)b > -4096ul)
+            return 0;
+
+        b->size = size | 1;
+        return b + 1;
+    }
+
+    for (struct heap_block** p = &heap_free_list; *p; p = &(*p)->next)
+    {
+        if ((*p)->size >= size)
+        {
+            struct heap_block* b = *p;
+            *p = b->next;
+            return b + 1;
+        }
+    }
+
+    struct heap_block* b = sbrk((long)size);
+
+    if (b == (void*)-1)
+        return 0;
+
+    b->size = size;
+    return b + 1;
+}
+
+static void heap_free(void* ptr)
+{
+    if (!ptr)
+        return;
+
+    struct heap_block* b = (struct heap_block*)ptr - 1;
+
+    if (b->size & 1)
+    {
+        munmap(b, (long)(b->size & ~1ul));
+        return;
+    }
+
+    b->next = heap_free_list;
+    heap_free_list = b;
+}
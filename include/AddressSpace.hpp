@@ -0,0 +1,141 @@
+#pragma once
+
+//> The guest's address space as the kernel keeps it: which ranges are mapped
+//> and what for (the image, the brk heap, the stack, mmap areas), on top of the
+//> SparseMemory that holds the bytes. Nothing here allocates pages: mapping a
+//> range only grants access to it, and the memory creates a page on the first
+//> store into it. Unmapping gives the pages back (SparseMemory::discard()), so
+//> the range reads as zero and costs the host nothing if it is mapped again.
+//>
+//> The heap starts at the page after the image and brk moves its end, up to
+//> heap_limit. mmap places areas top-down from MMAP_TOP, below what is already
+//> there and never under heap_limit, so the heap always has room to grow;
+//> MAP_FIXED puts them anywhere. Areas that meet and are of the same kind
+//> merge, as the kernel's do.
+//>
+//> Files map the same lazy way (SparseMemory::mapFile()): the guest reads the
+//> host's page cache in place, nothing is copied up front, and guests mapping
+//> the same file share its pages. MAP_PRIVATE areas are copied a page at a
+//> time as the guest writes them. MAP_SHARED ones are read-only: writes would
+//> never reach the file, so asking for PROT_WRITE on them is -EACCES.
+//>
+//> With protect off the guest may touch anything anyway: the areas are kept
+//> all the same, only the memory's permissions are left alone.
+
+#include <map>
+#include <memory>
+
+#include "IntTypes.hpp"
+#include "MappedFile.hpp"
+#include "Memory.hpp"
+
+namespace rv32i {
+
+class AddressSpace
+{
+public:
+
+    enum class Kind : u8
+    {
+        Image,
+        Heap,
+        Stack,
+        Anonymous,
+        File,      // MAP_PRIVATE
+        SharedFile // MAP_SHARED, read-only
+    };
+
+    struct Area
+    {
+        u32  end;  // the key is where it begins
+        Kind kind;
+    };
+
+    //> RISC-V Linux mmap/mprotect bits
+    static constexpr u32 PROT_READ  = 1;
+    static constexpr u32 PROT_WRITE = 2;
+    static constexpr u32 PROT_EXEC  = 4;
+
+    static constexpr u32 MAP_SHARED          = 0x01;
+    static constexpr u32 MAP_PRIVATE         = 0x02;
+    static constexpr u32 MAP_TYPE            = 0x0F;
+    static constexpr u32 MAP_FIXED           = 0x10;
+    static constexpr u32 MAP_ANONYMOUS       = 0x20;
+    static constexpr u32 MAP_FIXED_NOREPLACE = 0x100000;
+
+    //> Highest address mmap hands out on its own: under 2 GiB, so pointers
+    //> stay positive for guests that compare them as ints. Above it only when
+    //> nothing fits below.
+    static constexpr u32 MMAP_TOP  = 0x80000000u;
+    static constexpr u32 SPACE_TOP = 0xFFFFF000u; // the last page is never mapped
+
+    struct Stats
+    {
+        u32 heap_bytes   = 0; // break - heap start
+        u32 heap_peak    = 0;
+        u32 mapped_bytes = 0; // anonymous mmap areas
+        u32 mapped_peak  = 0;
+        u32 file_bytes   = 0; // file mmap areas
+        u64 brk_calls    = 0;
+        u64 mmap_calls   = 0;
+        u64 munmap_calls = 0;
+        u64 failed       = 0; // calls that came back with an error
+    } stats;
+
+    //> What the loader laid out; forgets any areas from before
+    void reset(u32 image_begin, u32 heap_begin, u32 heap_limit,
+               u32 stack_limit, u32 stack_top, bool protect);
+
+    //> New break, which stays where it was if addr is outside the heap or
+    //> would run into another area; brk(0) just asks
+    u32 brk(SparseMemory& m, u32 addr);
+
+    //> Address of the new area, or -errno. Without MAP_ANONYMOUS it maps file
+    //> from offset (page aligned) on; pages past its end read as zero.
+    u32 mmap(SparseMemory& m, u32 addr, u32 len, u32 prot, u32 flags,
+             std::shared_ptr<const MappedFile> file = nullptr, u64 offset = 0);
+
+    //> 0 or -errno; unmapping what is not mapped is not an error
+    s32 munmap(SparseMemory& m, u32 addr, u32 len);
+
+    //> 0 or -errno (-ENOMEM if part of the range is not mapped, -EACCES for
+    //> write access to a shared file mapping)
+    s32 mprotect(SparseMemory& m, u32 addr, u32 len, u32 prot);
+
+    u32 heapBegin() const { return heap_begin_; }
+    u32 breakAddr() const { return brk_; }
+    u32 heapLimit() const { return heap_limit_; }
+
+    const std::map<u32, Area>& areas() const { return areas_; }
+
+    //> Whether any area overlaps [begin, end)
+    bool overlaps(u32 begin, u32 end) const;
+
+private:
+
+    std::map<u32, Area> areas_;
+
+    u32  heap_begin_ = 0;
+    u32  brk_        = 0;
+    u32  heap_limit_ = 0;
+    bool protect_    = false;
+
+    //> Whether areas cover every byte of [begin, end)
+    bool covered(u32 begin, u32 end) const;
+
+    //> Splits the area holding addr so one begins there
+    void split(u32 addr);
+
+    //> Maps [begin, end) as kind, merging with neighbours of the same kind
+    void insert(u32 begin, u32 end, Kind kind);
+
+    //> Unmaps whatever is in [begin, end) and gives its pages back
+    void remove(SparseMemory& m, u32 begin, u32 end);
+
+    //> Highest free range of len bytes within [floor, top), 0 if none
+    u32 findGap(u32 len, u32 floor, u32 top) const;
+
+    void count(Kind kind, s64 bytes);
+};
+
+} // namespace rv32i
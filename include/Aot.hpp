@@ -0,0 +1,94 @@
+#pragma once
+
+//> Ahead-of-time translation of a guest program into C++.
+//> StaticTranslator walks the code reachable from the entry point (recursive
+//> descent: branch targets, jal targets, return sites and jalr targets it can
+//> prove from lui/auipc/addi), and emits one C++ function with a label per
+//> block leader. Direct jumps become gotos; jalr goes through a switch on the
+//> pc. The output is compiled by the host compiler together with rv32i_core.
+//>
+//> Anything the translation does not cover (ecall and other handlers the block
+//> engine does not know, jumps to code it did not find) leaves the translated
+//> function, runs one instruction on the embedded interpreter and comes back.
+//> The translated code assumes the text is never rewritten at run time.
+
+#include <iosfwd>
+#include <map>
+#include <set>
+#include <string>
+#include <vector>
+
+#include "Formats.hpp"
+#include "Interpreter.hpp"
+#include "IntTypes.hpp"
+#include "Status.hpp"
+
+namespace rv32i {
+
+//> Entry of a translated program: runs from s.pc until it must leave. Returns
+//> Success with s.pc at an instruction for the interpreter, or the trap it hit.
+//> `cycles` grows by whole blocks as they are entered.
+using AotEntry = ExecutionStatus(*)(InterpreterState& s, u64& cycles);
+
+//> Runtime of a generated program: loads the embedded image with argv as the
+//> guest's arguments and alternates between `entry` and the interpreter.
+int aot_main(int argc, char* argv[], const u8* image, size_t size, AotEntry entry);
+
+//> Straight op with its operands baked in, used by generated code
+#define RV32I_AOT_STEP(FORMAT, OPER, PC, RD, RS1, RS2, RS3, IMM, SHAMT)           \
+    {                                                                             \
+        static constexpr InstrInfo info_{RD, RS1, RS2, RS3, IMM, SHAMT, PC};      \
+                                                                                  \
+        if (ExecutionStatus st_ = FORMAT::apply<OPER>(s, info_);                  \
+            st_ != ExecutionStatus::Success) [[unlikely]]                          \
+        {                                                                         \
+            s.pc = PC;                                                            \
+            return st_;                                                           \
+        }                                                                         \
+    }
+
+class StaticTranslator
+{
+    struct Instr
+    {
+        InstrInfo info;
+        u16       op;
+    };
+
+    Interpreter&         cpu_;
+    u32                  text_begin_;
+    u32                  text_end_;
+    std::map<u32, Instr> code_;    // every instruction found, by pc
+    std::set<u32>        leaders_; // pcs that get a label
+
+    bool inText(u32 pc) const { return pc % 4 == 0 && pc >= text_begin_ && pc < text_end_; }
+
+    std::string jumpTo(u32 pc) const;
+
+public:
+
+    struct Stats
+    {
+        u64 blocks       = 0;
+        u64 instructions = 0;
+        u64 indirect     = 0; // jalr sites, resolved through the pc switch
+        u64 resolved     = 0; // jalr targets proven from constants
+        u64 exits        = 0; // instructions left to the interpreter
+    };
+
+    Stats stats;
+
+    //> cpu must have the program loaded and the handlers registered
+    StaticTranslator(Interpreter& cpu, u32 text_begin, u32 text_end)
+        : cpu_(cpu), text_begin_(text_begin), text_end_(text_end) {}
+
+    //> Finds the code reachable from entry
+    void discover(u32 entry);
+
+    const std::set<u32>& leaders() const { return leaders_; }
+
+    //> Writes the translation unit; image is the ELF file, embedded as is
+    void emit(std::ostream& out, const std::vector<u8>& image, const std::string& name) const;
+};
+
+} // namespace rv32i
@@ -0,0 +1,367 @@
+#pragma once
+
+//> Basic blocks for the threaded engine.
+//> A block is a run of straight-line instructions that ends at a branch, a jump,
+//> an instruction whose handler the engine does not know (ecall, fence.i, illegal, ...),
+//> the block length limit or the end of the page.
+
+#include <algorithm>
+#include <array>
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+#include "Formats.hpp"
+#include "HandlerFactory.hpp"
+#include "InstrInfo.hpp"
+#include "Memory.hpp"
+#include "Operations.hpp"
+
+namespace rv32i {
+
+//> Instructions the threaded engine runs inline, as (Format, Oper) pairs.
+//> STRAIGHT ops go through Format::apply, CONTROL ops end the block with Format::execute.
+
+#define RV32I_STRAIGHT_OPS(X)                                                     \
+    X(FormatR, AddOp)     X(FormatR, SubOp)     X(FormatR, SllOp)                 \
+    X(FormatR, SltOp)     X(FormatR, SltuOp)    X(FormatR, XorOp)                 \
+    X(FormatR, SrlOp)     X(FormatR, SraOp)     X(FormatR, OrOp)                  \
+    X(FormatR, AndOp)                                                             \
+    X(FormatR, MulOp)     X(FormatR, MulhOp)    X(FormatR, MulhsuOp)              \
+    X(FormatR, MulhuOp)   X(FormatR, DivOp)     X(FormatR, DivuOp)                \
+    X(FormatR, RemOp)     X(FormatR, RemuOp)                                      \
+    X(FormatR, AndnOp)    X(FormatR, OrnOp)     X(FormatR, XnorOp)                \
+    X(FormatR, MaxOp)     X(FormatR, MaxuOp)    X(FormatR, MinOp)                 \
+    X(FormatR, MinuOp)    X(FormatR, ZextHOp)   X(FormatR, RolOp)                 \
+    X(FormatR, RorOp)                                                             \
+    X(FormatI, AddiOp)    X(FormatI, SltiOp)    X(FormatI, SltiuOp)               \
+    X(FormatI, XoriOp)    X(FormatI, OriOp)     X(FormatI, AndiOp)                \
+    X(FormatI, SlliOp)    X(FormatI, SrliOp)    X(FormatI, SraiOp)                \
+    X(FormatI, ClzOp)     X(FormatI, CtzOp)     X(FormatI, CpopOp)                \
+    X(FormatI, SextBOp)   X(FormatI, SextHOp)   X(FormatI, RoriOp)                \
+    X(FormatI, OrcbOp)    X(FormatI, Rev8Op)                                      \
+    X(FormatLoad, LbOp)   X(FormatLoad, LhOp)   X(FormatLoad, LwOp)               \
+    X(FormatLoad, LbuOp)  X(FormatLoad, LhuOp)                                    \
+    X(FormatS, SbOp)      X(FormatS, ShOp)      X(FormatS, SwOp)                  \
+    X(FormatU, LuiOp)     X(FormatU, AuipcOp)                                     \
+    X(FormatFence, FenceOp)                                                       \
+    X(FormatFlw, FlwOp)   X(FormatFsw, FswOp)                                     \
+    X(FormatFR, FaddSOp)  X(FormatFR, FsubSOp)  X(FormatFR, FmulSOp)              \
+    X(FormatFR, FdivSOp)  X(FormatFR, FsqrtSOp)                                   \
+    X(FormatFR, FsgnjSOp) X(FormatFR, FsgnjnSOp) X(FormatFR, FsgnjxSOp)           \
+    X(FormatFR, FminSOp)  X(FormatFR, FmaxSOp)                                    \
+    X(FormatFCmp, FeqSOp) X(FormatFCmp, FltSOp) X(FormatFCmp, FleSOp)             \
+    X(FormatF2I, FcvtWSOp) X(FormatF2I, FcvtWUSOp) X(FormatF2I, FmvXWOp)          \
+    X(FormatI2F, FcvtSWOp) X(FormatI2F, FcvtSWUOp) X(FormatI2F, FmvWXOp)          \
+    X(FormatFR4, FmaddSOp) X(FormatFR4, FmsubSOp)                                 \
+    X(FormatFR4, FnmsubSOp) X(FormatFR4, FnmaddSOp)
+
+#define RV32I_CONTROL_OPS(X)                                                      \
+    X(FormatB, BeqOp)     X(FormatB, BneOp)     X(FormatB, BltOp)                 \
+    X(FormatB, BgeOp)     X(FormatB, BltuOp)    X(FormatB, BgeuOp)                \
+    X(FormatJ, JalOp)     X(FormatJalr, JalrOp)
+
+//> Superinstructions: compiler idioms run as one op, as (name, first, second).
+//> The first instruction's result must feed the second, see fuse_pair().
+
+#define RV32I_FUSED_STRAIGHT_OPS(X)                                               \
+    X(LUI_ADDI,   FormatU, LuiOp,   FormatI, AddiOp)     /* li   */               \
+    X(AUIPC_ADDI, FormatU, AuipcOp, FormatI, AddiOp)     /* la   */
+
+#define RV32I_FUSED_CONTROL_OPS(X)                                                \
+    X(AUIPC_JALR, FormatU, AuipcOp, FormatJalr, JalrOp)  /* call */               \
+    X(SLT_BEQ,    FormatR, SltOp,   FormatB, BeqOp)                               \
+    X(SLT_BNE,    FormatR, SltOp,   FormatB, BneOp)                               \
+    X(SLTU_BEQ,   FormatR, SltuOp,  FormatB, BeqOp)                               \
+    X(SLTU_BNE,   FormatR, SltuOp,  FormatB, BneOp)                               \
+    X(ADDI_BNE,   FormatI, AddiOp,  FormatB, BneOp)      /* loop counter */
+
+#define RV32I_OP_ID(FORMAT, OPER) OP_##FORMAT##_##OPER,
+#define RV32I_FUSED_ID(NAME, F1, O1, F2, O2) OP_FUSED_##NAME,
+
+enum BlockOpId : u16
+{
+    RV32I_STRAIGHT_OPS(RV32I_OP_ID)
+    RV32I_CONTROL_OPS(RV32I_OP_ID)
+
+    OP_EXIT_CALL, // handler the engine does not know: call it and leave the block
+    OP_END,       // block cut by length or page end: fall through to end_pc
+    OP_LOOP,      // end of a loop trace: back to its first op
+
+    // Only ever set on the first op of a pair; the second keeps its own id
+    RV32I_FUSED_STRAIGHT_OPS(RV32I_FUSED_ID)
+    RV32I_FUSED_CONTROL_OPS(RV32I_FUSED_ID)
+
+    OP_COUNT
+};
+
+#undef RV32I_OP_ID
+#undef RV32I_FUSED_ID
+
+inline constexpr u16 OP_FIRST_CONTROL = OP_FormatB_BeqOp; // ops from here on end a block
+
+//> Fused id for two adjacent ops, or OP_COUNT when they are not a known pair
+constexpr u16 fused_op(u16 first, u16 second)
+{
+#define RV32I_FUSED_MATCH(NAME, F1, O1, F2, O2)                                   \
+    if (first == OP_##F1##_##O1 && second == OP_##F2##_##O2)                      \
+        return OP_FUSED_##NAME;
+
+    RV32I_FUSED_STRAIGHT_OPS(RV32I_FUSED_MATCH)
+    RV32I_FUSED_CONTROL_OPS(RV32I_FUSED_MATCH)
+
+#undef RV32I_FUSED_MATCH
+
+    return OP_COUNT;
+}
+
+//> Plain id of the first instruction of a fused op; other ids map to themselves
+constexpr u16 unfused_op(u16 op)
+{
+#define RV32I_FUSED_FIRST(NAME, F1, O1, F2, O2)                                   \
+    if (op == OP_FUSED_##NAME)                                                    \
+        return OP_##F1##_##O1;
+
+    RV32I_FUSED_STRAIGHT_OPS(RV32I_FUSED_FIRST)
+    RV32I_FUSED_CONTROL_OPS(RV32I_FUSED_FIRST)
+
+#undef RV32I_FUSED_FIRST
+
+    return op;
+}
+
+struct BlockOp
+{
+    InstrInfo info;
+    Handler   handler = nullptr;
+    u16       op      = OP_END;
+    u32       next    = 0; // traces only: pc the recorded path went on at after this op
+};
+
+struct Block;
+
+//> Host code for a whole block (see Jit.hpp). Runs it against s.regs, writes
+//> the next pc to *pc and returns the status; on a trap *pc is the faulting pc.
+using NativeBlock = ExecutionStatus (*)(InterpreterState* s, u32* regs, u32* pc);
+
+//> Statically known successor of a block, patched to point at the successor
+//> once that has been translated
+struct BlockLink
+{
+    u32    pc     = 0;
+    Block* target = nullptr;
+};
+
+struct Block
+{
+    u32 start_pc = 0;
+    u32 end_pc   = 0; // pc after the last instruction
+    u32 length   = 0; // guest instructions
+    u32 fused    = 0; // instruction pairs run as one op
+
+    std::vector<BlockOp> ops; // always ends with a control op, OP_EXIT_CALL, OP_END or OP_LOOP
+
+    std::array<BlockLink, 2> exits{}; // jal/branch target, then fall-through
+    u32                      num_exits = 0;
+
+    BlockLink ret{}; // where a call made by this block returns to (end_pc)
+
+    BlockLink trace{};     // loop trace headed by this block, see Trace.hpp
+    u32       loop_heat = 0; // backward branches taken into this block
+
+    std::vector<Block**> incoming; // link slots of other blocks that point here
+    std::vector<u32>     pages;    // guest pages the ops come from, each once
+
+
+    NativeBlock native = nullptr; // set once the JIT has compiled the block
+    u32         heat   = 0;       // whole runs so far, counted while the JIT is on
+
+    bool valid = true;
+};
+
+class BlockCache
+{
+    static constexpr u32 PAGE_SIZE  = SparseMemory::PAGE_SIZE;
+    static constexpr u32 MAX_BLOCKS = 1u << 16; // the whole cache is flushed past this
+
+    std::unordered_map<u32, std::unique_ptr<Block>> blocks_;  // by start pc
+    std::unordered_map<u32, std::vector<u32>>       by_page_; // page -> start pcs
+    std::vector<std::unique_ptr<Block>>             retired_; // may still be running
+
+    u64 epoch_ = 1; // bumped whenever blocks are dropped
+
+    //> Cuts every link into and out of b
+    static void unlink(Block& b)
+    {
+        for (Block** slot : b.incoming)
+            *slot = nullptr;
+
+        b.incoming.clear();
+
+        auto drop = [](BlockLink& exit) {
+            if (!exit.target)
+                return;
+
+            auto& in = exit.target->incoming;
+            in.erase(std::remove(in.begin(), in.end(), &exit.target), in.end());
+
+            exit.target = nullptr;
+        };
+
+        for (u32 i = 0; i < b.num_exits; ++i)
+            drop(b.exits[i]);
+
+        drop(b.ret);
+        drop(b.trace);
+    }
+
+    //> Takes b out of the lists of every page it was indexed under
+    void unindex(const Block& b)
+    {
+        for (u32 page : b.pages)
+        {
+            auto it = by_page_.find(page);
+
+            if (it == by_page_.end())
+                continue;
+
+            auto& pcs = it->second;
+            pcs.erase(std::remove(pcs.begin(), pcs.end(), b.start_pc), pcs.end());
+
+            if (pcs.empty())
+                by_page_.erase(it);
+        }
+    }
+
+    void retire(std::unique_ptr<Block> b)
+    {
+        unlink(*b);
+
+        b->valid = false;
+        retired_.push_back(std::move(b));
+        ++stats.invalidated;
+    }
+
+public:
+
+    struct Stats
+    {
+        u64 translated  = 0;
+        u64 invalidated = 0;
+        u64 executed    = 0;
+        u64 flushes     = 0;
+
+        u64 chained     = 0; // exits that followed a patched link
+        u64 unchained   = 0; // static exits that still needed a lookup
+        u64 indirect    = 0; // jalr/ecall exits, always looked up
+
+        u64 fused       = 0; // fused pairs run by whole blocks
+    };
+
+    Stats stats;
+
+    Block* find(u32 pc) const
+    {
+        auto it = blocks_.find(pc);
+
+        return it == blocks_.end() ? nullptr : it->second.get();
+    }
+
+    Block* insert(std::unique_ptr<Block> b)
+    {
+        if (blocks_.size() >= MAX_BLOCKS) [[unlikely]]
+        {
+            clear();
+            ++stats.flushes;
+        }
+
+        Block* raw = b.get();
+
+        // Traces may cover many pages, and come back to one, so index every
+        // page an op comes from once
+        raw->pages.clear();
+
+        for (const BlockOp& op : raw->ops)
+        {
+            const u32 page = op.info.pc / PAGE_SIZE;
+
+            if (op.op == OP_END || op.op == OP_LOOP)
+                continue;
+
+            if (std::find(raw->pages.begin(), raw->pages.end(), page) == raw->pages.end())
+                raw->pages.push_back(page);
+        }
+
+        for (u32 page : raw->pages)
+            by_page_[page].push_back(raw->start_pc);
+
+        blocks_[raw->start_pc] = std::move(b);
+        ++stats.translated;
+
+        return raw;
+    }
+
+    //> Patches one of from's exits to jump straight to `to`
+    static void link(BlockLink& exit, Block* to)
+    {
+        exit.target = to;
+        to->incoming.push_back(&exit.target);
+    }
+
+    //> Drops every block with code on the page, and with it from the index of
+    //> every other page it covers. Dropped blocks stay allocated until
+    //> reclaim(), because the engine may be in the middle of one.
+    void invalidatePage(u32 page_index)
+    {
+        auto it = by_page_.find(page_index);
+
+        if (it == by_page_.end())
+            return;
+
+        ++epoch_;
+
+        const std::vector<u32> pcs = std::move(it->second);
+        by_page_.erase(it);
+
+        for (u32 pc : pcs)
+        {
+            auto b = blocks_.find(pc);
+
+            if (b != blocks_.end())
+            {
+                unindex(*b->second);
+                retire(std::move(b->second));
+                blocks_.erase(b);
+            }
+        }
+    }
+
+    //> Start pcs indexed under the page; a block covering it shows up once
+    size_t indexed(u32 page_index) const
+    {
+        auto it = by_page_.find(page_index);
+
+        return it == by_page_.end() ? 0 : it->second.size();
+    }
+
+    void clear()
+    {
+        ++epoch_;
+
+        for (auto& [pc, b] : blocks_)
+            retire(std::move(b));
+
+        blocks_.clear();
+        by_page_.clear();
+    }
+
+    //> Block pointers kept outside the cache are only valid while this is unchanged
+    u64 epoch() const { return epoch_; }
+
+    //> Frees dropped blocks; only call when no block is executing
+    void reclaim() { retired_.clear(); }
+
+    bool hasRetired() const { return !retired_.empty(); }
+};
+
+} // namespace rv32i
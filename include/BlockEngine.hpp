@@ -0,0 +1,28 @@
+#pragma once
+
+//> Threaded basic-block engine.
+//> Blocks are translated from the decode cache on first entry and run with
+//> computed goto (GCC/Clang) or a switch loop elsewhere. Straight-line ops
+//> skip the pc update; the pc and the cycle count are written once per block.
+//> Optional tiers on top: hot blocks compiled to host code (Jit.hpp) and hot
+//> loops recorded into traces (Trace.hpp), and below: cold code left to the
+//> interpreter until it is entered often enough (Tiering.hpp).
+
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+
+namespace rv32i {
+
+//> Op id the engine runs a handler as, OP_EXIT_CALL for handlers it does not know
+u16 block_op(Handler h);
+
+struct BlockEngineConfig
+{
+    bool jit    = false; // compile blocks that ran Jit::hot_threshold times
+    bool traces = false; // record loops whose header got TraceRecorder::hot_loop back edges
+    bool tiered = false; // interpret entries until they were reached TierManager::warm_threshold times
+};
+
+ExecutionResult run_blocks(Interpreter& cpu, size_t cycle_limit, BlockEngineConfig config = {});
+
+} // namespace rv32i
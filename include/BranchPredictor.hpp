@@ -0,0 +1,86 @@
+#pragma once
+
+//> Per-hart prediction of indirect (jalr) block exits for the block engine.
+//> A shadow return-address stack covers returns, a small direct-mapped cache
+//> keyed by the jalr address covers everything else. Entries carry the
+//> BlockCache epoch they were made in and are ignored once it moves on, so a
+//> dropped block is never reached through them.
+
+#include <array>
+
+#include "Block.hpp"
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+class BranchPredictor
+{
+public:
+
+    static constexpr u32 RAS_DEPTH = 32;
+    static constexpr u32 ITC_SIZE  = 512;
+
+    struct ReturnEntry
+    {
+        u32        pc    = 0;
+        Block*     block = nullptr; // successor block at pc, if known at push time
+        BlockLink* fill  = nullptr; // caller's return link, patched on first return
+        u64        epoch = 0;
+    };
+
+    struct IndirectEntry
+    {
+        u32    site  = ~0u; // pc of the jalr
+        u32    pc    = 0;
+        Block* block = nullptr;
+        u64    epoch = 0;
+    };
+
+    struct Stats
+    {
+        u64 ras_hits   = 0;
+        u64 ras_misses = 0;
+        u64 itc_hits   = 0;
+        u64 itc_misses = 0;
+    };
+
+    Stats stats;
+
+    void push(u32 ret_pc, BlockLink* fill, u64 epoch)
+    {
+        ras_top_ = (ras_top_ + 1) % RAS_DEPTH;
+
+        ras_[ras_top_] = {ret_pc, fill ? fill->target : nullptr, fill, epoch};
+    }
+
+    //> Top of the stack; an overflowed or empty stack simply mispredicts
+    ReturnEntry pop()
+    {
+        ReturnEntry e = ras_[ras_top_];
+
+        ras_[ras_top_] = {};
+        ras_top_ = (ras_top_ + RAS_DEPTH - 1) % RAS_DEPTH;
+
+        return e;
+    }
+
+    IndirectEntry& site(u32 jalr_pc) { return itc_[(jalr_pc / 4) % ITC_SIZE]; }
+
+    void reset()
+    {
+        ras_.fill({});
+        itc_.fill({});
+        ras_top_ = 0;
+    }
+
+private:
+
+    std::array<ReturnEntry, RAS_DEPTH>  ras_{};
+    std::array<IndirectEntry, ITC_SIZE> itc_{};
+    u32                                 ras_top_ = 0;
+};
+
+//> RISC-V calling convention: x1 (ra) and x5 (t0) hold return addresses
+inline bool is_link_reg(u8 r) { return r == 1 || r == 5; }
+
+} // namespace rv32i
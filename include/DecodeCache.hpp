@@ -0,0 +1,109 @@
+#pragma once
+
+//> Predecoded instruction cache, one slot per word of every guest page that has
+//> been executed. A slot keeps the decoded InstrInfo together with the resolved
+//> handler; a null handler means the slot has not been decoded yet.
+
+#include <array>
+#include <memory>
+#include <unordered_map>
+
+#include "HandlerFactory.hpp"
+#include "InstrInfo.hpp"
+#include "Memory.hpp"
+#include "Status.hpp"
+
+namespace rv32i {
+
+struct DecodedInstr
+{
+    InstrInfo info;
+    Handler   handler = nullptr;
+};
+
+//> Stands in for keys without a registered handler, so a decoded slot is never null
+inline ExecutionStatus trap_illegal(InterpreterState&, InstrInfo const&)
+{
+    return ExecutionStatus::TrapIllegal;
+}
+
+//> Stands in for instructions on pages the guest may not execute; never cached
+inline ExecutionStatus trap_fetch(InterpreterState& s, InstrInfo const& info)
+{
+    s.fault_addr = info.pc;
+    return ExecutionStatus::TrapFetchFault;
+}
+
+class DecodeCache
+{
+    static constexpr u32 PAGE_SIZE = SparseMemory::PAGE_SIZE;
+    static constexpr u32 SLOTS     = PAGE_SIZE / 4;
+
+    struct CachedPage
+    {
+        std::array<DecodedInstr, SLOTS> slots{};
+    };
+
+    std::unordered_map<u32, std::unique_ptr<CachedPage>> pages_;
+
+    u32         last_index_ = ~0u;
+    CachedPage* last_       = nullptr;
+
+    CachedPage* page(u32 page_index)
+    {
+        auto& p = pages_[page_index];
+
+        if (!p)
+            p = std::make_unique<CachedPage>();
+
+        return p.get();
+    }
+
+public:
+
+    struct Stats
+    {
+        u64 hits          = 0;
+        u64 misses        = 0;
+        u64 invalidations = 0;
+    };
+
+    Stats stats;
+
+    //> Slot for a word-aligned pc; consecutive fetches from one page skip the map
+    DecodedInstr& slot(u32 pc)
+    {
+        const u32 index = pc / PAGE_SIZE;
+
+        if (index != last_index_) [[unlikely]]
+        {
+            last_       = page(index);
+            last_index_ = index;
+        }
+
+        return last_->slots[(pc % PAGE_SIZE) / 4];
+    }
+
+    //> Drops the decoded slots of a page. Storage is kept, so an InstrInfo that
+    //> is currently executing stays valid.
+    void invalidatePage(u32 page_index)
+    {
+        auto it = pages_.find(page_index);
+
+        if (it == pages_.end())
+            return;
+
+        for (auto& d : it->second->slots)
+            d.handler = nullptr;
+
+        ++stats.invalidations;
+    }
+
+    void clear()
+    {
+        for (auto& [index, p] : pages_)
+            invalidatePage(index);
+    }
+};
+
+} // namespace rv32i
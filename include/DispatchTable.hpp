@@ -0,0 +1,104 @@
+#pragma once
+
+//> Dense handler table indexed directly by the decoder key.
+//> Regular keys are `opcode | funct3 << 8 | funct7 << 16`: the opcode selects a
+//> sub-table and funct3/funct7 index into it. Keys outside that layout (the
+//> ZBB_KEY_* values) live in a small side table; any other key is refused.
+
+#include <array>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#include "HandlerFactory.hpp"
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+class DispatchTable
+{
+    static constexpr u32 OPCODE_COUNT = 128;
+    static constexpr u32 FUNCT_COUNT  = 8 * 128;     // funct3 | funct7 << 3
+    static constexpr u32 KEY_MASK     = 0x007F077Fu; // funct7 | funct3 | opcode
+    static constexpr u32 EXT_BASE     = 0x80000100u; // see Zbb.hpp
+    static constexpr u32 EXT_COUNT    = 256;
+
+    using SubTable = std::array<Handler, FUNCT_COUNT>;
+
+    std::array<u8, OPCODE_COUNT> top_{};          // opcode -> sub-table, 0 is the empty one
+    std::vector<SubTable>        subtables_ = std::vector<SubTable>(1);
+    std::array<Handler, EXT_COUNT> ext_{};
+
+    static constexpr u32 opcode_of(u32 key) { return key & 0x7Fu; }
+    static constexpr u32 funct_of(u32 key)  { return ((key >> 8) & 0x7u) | ((key >> 13) & 0x3F8u); }
+
+    static constexpr u32 key_of(u32 opcode, u32 funct)
+    {
+        return opcode | ((funct & 0x7u) << 8) | ((funct >> 3) << 16);
+    }
+
+    Handler find_extended(u32 key) const
+    {
+        if ((key & ~(EXT_COUNT - 1)) != EXT_BASE)
+            return nullptr;
+
+        return ext_[key & (EXT_COUNT - 1)];
+    }
+
+public:
+
+    //> Throws for a key neither the opcode/funct layout nor the side table can hold
+    void insert(u32 key, Handler h)
+    {
+        if (key & ~KEY_MASK)
+        {
+            if ((key & ~(EXT_COUNT - 1)) != EXT_BASE)
+                throw std::runtime_error("Handler key outside the dispatch table: " + std::to_string(key));
+
+            ext_[key & (EXT_COUNT - 1)] = h;
+            return;
+        }
+
+        u8& slot = top_[opcode_of(key)];
+
+        if (slot == 0)
+        {
+            subtables_.emplace_back();
+            slot = static_cast<u8>(subtables_.size() - 1);
+        }
+
+        subtables_[slot][funct_of(key)] = h;
+    }
+
+    //> nullptr when nothing is registered for the key
+    Handler find(u32 key) const
+    {
+        if (key & ~KEY_MASK) [[unlikely]]
+            return find_extended(key);
+
+        return subtables_[top_[opcode_of(key)]][funct_of(key)];
+    }
+
+    //> Visits every registered (key, handler) pair
+    template<typename F>
+    void for_each(F&& f) const
+    {
+        for (u32 op = 0; op < OPCODE_COUNT; ++op)
+        {
+            if (top_[op] == 0)
+                continue;
+
+            const SubTable& sub = subtables_[top_[op]];
+
+            for (u32 fn = 0; fn < FUNCT_COUNT; ++fn)
+                if (sub[fn])
+                    f(key_of(op, fn), sub[fn]);
+        }
+
+        for (u32 i = 0; i < EXT_COUNT; ++i)
+            if (ext_[i])
+                f(EXT_BASE | i, ext_[i]);
+    }
+};
+
+} // namespace rv32i
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <istream>
 #include <string>
 #include <vector>
 #include "IntTypes.hpp"
@@ -7,18 +8,46 @@
 
 namespace rv32i {
 
+//> Where the loader puts the stack and heap, and whether the guest is held to
+//> its permissions. With protect on only the PT_LOAD segments (as their flags
+//> say), the heap up to the break and the stack are accessible; anything else
+//> faults until brk or mmap hands it out (see AddressSpace.hpp).
+//> With demand_paging on, segment pages are mapped from the file rather than
+//> copied, and the host only reads the ones the guest touches.
+struct GuestLayout
+{
+    u32  stack_top     = 0;          // 0: at least 16 MiB, 1 MiB above the image and above the heap
+    u32  stack_size    = 8u << 20;   // read/write below stack_top
+    u32  heap_size     = 64u << 20;  // how far brk may go past the image, up to the stack
+    bool protect       = true;
+    bool demand_paging = true;       // path loads only; a stream is always copied
+};
+
 struct ElfLoadResult
 {
     u32 entry     = 0; // inital pc
     u32 min_vaddr = 0xFFFFFFFF; // lowest mapped vaddr
     u32 max_vaddr = 0; // highest mapped segment addr (vaddr + memsz)
     u32 sp        = 0; // initial sp
+    u32 text_begin = 0xFFFFFFFF; // span of the executable segments
+    u32 text_end   = 0;
+    u32 heap_begin  = 0; // page after the image
+    u32 heap_end    = 0; // highest break
+    u32 stack_limit = 0; // lowest stack address
 };
 
 ElfLoadResult loadElf(Interpreter& cpu,
                       const std::string& elf_path,
                       const std::vector<std::string>& args,
-                      u32 stack_top_hint
+                      const GuestLayout& layout = {}
+                     );
+
+//> Same, for an image that is already in memory; elf_name stands in for the path
+ElfLoadResult loadElf(Interpreter& cpu,
+                      std::istream& elf,
+                      const std::string& elf_name,
+                      const std::vector<std::string>& args,
+                      const GuestLayout& layout = {}
                      );
 
 } // namespace rv32i
@@ -0,0 +1,94 @@
+#pragma once
+
+//> The guest's files: descriptors from 3 up, each a host descriptor opened
+//> under the guest's root directory. Paths are resolved inside the root as if
+//> it were "/": absolute paths start there and ".." stops there. On Linux the
+//> host resolves symlinks the same way (openat2 with RESOLVE_IN_ROOT); where
+//> it can't, the last component may not be a symlink, but one further up the
+//> path can still lead out.
+//>
+//> Open flags and stat come in and go out the way the RISC-V Linux ABI has
+//> them; errors are the host's errno values, which are the guest's on Linux.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "IntTypes.hpp"
+#include "IoBackend.hpp"
+#include "MappedFile.hpp"
+
+namespace rv32i {
+
+class FileTable
+{
+    struct File
+    {
+        int                               host = -1;
+        bool                              readable = false;
+        std::string                       path;   // inside the root, for openat() relative to it
+        std::shared_ptr<const MappedFile> mapped; // for mmap, while the file stays the same size
+    };
+
+    std::vector<File> files_; // by guest fd - FIRST
+    std::string       root_ = ".";
+    int               root_fd_ = -1;
+
+    const File* find(u32 fd) const;
+
+public:
+
+    static constexpr u32 FIRST     = 3;
+    static constexpr u32 MAX_FILES = 1024;
+
+    static constexpr s32 CWD       = -100; // the guest's AT_FDCWD
+
+    //> Size of the guest's struct stat: the rv64 layout, which RISC-V newlib
+    //> uses on RV32 as well (64-bit sizes, inode numbers and times)
+    static constexpr u32 STAT_SIZE = 128;
+
+    FileTable() = default;
+    ~FileTable();
+
+    FileTable(const FileTable&)            = delete;
+    FileTable& operator=(const FileTable&) = delete;
+
+    //> Closes everything here and takes over parent's root and open files,
+    //> as fork(2) does: each fd is a duplicate of the parent's host
+    //> descriptor, which it shares its offset with
+    void forkFrom(const FileTable& parent);
+
+    //> Directory the guest sees as "/"; files already open stay open
+    void setRoot(std::string path);
+    const std::string& root() const { return root_; }
+
+    //> Guest fd, or -errno. dirfd is CWD (AT_FDCWD: the root) or a directory the
+    //> guest opened. O_TRUNC on a file that is mapped (see MappedFile::mapped())
+    //> is -ETXTBSY.
+    s32 open(s32 dirfd, const std::string& path, u32 flags, u32 mode);
+    s32 close(u32 fd);
+
+    //> Host descriptor behind a guest fd, -1 if it is not open
+    int host(u32 fd) const;
+
+    //> One readv/writev on fd, or preadv/pwritev at offset if it is not
+    //> negative; as IoBackend, bytes moved or -errno
+    s64 transfer(u32 fd, bool out, const IoSpan* spans, int count, s64 offset);
+
+    //> New offset, or -errno
+    s64 seek(u32 fd, s64 offset, u32 whence);
+
+    //> The whole file behind fd mapped into the host, for the guest's mmap;
+    //> every mapping of it shares one until its size changes. 0 or -errno:
+    //> -EACCES if it was not opened for reading, -ENODEV if it can't be
+    //> mapped (the standard streams never can).
+    s32 map(u32 fd, std::shared_ptr<const MappedFile>& out);
+
+    //> The guest's struct stat for a host descriptor; 0 or -errno
+    static s32 statHost(int host_fd, u8 (&out)[STAT_SIZE]);
+
+    //> For streams that have no host descriptor: an empty pipe
+    static void statStream(u8 (&out)[STAT_SIZE]);
+};
+
+} // namespace rv32i
@@ -2,7 +2,10 @@
 
 //> Unified Format abstractions
 //> Each Format implements a template `execute<Oper>(state, info)` that performs the
-//> shared operand extraction and calls Oper's semantics
+//> shared operand extraction and calls Oper's semantics.
+//> Straight-line formats only implement `apply<Oper>` (everything except the pc
+//> step) and get `execute` from Sequential, so block engines can run a sequence
+//> of them and write the pc back once.
 
 #include "IntTypes.hpp"
 #include "InterpreterState.hpp"
@@ -12,10 +15,32 @@
 
 namespace rv32i {
 
-struct FormatR
+//> Records where a guest access faulted and returns its trap
+inline ExecutionStatus access_fault(InterpreterState& s, u32 addr, ExecutionStatus trap)
+{
+    s.fault_addr = addr;
+    return trap;
+}
+
+template<typename Format>
+struct Sequential
 {
     template<typename Oper>
     static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    {
+        ExecutionStatus st = Format::template apply<Oper>(s, info);
+
+        if (st == ExecutionStatus::Success)
+            s.pc = info.pc + 4u;
+
+        return st;
+    }
+};
+
+struct FormatR : Sequential<FormatR>
+{
+    template<typename Oper>
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
 
         u32 a = s.regs[info.rs1];
@@ -28,16 +53,14 @@ struct FormatR
         if (info.rd != 0)
             s.regs[info.rd] = r;
 
-        s.pc = info.pc + 4u;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatFR
+struct FormatFR : Sequential<FormatFR>
 {
     template<typename Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
 
         u32 a = s.fregs[info.rs1];
@@ -49,16 +72,14 @@ struct FormatFR
 
         s.fregs[info.rd] = r;
 
-        s.pc = info.pc + 4u;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatFR4
+struct FormatFR4 : Sequential<FormatFR4>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         u32 a = s.fregs[info.rs1];
         u32 b = s.fregs[info.rs2];
@@ -66,16 +87,14 @@ struct FormatFR4
 
         s.fregs[info.rd] = Oper::exec(a, b, c);
 
-        s.pc = info.pc + 4;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatF2I
+struct FormatF2I : Sequential<FormatF2I>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         const u32 a = s.fregs[info.rs1];
         const u32 b = s.fregs[info.rs2];
@@ -83,32 +102,28 @@ struct FormatF2I
         if (info.rd != 0)
             s.regs[info.rd] = Oper::exec(a, b);
 
-        s.pc = info.pc + 4;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatI2F
+struct FormatI2F : Sequential<FormatI2F>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         const u32 a = s.regs[info.rs1];
         const u32 b = s.fregs[info.rs2];
 
         s.fregs[info.rd] = Oper::exec(a, b);
 
-        s.pc = info.pc + 4;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatFCmp
+struct FormatFCmp : Sequential<FormatFCmp>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         const u32 a = s.fregs[info.rs1];
         const u32 b = s.fregs[info.rs2];
@@ -116,49 +131,49 @@ struct FormatFCmp
         if (info.rd != 0)
             s.regs[info.rd] = Oper::exec(a, b);
 
-        s.pc = info.pc + 4;
-
         return ExecutionStatus::Success;
     }
 };
 
 
-struct FormatFlw
+struct FormatFlw : Sequential<FormatFlw>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         const u32 addr = s.regs[info.rs1] + info.imm; // FIXME: signed?
 
-        if (info.rd != 0)
-            s.fregs[info.rd] = s.memory.LoadU32(addr);
+        u32 val = 0;
 
-        s.pc = info.pc + 4;
+        if (!s.memory.TryLoad(addr, val)) [[unlikely]]
+            return access_fault(s, addr, ExecutionStatus::TrapLoadFault);
+
+        // f0 is an ordinary register, unlike x0
+        s.fregs[info.rd] = val;
 
         return ExecutionStatus::Success;
     }
 };
 
 // FSW: store f[rs2] to addr = x[rs1] + imm
-struct FormatFsw
+struct FormatFsw : Sequential<FormatFsw>
 {
     template<class Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         const u32 addr = s.regs[info.rs1] + (s32)info.imm;
 
-        s.memory.StoreU32(addr, s.fregs[info.rs2]);
-
-        s.pc = info.pc + 4;
+        if (!s.memory.TryStore(addr, s.fregs[info.rs2])) [[unlikely]]
+            return access_fault(s, addr, ExecutionStatus::TrapStoreFault);
 
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatI
+struct FormatI : Sequential<FormatI>
 {
     template<typename Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         u32 a = s.regs[info.rs1];
         s32 imm = static_cast<s32>(info.imm);
@@ -168,69 +183,68 @@ struct FormatI
         if (info.rd != 0)
             s.regs[info.rd] = r;
 
-        s.pc = info.pc + 4u;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatLoad  //> load variants handled by Oper type selection
+struct FormatLoad : Sequential<FormatLoad>  //> load variants handled by Oper type selection
 {
     template<typename Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         u32 addr = s.regs[info.rs1] + static_cast<s32>(info.imm);
 
+        using T = std::conditional_t<std::is_same_v<Oper, LbOp> || std::is_same_v<Oper, LbuOp>, u8,
+                  std::conditional_t<std::is_same_v<Oper, LhOp> || std::is_same_v<Oper, LhuOp>, u16, u32>>;
+
+        T val = 0;
+
+        if (!s.memory.TryLoad(addr, val)) [[unlikely]]
+            return access_fault(s, addr, ExecutionStatus::TrapLoadFault);
+
         if constexpr (std::is_same_v<Oper, LbOp>)
         {
-            s.regs[info.rd] = static_cast<s32>(static_cast<int8_t>(s.memory.LoadU8(addr)));
-        }
-        else if constexpr (std::is_same_v<Oper, LbuOp>)
-        {
-            s.regs[info.rd] = s.memory.LoadU8(addr);
+            s.regs[info.rd] = static_cast<s32>(static_cast<int8_t>(val));
         }
         else if constexpr (std::is_same_v<Oper, LhOp>)
         {
-            s.regs[info.rd] = static_cast<s32>(static_cast<s16>(s.memory.LoadU16(addr)));
-        }
-        else if constexpr (std::is_same_v<Oper, LhuOp>)
-        {
-            s.regs[info.rd] = s.memory.LoadU16(addr);
+            s.regs[info.rd] = static_cast<s32>(static_cast<s16>(val));
         }
         else
         {
-            s.regs[info.rd] = s.memory.LoadU32(addr);
+            s.regs[info.rd] = val;
         }
 
-        s.pc = info.pc + 4u;
-
         return ExecutionStatus::Success;
     }
 };
 
-struct FormatS
+struct FormatS : Sequential<FormatS>
 {
     template<typename Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
         u32 addr = s.regs[info.rs1] + static_cast<s32>(info.imm);
 
         u32 val = s.regs[info.rs2];
 
+        bool ok;
+
         if constexpr (std::is_same_v<Oper, SbOp>)
         {
-            s.memory.StoreU8(addr, static_cast<u8>(val & 0xFF));
+            ok = s.memory.TryStore(addr, static_cast<u8>(val & 0xFF));
         }
         else if constexpr (std::is_same_v<Oper, ShOp>)
         {
-            s.memory.StoreU16(addr, static_cast<uint16_t>(val & 0xFFFF));
+            ok = s.memory.TryStore(addr, static_cast<uint16_t>(val & 0xFFFF));
         }
         else
         {
-            s.memory.StoreU32(addr, val);
+            ok = s.memory.TryStore(addr, val);
         }
 
-        s.pc = info.pc + 4u;
+        if (!ok) [[unlikely]]
+            return access_fault(s, addr, ExecutionStatus::TrapStoreFault);
 
         return ExecutionStatus::Success;
     }
@@ -257,10 +271,10 @@ struct FormatB
     }
 };
 
-struct FormatU
+struct FormatU : Sequential<FormatU>
 {
     template<typename Oper>
-    static ExecutionStatus execute(InterpreterState& s, InstrInfo const& info)
+    static ExecutionStatus apply(InterpreterState& s, InstrInfo const& info)
     {
 
         if constexpr (std::is_same_v<Oper, LuiOp>)
@@ -272,8 +286,20 @@ struct FormatU
             if (info.rd != 0) s.regs[info.rd] = info.pc + info.imm;
         }
 
-        s.pc = info.pc + 4u;
+        return ExecutionStatus::Success;
+    }
+};
 
+//> fence orders memory accesses, which one hart with no devices never reorders.
+//> fence.i makes earlier stores visible to instruction fetch: a store into a
+//> code page already drops whatever was decoded or translated from that page,
+//> so all that is left is to stop running code fetched before the fence. The
+//> block engine never runs fence.i inline, which ends the block or trace there.
+struct FormatFence : Sequential<FormatFence>
+{
+    template<typename Oper>
+    static ExecutionStatus apply(InterpreterState&, InstrInfo const&)
+    {
         return ExecutionStatus::Success;
     }
 };
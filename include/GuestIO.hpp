@@ -0,0 +1,80 @@
+#pragma once
+
+//> The guest's standard streams. READ and WRITE hand the backend the guest's
+//> own pages, a batch of spans that are contiguous on the host at a time (one
+//> readv/writev for host descriptors), with no copy in between. Only the first
+//> page's worth of a read, which is all most reads get, and small writes to
+//> stdout are copied, the latter into a buffer that goes out the way stdio
+//> would send it (see OutputBuffering); stderr is never buffered.
+//>
+//> The backend is the host's stdin, stdout and stderr unless the embedding
+//> program puts another one in (see IoBackend.hpp). Whatever is still buffered
+//> goes out on flush(), on the guest's exit and when the GuestIO goes away.
+//>
+//> Descriptors from 3 up are files the guest opened (see FileTable.hpp); their
+//> data goes between the host file and the guest's pages the same way.
+
+#include <memory>
+#include <vector>
+
+#include "FileTable.hpp"
+#include "IntTypes.hpp"
+#include "IoBackend.hpp"
+#include "Memory.hpp"
+
+namespace rv32i {
+
+enum class OutputBuffering
+{
+    Auto, // Line on a terminal, Full otherwise, decided on the first write
+    None, // every write goes out as it is made
+    Line, // after each write with a newline in it, like stdio on a terminal
+    Full  // when the buffer fills up
+};
+
+class GuestIO
+{
+    std::vector<u8> buffer_; // stdout, allocated on the first buffered write
+    size_t          pending_ = 0;
+
+    OutputBuffering mode();
+
+public:
+
+    static constexpr u32 BUFFER_SIZE = 64 * 1024;
+
+    std::shared_ptr<IoBackend> backend = std::make_shared<HostFdIo>(); // flush() before swapping it
+
+    OutputBuffering buffering = OutputBuffering::Auto;
+
+    FileTable files;
+
+    GuestIO() = default;
+    ~GuestIO() { flush(); }
+
+    GuestIO(const GuestIO&)            = delete;
+    GuestIO& operator=(const GuestIO&) = delete;
+
+    //> Bytes moved between guest fd and [addr, addr + len), or -errno as the
+    //> guest's a0 has it. Reads wait for len bytes or the end of the input.
+    u32 read(SparseMemory& m, u32 fd, u32 addr, u32 len);
+    u32 write(SparseMemory& m, u32 fd, u32 addr, u32 len);
+
+    //> Same at a file offset, which stays where it was; -ESPIPE on streams
+    u32 pread(SparseMemory& m, u32 fd, u32 addr, u32 len, u64 offset);
+    u32 pwrite(SparseMemory& m, u32 fd, u32 addr, u32 len, u64 offset);
+
+    //> New offset or -errno
+    s64 seek(u32 fd, s64 offset, u32 whence);
+
+    //> The guest's struct stat (FileTable::STAT_SIZE bytes); 0 or -errno
+    s32 stat(u32 fd, u8 (&out)[FileTable::STAT_SIZE]);
+
+    //> Closing stdout flushes it; the streams themselves stay usable
+    s32 close(u32 fd);
+
+    //> Sends what stdout buffered; 0, or the errno if the backend would not take it
+    int flush();
+};
+
+} // namespace rv32i
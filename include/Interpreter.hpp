@@ -1,39 +1,201 @@
 #pragma once
 
 #include <iostream>
-#include <unordered_map>
+#include <memory>
 #include <vector>
 
 #include "InterpreterState.hpp"
 #include "Status.hpp"
 #include "HandlerFactory.hpp"
+#include "DispatchTable.hpp"
+#include "DecodeCache.hpp"
+#include "Block.hpp"
+#include "BranchPredictor.hpp"
+#include "Jit.hpp"
+#include "Trace.hpp"
+#include "Tiering.hpp"
+#include "Decoder.hpp"
 
 namespace rv32i {
 
 class Interpreter
 {
-    std::unordered_map<u32, Handler> handlers_;
+    DispatchTable   handlers_;
+    DecodeCache     icache_;
+    BlockCache      blocks_;
+    BlockCache      traces_;
+    TraceRecorder   recorder_;
+    BranchPredictor predictor_;
+    Jit             jit_;
+    TierManager     tiers_;
+    DecodedInstr    uncached_; // fetches from misaligned pcs bypass the cache
+
+    struct Baseline
+    {
+        std::array<u32, 32> regs{};
+        std::array<u32, 32> fregs{};
+        u32                 pc = 0;
+        AddressSpace        vm;
+    };
+
+    Baseline        baseline_;
+
+    void decodeInto(DecodedInstr& d, u32 pc)
+    {
+        auto [info, key] = Decoder::decode(state.memory.LoadU32(pc), pc);
+
+        Handler h = handlers_.find(key);
+
+        d.info    = info;
+        d.handler = h ? h : trap_illegal;
+    }
+
+    const DecodedInstr& fetchFault(u32 pc)
+    {
+        uncached_.info    = InstrInfo{};
+        uncached_.info.pc = pc;
+        uncached_.handler = trap_fetch;
+
+        return uncached_;
+    }
 
 public:
 
-    Interpreter() = default;
+    explicit Interpreter(MemoryBackend backend = MemoryBackend::Sparse)
+        : state(backend)
+    {
+        state.memory.setCodeWriteHook([this](u32 page) {
+            icache_.invalidatePage(page);
+            blocks_.invalidatePage(page);
+            traces_.invalidatePage(page);
+        });
+    }
+
+    Interpreter(const Interpreter&)            = delete;
+    Interpreter& operator=(const Interpreter&) = delete;
 
     InterpreterState state;
 
-    void register_handler(u32 key, Handler h) { handlers_[key] = h; }
+    //> Throws std::runtime_error for a key DispatchTable has no slot for
+    void register_handler(u32 key, Handler h)
+    {
+        handlers_.insert(key, h);
+        icache_.clear();
+        blocks_.clear();
+        traces_.clear();
+    }
+
+    Handler handler(u32 key) const { return handlers_.find(key); }
+
+    //> Remembers registers, memory and its mappings as they are now (see
+    //> SparseMemory::markBaseline). Open files are left as they are.
+    void markBaseline()
+    {
+        baseline_ = {state.regs, state.fregs, state.pc, state.vm};
+        state.memory.markBaseline();
+    }
+
+    //> Back to the last markBaseline(): registers, the break and the mappings,
+    //> and the pages written or reprotected since
+    void resetToBaseline()
+    {
+        state.regs  = baseline_.regs;
+        state.fregs = baseline_.fregs;
+        state.pc    = baseline_.pc;
+        state.vm    = baseline_.vm;
+        state.memory.resetToBaseline();
+    }
+
+    //> A new interpreter that carries on from here: same registers, handlers,
+    //> thresholds and mappings, memory forked copy-on-write (see
+    //> SparseMemory::forkFrom), open files duplicated (see FileTable::forkFrom),
+    //> empty caches. The two share nothing mutable but file offsets, as after
+    //> fork(2), and may run on different threads.
+    std::unique_ptr<Interpreter> fork()
+    {
+        auto child = std::make_unique<Interpreter>(state.memory.backend());
+
+        child->handlers_ = handlers_;
+
+        child->state.regs  = state.regs;
+        child->state.fregs = state.fregs;
+        child->state.pc    = state.pc;
+        child->state.vm    = state.vm;
+        child->state.memory.forkFrom(state.memory);
+        child->state.io.files.forkFrom(state.io.files);
+
+        child->jit_.hot_threshold    = jit_.hot_threshold;
+        child->tiers_.warm_threshold = tiers_.warm_threshold;
+
+        return child;
+    }
+
+    const DispatchTable& handlers() const { return handlers_; }
 
     ExecutionStatus dispatch(InterpreterState& s, InstrInfo const& info, u32 key) const
     {
-        auto it = handlers_.find(key);
+        Handler h = handlers_.find(key);
 
-        if (it == handlers_.end())
+        if (!h)
         {
             return ExecutionStatus::TrapIllegal;
         }
 
-        return it->second(s, info);
+        return h(s, info);
     }
 
+    //> Decoded instruction at pc with its handler resolved; decodes on first use.
+    //> Execute permission is checked on the way into the cache only.
+    const DecodedInstr& fetch(u32 pc)
+    {
+        if (pc % 4 != 0) [[unlikely]]
+        {
+            if (!state.memory.allows(pc, 4, SparseMemory::PERM_X))
+                return fetchFault(pc);
+
+            decodeInto(uncached_, pc);
+            return uncached_;
+        }
+
+        DecodedInstr& d = icache_.slot(pc);
+
+        if (d.handler) [[likely]]
+        {
+            ++icache_.stats.hits;
+            return d;
+        }
+
+        ++icache_.stats.misses;
+
+        if (!state.memory.allows(pc, 4, SparseMemory::PERM_X)) [[unlikely]]
+            return fetchFault(pc);
+
+        state.memory.markCode(pc);
+        decodeInto(d, pc);
+
+        return d;
+    }
+
+    const DecodeCache::Stats& icacheStats() const { return icache_.stats; }
+
+    BlockCache&       blocks()       { return blocks_; }
+    const BlockCache& blocks() const { return blocks_; }
+
+    BlockCache&       traces()       { return traces_; }
+    const BlockCache& traces() const { return traces_; }
+
+    TraceRecorder&       recorder()       { return recorder_; }
+    const TraceRecorder& recorder() const { return recorder_; }
+
+    BranchPredictor&       predictor()       { return predictor_; }
+    const BranchPredictor& predictor() const { return predictor_; }
+
+    Jit&       jit()       { return jit_; }
+    const Jit& jit() const { return jit_; }
+
+    TierManager&       tiers()       { return tiers_; }
+    const TierManager& tiers() const { return tiers_; }
+
     template<typename T>
     T load(u32 addr) const
     {
@@ -60,11 +222,21 @@ public:
             static_assert(!sizeof(T*), "Unsupported Store<T> type");
     }
 
+    void readBlock(u32 addr, u8* dst, u32 len) const
+    {
+        state.memory.ReadBlock(addr, dst, len);
+    }
+
     void writeBlock(u32 addr, const u8* src, u32 len)
     {
         state.memory.WriteBlock(addr, src, len);
     }
 
+    void fill(u32 addr, u8 value, u32 len)
+    {
+        state.memory.Fill(addr, value, len);
+    }
+
     u32& pc() { return state.pc; }
     const u32& pc() const { return state.pc; }
 
@@ -1,6 +1,8 @@
 #pragma once
 
 #include <array>
+#include "AddressSpace.hpp"
+#include "GuestIO.hpp"
 #include "IntTypes.hpp"
 #include "Memory.hpp"
 
@@ -13,9 +15,14 @@ struct InterpreterState
 
     u32 pc = 0;
 
+    u32 fault_addr = 0; // guest address of the last load/store/fetch fault
+
     SparseMemory memory;
+    AddressSpace vm;     // what the image, brk, mmap and the stack took of it
+    GuestIO      io;     // the guest's stdin, stdout and stderr
 
-    InterpreterState() = default;
+    explicit InterpreterState(MemoryBackend backend = MemoryBackend::Sparse)
+        : memory(backend) {}
 };
 
 } // namespace rv32i
@@ -0,0 +1,98 @@
+#pragma once
+
+//> Where the guest's standard streams (fds 0, 1 and 2) really go. GuestIO does
+//> the guest's side of it (finding its pages, buffering stdout) and hands the
+//> backend spans of host memory, which stay valid only for the call:
+//>
+//>   HostFdIo    - host file descriptors, readv/writev straight on the spans
+//>   BufferIo    - stdin from a string, stdout and stderr captured in strings,
+//>                 for running guests in-process (tests, embedding)
+//>   CallbackIo  - whatever the embedding program does with the bytes
+//>
+//> read() and write() may move fewer bytes than asked, like readv/writev: 0
+//> from read() is the end of the input, a negative result is -errno (-EINTR
+//> is tried again).
+
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+struct IoSpan
+{
+    u8*    data;
+    size_t len;
+};
+
+class IoBackend
+{
+public:
+
+    virtual ~IoBackend() = default;
+
+    virtual s64 read(u32 fd, const IoSpan* spans, int count)  = 0;
+    virtual s64 write(u32 fd, const IoSpan* spans, int count) = 0;
+
+    //> Whether fd is someone typing: stdout is line buffered by default then
+    virtual bool interactive(u32 fd) const { (void)fd; return false; }
+
+    //> Host descriptor behind fd, for fstat; -1 if there is none
+    virtual int hostFd(u32 fd) const { (void)fd; return -1; }
+};
+
+class HostFdIo : public IoBackend
+{
+public:
+
+    int in_fd  = 0; // host descriptors behind guest fds 0, 1 and 2
+    int out_fd = 1;
+    int err_fd = 2;
+
+    HostFdIo() = default;
+    HostFdIo(int in, int out, int err = 2) : in_fd(in), out_fd(out), err_fd(err) {}
+
+    s64  read(u32 fd, const IoSpan* spans, int count) override;
+    s64  write(u32 fd, const IoSpan* spans, int count) override;
+    bool interactive(u32 fd) const override;
+
+    int hostFd(u32 fd) const override { return fd == 0 ? in_fd : fd == 1 ? out_fd : fd == 2 ? err_fd : -1; }
+};
+
+class BufferIo : public IoBackend
+{
+public:
+
+    std::string input;     // what the guest reads, from consumed on
+    size_t      consumed = 0;
+
+    std::string out;       // what it wrote to fds 1 and 2
+    std::string err;
+
+    BufferIo() = default;
+    explicit BufferIo(std::string in) : input(std::move(in)) {}
+
+    s64 read(u32 fd, const IoSpan* spans, int count) override;
+    s64 write(u32 fd, const IoSpan* spans, int count) override;
+};
+
+class CallbackIo : public IoBackend
+{
+public:
+
+    //> Bytes moved, 0 at the end of the input, or -errno
+    using ReadFn  = std::function<s64(u32 fd, u8* data, size_t len)>;
+    using WriteFn = std::function<s64(u32 fd, const u8* data, size_t len)>;
+
+    ReadFn  on_read;  // none: the input is empty
+    WriteFn on_write; // none: output is thrown away
+
+    CallbackIo(ReadFn r, WriteFn w) : on_read(std::move(r)), on_write(std::move(w)) {}
+
+    s64 read(u32 fd, const IoSpan* spans, int count) override;
+    s64 write(u32 fd, const IoSpan* spans, int count) override;
+};
+
+} // namespace rv32i
@@ -0,0 +1,78 @@
+#pragma once
+
+//> Baseline JIT: turns hot blocks into x86-64 code.
+//> Guest registers stay in InterpreterState::regs and are loaded and stored
+//> around every instruction, so the interpreter can take over after any block.
+//> Simple integer ops are emitted inline; every other straight-line op calls
+//> its Format::apply, so semantics stay shared with the other engines. Blocks
+//> that end in a call the engine does not know (ecall, illegal, ...) are left
+//> to the threaded engine.
+//>
+//> Only built for x86-64 Linux; elsewhere compile() always refuses.
+
+#include <cstddef>
+#include <vector>
+
+#include "Block.hpp"
+#include "IntTypes.hpp"
+
+#if defined(__x86_64__) && defined(__linux__)
+#define RV32I_JIT_SUPPORTED 1
+#else
+#define RV32I_JIT_SUPPORTED 0
+#endif
+
+namespace rv32i {
+
+class Jit
+{
+    static constexpr size_t CODE_SIZE = size_t(16) << 20;
+
+    u8*    code_  = nullptr; // mmap'd, read+exec except while a block is copied in
+    size_t used_  = 0;
+    bool   full_  = false;
+    bool   off_   = !RV32I_JIT_SUPPORTED; // no buffer, or the host refused to reprotect it
+
+    std::vector<u8> scratch_; // a block is assembled here first
+
+    bool disable();
+
+public:
+
+    static constexpr u32 DEFAULT_HOT_THRESHOLD = 32;
+
+    struct Stats
+    {
+        u64 compiled = 0;
+        u64 rejected = 0; // blocks left to the threaded engine
+        u64 executed = 0;
+        u64 flushes  = 0;
+    };
+
+    Stats stats;
+
+    u32 hot_threshold = DEFAULT_HOT_THRESHOLD; // whole threaded runs before compiling
+
+    Jit();
+    ~Jit();
+
+    Jit(const Jit&)            = delete;
+    Jit& operator=(const Jit&) = delete;
+
+    static constexpr bool supported() { return RV32I_JIT_SUPPORTED; }
+
+    //> Compiles b and sets b.native; false if the block has to stay threaded
+    bool compile(Block& b);
+
+    //> The code buffer ran out; every block has to be dropped before reset()
+    bool full() const { return full_; }
+
+    //> False once the host refused the code buffer; every block stays threaded
+    bool available() const { return !off_; }
+
+    void reset();
+
+    size_t codeBytes() const { return used_; }
+};
+
+} // namespace rv32i
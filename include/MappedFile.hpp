@@ -0,0 +1,60 @@
+#pragma once
+
+//> A file mapped read-only into the host, for loaders that want to hand guest
+//> pages straight out of it instead of copying. The host reads a page of the
+//> file the first time something looks at it. Where there is no mmap the file
+//> is read into memory instead, and fd() is -1.
+//>
+//> A mapped file must not shrink while it is mapped: the host faults (SIGBUS)
+//> on pages past its new end. mapped() tells whether a file is, so whatever
+//> would truncate it on the guest's behalf can refuse to.
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+class MappedFile
+{
+    const u8*       data_ = nullptr;
+    size_t          size_ = 0;
+    int             fd_   = -1;
+    u64             dev_  = 0;
+    u64             ino_  = 0;
+    std::vector<u8> copy_; // no mmap on this host
+
+    MappedFile() = default;
+
+    //> Maps the whole of fd, which it then owns; closes it on failure
+    static std::shared_ptr<MappedFile> map(int fd);
+
+public:
+
+    ~MappedFile();
+
+    MappedFile(const MappedFile&)            = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    //> Null if the file cannot be opened
+    static std::shared_ptr<MappedFile> open(const std::string& path);
+
+    //> The file behind a descriptor that is already open for reading, as it
+    //> is now; fd stays the caller's. Null if it is empty or can't be mapped
+    //> (a pipe, say), and wherever there is no mmap.
+    static std::shared_ptr<MappedFile> fromFd(int fd);
+
+    const u8* data() const { return data_; }
+    size_t    size() const { return size_; }
+
+    //> Open descriptor of the file, for mapping parts of it elsewhere; -1 if none
+    int fd() const { return fd_; }
+
+    //> Whether the file behind a host descriptor is mapped by a MappedFile
+    //> that is still around; thread safe
+    static bool mapped(int fd);
+};
+
+} // namespace rv32i
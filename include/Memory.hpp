@@ -2,50 +2,555 @@
 #include <iomanip>
 #include <iostream>
 #include <unordered_map>
+#include <algorithm>
 #include <array>
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <functional>
 #include <memory>
+#include <vector>
 #include "IntTypes.hpp"
+#include "PagePool.hpp"
+
+#if (defined(__unix__) || defined(__APPLE__)) && UINTPTR_MAX > 0xFFFFFFFFu
+#define RV32I_FLAT_MEMORY_SUPPORTED 1
+#else
+#define RV32I_FLAT_MEMORY_SUPPORTED 0
+#endif
 
 namespace rv32i {
 
+class MappedFile;
+
+enum class MemoryBackend
+{
+    Sparse, // page map, a page is allocated on its first store
+    Flat    // all 4 GiB reserved in host virtual memory, loads and stores are base + addr
+};
+
+//> Guest memory. Untouched addresses read as zero and numPages() counts the
+//> pages that were stored to (or marked as code), whatever the backend.
+//> Halfword and word accesses inside one page are a single host copy; only
+//> the ones that cross a page go byte by byte.
+//>
+//> The page map keeps small direct-mapped TLBs in front of its hash map, one
+//> for reads and one for writes, and takes its pages from a PagePool.
+//>
+//> mapFile() fills pages straight from a file the same way, as snapshots.
+//>
+//> forkFrom() turns a memory into a copy of another one. Between two page maps
+//> the copy is lazy: both sides point at the same pages, which become read-only
+//> snapshots, and whichever side writes a page first gets its own copy of it.
+//> Snapshot pages are never written again, so forks can run on other threads
+//> while the parent goes on; the pools they came from live as long as any of
+//> the memories that may share them, and count who holds each page, so a
+//> page goes back to its pool once the last relative copied or dropped it.
+//>
+//> Page map pages that are all zeros can share one read-only zero page
+//> (shareZeroPages(), and Fill() with zeros over a whole page), and pages that
+//> are the same in many memories can share one copy (mergePage(), see
+//> PageMerger.hpp); both are snapshots like a fork's.
+//>
+//> markBaseline() takes the same kind of snapshot of this memory for itself
+//> and starts recording which pages get written; resetToBaseline() puts back
+//> only those. Both backends find the first write to a page on the slow path
+//> they already have (a write TLB miss, a flag test), so tracking is free for
+//> every later store.
+//>
+//> The flat backend reserves the whole guest space once; the host commits a
+//> page on its first touch. Per-page flags keep the count and the code marks
+//> the sparse map keeps in its pages. It needs a 64-bit POSIX host that is
+//> little-endian like the guest; elsewhere, or if the reservation fails, the
+//> memory quietly stays sparse (see backend()).
+//>
+//> Pages carry R/W/X permissions, all granted until protect() says otherwise.
+//> Only the guest's own accesses (TryLoad, TryStore, instruction fetch) are
+//> checked; the host side (Load*/Store*, blocks) sees everything. The checks
+//> ride on lookups that happen anyway: the TLBs only cache pages the guest may
+//> read or write, and flat stores already test the page flags. Flat loads,
+//> which have no lookup, test one flag byte.
 class SparseMemory 
 {
+public:
+
     static constexpr u32 PAGE_SIZE = 4096;
 
-    struct Page 
-    { 
-        std::array<u8, PAGE_SIZE> data{}; 
+    static_assert(PagePool::PAGE_SIZE == PAGE_SIZE);
+    static constexpr u32 NUM_PAGES = u32((u64(1) << 32) / PAGE_SIZE);
+
+    //> Called with the page index on the first store to a page marked as code
+    using CodeWriteHook = std::function<void(u32)>;
+
+    static constexpr bool flatSupported()
+    {
+        return RV32I_FLAT_MEMORY_SUPPORTED && std::endian::native == std::endian::little;
+    }
+
+private:
+
+    enum PageFlags : u8
+    {
+        PAGE_TOUCHED     = 1,  // counted in numPages(), flat only
+        PAGE_CODE        = 2,  // flat only
+        PAGE_NO_READ     = 4,
+        PAGE_NO_WRITE    = 8,
+        PAGE_NO_EXEC     = 16,
+        PAGE_CLEAN       = 32, // flat: not written since the baseline
+        PAGE_REPROTECTED = 64  // permissions changed since the baseline, old ones in perm_log_
+    };
+
+    static constexpr u8 DENY_SHIFT = 2;   // PAGE_NO_* is the denied Perm shifted up
+    static constexpr u8 DENY_MASK  = PAGE_NO_READ | PAGE_NO_WRITE | PAGE_NO_EXEC;
+
+    u8*                   flat_ = nullptr; // base of the reservation, null for the page map
+    std::unique_ptr<u8[]> flags_;          // PageFlags by page index; sparse: only once protected
+    size_t                flat_pages_ = 0;
+
+    //> Flat: flags of a page stores go straight into
+    static constexpr u8 STORE_MASK = PAGE_TOUCHED | PAGE_CODE | PAGE_CLEAN | PAGE_NO_WRITE;
+
+    //> Flat: before a store into the page
+    void touch(u32 page_index)
+    {
+        if ((flags_[page_index] & (PAGE_TOUCHED | PAGE_CODE | PAGE_CLEAN)) != PAGE_TOUCHED) [[unlikely]]
+            firstTouch(page_index);
+    }
+
+    void firstTouch(u32 page_index)
+    {
+        u8& f = flags_[page_index];
+
+        if (f & PAGE_CLEAN)
+        {
+            f &= u8(~PAGE_CLEAN);
+            dirty_.push_back(page_index);
+        }
+
+        if (!(f & PAGE_TOUCHED))
+        {
+            f = u8(f | PAGE_TOUCHED);
+            ++flat_pages_;
+        }
+
+        if (f & PAGE_CODE)
+        {
+            f &= u8(~PAGE_CODE);
+
+            if (on_code_write_)
+                on_code_write_(page_index);
+        }
+    }
+
+    void releaseFlat();
+
+    //> Gives back every page held, for the destructor
+    void releaseAll();
+
+    //> Perm bits the guest is denied on a page
+    u8 denied(u32 page_index) const
+    {
+        return flags_ ? u8((flags_[page_index] >> DENY_SHIFT) & PERM_RWX) : 0;
+    }
+
+    void protectPages(u32 first, u64 count, u8 perm);
+
+    //> Sets a page's PAGE_NO_* bits, dropping code decoded from it if X changes
+    void setDenied(u32 page_index, u8 deny);
+
+    void dropBaseline();
+
+    struct PageSlot
+    {
+        u8*       data   = nullptr; // PAGE_SIZE bytes from pool_, or a snapshot's
+        PagePool* from   = nullptr; // snapshot: the pool counting its holders, null for zeros and files
+        bool      code   = false;   // holds instructions cached by the interpreter
+        bool      shared = false;   // part of a fork snapshot, copied before the first write
+        bool      dirty  = false;   // written since the baseline
+    };
+
+    //> Makes a private page a snapshot of pool_ (holders are counted there)
+    void shareSlot(PageSlot& p)
+    {
+        if (p.shared)
+            return;
+
+        p.shared = true;
+        p.from   = pool_.get();
+        ++shared_pages_;
+    }
+
+    //> Lets go of a slot's data: a private page goes back to the pool, a
+    //> snapshot loses a holder and goes back with the last one
+    void releaseSlot(PageSlot& p)
+    {
+        if (!p.shared)
+        {
+            pool_->release(p.data);
+            return;
+        }
+
+        --shared_pages_;
+
+        if (p.from)
+            p.from->release(p.data);
+    }
+
+    std::shared_ptr<PagePool>              pool_ = std::make_shared<PagePool>();
+    std::vector<std::shared_ptr<const void>> kept_;           // pools and files pages may come from
+    std::unordered_map<u32, PageSlot>      pages_;
+    size_t                                 shared_pages_ = 0;
+
+    //> Page map: runs of pages a mapped file shows through until they get a
+    //> slot of their own (a store, a code mark); sorted, apart
+    struct FileRange
+    {
+        u32       first;
+        u32       count;
+        const u8* data;  // the first page's; the rest follow it
+    };
+
+    std::vector<FileRange> file_ranges_;
+
+    //> File data a page without a slot reads as, null if none
+    const u8* filePage(u32 page_index) const
+    {
+        auto it = std::upper_bound(file_ranges_.begin(), file_ranges_.end(), page_index,
+                                   [](u32 page, const FileRange& r) { return page < r.first; });
+
+        if (it == file_ranges_.begin())
+            return nullptr;
+
+        --it;
+
+        return page_index - it->first < it->count ? it->data + size_t(page_index - it->first) * PAGE_SIZE
+                                                  : nullptr;
+    }
+
+    //> Takes the pages [first, first + count) out of the file ranges
+    void cutFileRanges(u32 first, u32 count);
+
+    //> A page held by the baseline, released like a snapshot slot
+    struct BaselinePage
+    {
+        u8*       data;
+        PagePool* from;
+    };
+
+    bool                                  tracking_ = false; // a baseline is set
+    std::unordered_map<u32, BaselinePage> baseline_;         // page data at the baseline, by index
+    std::vector<u32>                  dirty_;            // pages written since, in order
+    std::vector<std::pair<u32, u8>>   perm_log_;         // pages reprotected since, with their PAGE_NO_* bits then
+
+    //> Direct-mapped caches of page index -> page data in front of pages_. The
+    //> read side only holds pages that exist; the write side only pages not
+    //> marked as code, so a hit can store without checking the mark.
+    struct TlbEntry
+    {
+        u32 page = NO_PAGE;
+        u8* data = nullptr;
     };
 
-    std::unordered_map<u32, std::unique_ptr<Page>> pages_;
+    static constexpr u32 NO_PAGE  = 0xFFFFFFFFu;
+    static constexpr u32 TLB_SIZE = 64;
 
-    Page* getPage(u32 page_index) 
+    mutable std::array<TlbEntry, TLB_SIZE> read_tlb_{};
+    std::array<TlbEntry, TLB_SIZE>         write_tlb_{};
+
+    CodeWriteHook on_code_write_;
+
+    PageSlot& getPage(u32 page_index) 
+    {
+        PageSlot& p = pages_[page_index];
+
+        if (!p.data) 
+        {
+            // A file page becomes a snapshot page, copied on the first store
+            const u8* file = file_ranges_.empty() ? nullptr : filePage(page_index);
+
+            if (file)
+            {
+                p.data   = const_cast<u8*>(file);
+                p.shared = true;
+                ++shared_pages_;
+            }
+            else
+            {
+                p.data = pool_->allocate();
+            }
+        }
+
+        return p;
+    }
+
+    //> Page to read from, null if it was never written
+    const u8* readPage(u32 page_index) const
+    {
+        TlbEntry& e = read_tlb_[page_index % TLB_SIZE];
+
+        if (e.page == page_index) [[likely]]
+            return e.data;
+
+        auto it = pages_.find(page_index);
+
+        if (it == pages_.end())
+        {
+            if (file_ranges_.empty()) [[likely]]
+                return nullptr;
+
+            const u8* file = filePage(page_index);
+
+            if (file && !(denied(page_index) & PERM_R))
+                e = {page_index, const_cast<u8*>(file)};
+
+            return file;
+        }
+
+        if (denied(page_index) & PERM_R) [[unlikely]]
+            return it->second.data;
+
+        e = {page_index, it->second.data};
+
+        return e.data;
+    }
+
+    //> Page to write to, created on first use; fires the code hook first if needed
+    u8* writePage(u32 page_index)
     {
-        auto& p = pages_[page_index];
+        TlbEntry& e = write_tlb_[page_index % TLB_SIZE];
 
-        if (!p) 
-            p = std::make_unique<Page>();
+        if (e.page == page_index) [[likely]]
+            return e.data;
 
-        return p.get();
+        PageSlot& p = getPage(page_index);
+
+        if (p.code) [[unlikely]]
+            codeWritten(page_index, p);
+
+        if (p.shared) [[unlikely]]
+            unshare(page_index, p);
+
+        if (tracking_ && !p.dirty) [[unlikely]]
+        {
+            p.dirty = true;
+            dirty_.push_back(page_index);
+        }
+
+        if (denied(page_index) & PERM_W) [[unlikely]]
+            return p.data;
+
+        e = {page_index, p.data};
+
+        return p.data;
+    }
+
+    //> Drops a page from both TLBs, after its data moved
+    void evict(u32 page_index)
+    {
+        if (read_tlb_[page_index % TLB_SIZE].page == page_index)
+            read_tlb_[page_index % TLB_SIZE] = {};
+
+        if (write_tlb_[page_index % TLB_SIZE].page == page_index)
+            write_tlb_[page_index % TLB_SIZE] = {};
+    }
+
+    //> Holds on to what snapshot pages of this memory may point into
+    void keep(std::shared_ptr<const void> owner);
+
+    //> Points a page at snapshot data with new contents: a write as far as
+    //> code marks and dirty tracking go
+    void replacePage(u32 page_index, const u8* data);
+
+    //> Trades a snapshot page for a private copy; the snapshot stays as it is
+    void unshare(u32 page_index, PageSlot& p)
+    {
+        u8* copy = pool_->allocate();
+
+        std::memcpy(copy, p.data, PAGE_SIZE);
+        releaseSlot(p);
+
+        p.data   = copy;
+        p.from   = nullptr;
+        p.shared = false;
+
+        // Reads must follow the page to its copy
+        if (read_tlb_[page_index % TLB_SIZE].page == page_index)
+            read_tlb_[page_index % TLB_SIZE] = {};
+    }
+
+    void flushTlbs()
+    {
+        read_tlb_.fill({});
+        write_tlb_.fill({});
+    }
+
+    void codeWritten(u32 page_index, PageSlot& p)
+    {
+        p.code = false;
+
+        if (on_code_write_)
+            on_code_write_(page_index);
+    }
+
+    //> Little-endian value at host address p
+    template<typename T>
+    static T loadLE(const u8* p)
+    {
+        T v = 0;
+
+        if constexpr (std::endian::native == std::endian::little)
+            std::memcpy(&v, p, sizeof(T));
+        else
+            for (size_t i = 0; i < sizeof(T); ++i)
+                v = T(v | T(p[i]) << (8 * i));
+
+        return v;
+    }
+
+    template<typename T>
+    static void storeLE(u8* p, T v)
+    {
+        if constexpr (std::endian::native == std::endian::little)
+            std::memcpy(p, &v, sizeof(T));
+        else
+            for (size_t i = 0; i < sizeof(T); ++i)
+                p[i] = u8(v >> (8 * i));
+    }
+
+    //> Word access that stays inside one page: a page lookup and one host copy
+    template<typename T>
+    T loadWord(u32 addr) const
+    {
+        if (flat_)
+            return loadLE<T>(flat_ + addr);
+
+        const u8* p = readPage(addr / PAGE_SIZE);
+
+        return p ? loadLE<T>(p + addr % PAGE_SIZE) : T(0);
+    }
+
+    template<typename T>
+    void storeWord(u32 addr, T val)
+    {
+        if (flat_)
+        {
+            touch(addr / PAGE_SIZE);
+            storeLE<T>(flat_ + addr, val);
+            return;
+        }
+
+        storeLE<T>(writePage(addr / PAGE_SIZE) + addr % PAGE_SIZE, val);
+    }
+
+    template<typename T>
+    static bool inOnePage(u32 addr) { return addr % PAGE_SIZE <= PAGE_SIZE - sizeof(T); }
+
+    //> Any width, wherever it lands
+    template<typename T>
+    T loadAny(u32 addr) const
+    {
+        if constexpr (sizeof(T) == 1)
+            return LoadU8(addr);
+        else if constexpr (sizeof(T) == 2)
+            return LoadU16(addr);
+        else
+            return LoadU32(addr);
+    }
+
+    template<typename T>
+    void storeAny(u32 addr, T val)
+    {
+        if constexpr (sizeof(T) == 1)
+            StoreU8(addr, val);
+        else if constexpr (sizeof(T) == 2)
+            StoreU16(addr, val);
+        else
+            StoreU32(addr, val);
+    }
+
+    //> Calls fn(page_index, offset, length, bytes_done) for each page [addr, addr + len)
+    //> touches, in order, while it returns true
+    template<typename Fn>
+    static void forSpans(u32 addr, u32 len, Fn&& fn)
+    {
+        u32 done = 0;
+
+        while (done < len)
+        {
+            const u32 a   = addr + done;
+            const u32 off = a % PAGE_SIZE;
+            const u32 n   = std::min(len - done, PAGE_SIZE - off);
+
+            if (!fn(a / PAGE_SIZE, off, n, done))
+                return;
+
+            done += n;
+        }
+    }
+
+    //> Page data for bulk reads, null if the page was never written
+    const u8* readSpan(u32 page_index) const
+    {
+        if (flat_)
+            return flags_[page_index] & PAGE_TOUCHED ? flat_ + size_t(page_index) * PAGE_SIZE : nullptr;
+
+        return readPage(page_index);
+    }
+
+    u8* writeSpan(u32 page_index)
+    {
+        if (flat_)
+        {
+            touch(page_index);
+            return flat_ + size_t(page_index) * PAGE_SIZE;
+        }
+
+        return writePage(page_index);
     }
 
 public:
 
+    enum Perm : u8
+    {
+        PERM_NONE = 0,
+        PERM_R    = 1,
+        PERM_W    = 2,
+        PERM_X    = 4,
+        PERM_RW   = PERM_R | PERM_W,
+        PERM_RX   = PERM_R | PERM_X,
+        PERM_RWX  = PERM_R | PERM_W | PERM_X
+    };
+
+    explicit SparseMemory(MemoryBackend backend = MemoryBackend::Sparse);
+    ~SparseMemory();
+
+    SparseMemory(const SparseMemory&)            = delete;
+    SparseMemory& operator=(const SparseMemory&) = delete;
+
+    MemoryBackend backend() const { return flat_ ? MemoryBackend::Flat : MemoryBackend::Sparse; }
+
     u8  LoadU8(u32 addr) const {
-        u32 page = addr / PAGE_SIZE, off = addr % PAGE_SIZE;
+        if (flat_)
+            return flat_[addr];
 
-        auto it = pages_.find(page);
+        const u8* p = readPage(addr / PAGE_SIZE);
 
-        return (it == pages_.end()) ? 0 : it->second->data[off];
+        return p ? p[addr % PAGE_SIZE] : 0;
     }
 
     u16 LoadU16(u32 addr) const 
     { 
+        if (inOnePage<u16>(addr)) [[likely]]
+            return loadWord<u16>(addr);
+
         return u16(LoadU8(addr) | (LoadU8(addr+1) << 8)); 
     }
 
     u32 LoadU32(u32 addr) const 
     {
+        if (inOnePage<u32>(addr)) [[likely]]
+            return loadWord<u32>(addr);
+
         return (u32(LoadU8(addr + 0)) << 0)
              | (u32(LoadU8(addr + 1)) << 8)
              | (u32(LoadU8(addr + 2)) << 16)
@@ -54,37 +559,401 @@ public:
 
     void StoreU8(u32 addr, u8 val) 
     {
-        u32 page   = addr / PAGE_SIZE; 
-        u32 offset = addr % PAGE_SIZE;
+        if (flat_)
+        {
+            touch(addr / PAGE_SIZE);
+            flat_[addr] = val;
+            return;
+        }
 
-        getPage(page)->data[offset] = val;
+        writePage(addr / PAGE_SIZE)[addr % PAGE_SIZE] = val;
     }
 
     void StoreU16(u32 addr, u16 val)
     {
+        if (inOnePage<u16>(addr)) [[likely]]
+            return storeWord<u16>(addr, val);
+
         StoreU8(addr + 0, (val >> 0) & 0xFF);
         StoreU8(addr + 1, (val >> 8) & 0xFF);
     }
 
     void StoreU32(u32 addr, u32 val) 
     {
+        if (inOnePage<u32>(addr)) [[likely]]
+            return storeWord<u32>(addr, val);
+
         StoreU8(addr + 0, (val >> 0) & 0xFF);
         StoreU8(addr + 1, (val >> 8) & 0xFF);
         StoreU8(addr + 2, (val >> 16) & 0xFF);
         StoreU8(addr + 3, (val >> 24) & 0xFF);
     }
 
-    void WriteBlock(u32 addr, const u8* src, u32 len) 
+    //> Bulk copies and fills, one host memcpy/memset per guest page they touch.
+    //> Addresses wrap around the top of the guest space like single accesses do.
+    void ReadBlock(u32 addr, u8* dst, u32 len) const
     {
-        for (u32 i = 0; i < len; ++i)
-            StoreU8(addr + i, src[i]);
+        forSpans(addr, len, [&](u32 page, u32 off, u32 n, u32 done) {
+            const u8* p = readSpan(page);
+
+            if (p)
+                std::memcpy(dst + done, p + off, n);
+            else
+                std::memset(dst + done, 0, n);
+
+            return true;
+        });
     }
 
-    size_t numPages() const { return pages_.size(); }
+    //> Guest load: false, with out untouched, if the guest may not read there
+    template<typename T>
+    bool TryLoad(u32 addr, T& out) const
+    {
+        if (!inOnePage<T>(addr)) [[unlikely]]
+        {
+            if (!allows(addr, sizeof(T), PERM_R))
+                return false;
+
+            out = loadAny<T>(addr);
+            return true;
+        }
+
+        const u32 page = addr / PAGE_SIZE;
+
+        if (flat_)
+        {
+            if (flags_[page] & PAGE_NO_READ) [[unlikely]]
+                return false;
+
+            out = loadLE<T>(flat_ + addr);
+            return true;
+        }
+
+        const TlbEntry& e = read_tlb_[page % TLB_SIZE];
+
+        if (e.page == page) [[likely]]
+        {
+            out = loadLE<T>(e.data + addr % PAGE_SIZE);
+            return true;
+        }
+
+        if (denied(page) & PERM_R)
+            return false;
+
+        out = loadWord<T>(addr);
+        return true;
+    }
+
+    //> Guest store: false, with memory untouched, if the guest may not write there
+    template<typename T>
+    bool TryStore(u32 addr, T val)
+    {
+        if (!inOnePage<T>(addr)) [[unlikely]]
+        {
+            if (!allows(addr, sizeof(T), PERM_W))
+                return false;
+
+            storeAny<T>(addr, val);
+            return true;
+        }
+
+        const u32 page = addr / PAGE_SIZE;
+
+        if (flat_)
+        {
+            if ((flags_[page] & STORE_MASK) != PAGE_TOUCHED) [[unlikely]]
+            {
+                if (flags_[page] & PAGE_NO_WRITE)
+                    return false;
+
+                firstTouch(page);
+            }
+
+            storeLE<T>(flat_ + addr, val);
+            return true;
+        }
+
+        const TlbEntry& e = write_tlb_[page % TLB_SIZE];
+
+        if (e.page == page) [[likely]]
+        {
+            storeLE<T>(e.data + addr % PAGE_SIZE, val);
+            return true;
+        }
+
+        if (denied(page) & PERM_W)
+            return false;
+
+        storeLE<T>(writePage(page) + addr % PAGE_SIZE, val);
+        return true;
+    }
+
+    //> Whether the guest may access every byte of [addr, addr + len) with perm
+    bool allows(u32 addr, u32 len, u8 perm) const
+    {
+        if (!flags_ || len == 0)
+            return true;
+
+        const u32 first = addr / PAGE_SIZE;
+        const u32 last  = u32((u64(addr) + len - 1) / PAGE_SIZE); // may wrap past the top
+
+        for (u32 page = first; ; ++page)
+        {
+            if (denied(page % NUM_PAGES) & perm)
+                return false;
+
+            if (page % NUM_PAGES == last % NUM_PAGES)
+                return true;
+        }
+    }
+
+    //> Perm bits the guest has on the page holding addr
+    u8 permissions(u32 addr) const { return u8(~denied(addr / PAGE_SIZE) & PERM_RWX); }
+
+    //> Sets the guest's permissions on every page [addr, addr + len) touches.
+    //> Taking X away from a page drops whatever was decoded from it.
+    void protect(u32 addr, u32 len, u8 perm)
+    {
+        if (len == 0)
+            return;
+
+        const u32 first = addr / PAGE_SIZE;
+
+        protectPages(first, (u64(addr) + len - 1) / PAGE_SIZE - first + 1, perm);
+    }
+
+    void protectAll(u8 perm) { protectPages(0, NUM_PAGES, perm); }
+
+    void WriteBlock(u32 addr, const u8* src, u32 len)
+    {
+        forSpans(addr, len, [&](u32 page, u32 off, u32 n, u32 done) {
+            std::memcpy(writeSpan(page) + off, src + done, n);
+            return true;
+        });
+    }
+
+    //> Zero fills skip pages that were never written: they already read as zero
+    //> and stay unallocated (uncommitted when flat)
+    void Fill(u32 addr, u8 value, u32 len)
+    {
+        forSpans(addr, len, [&](u32 page, u32 off, u32 n, u32) {
+            if (value == 0 && !readSpan(page))
+                return true;
+
+            // A page map page cleared whole becomes the shared zero page
+            if (value == 0 && n == PAGE_SIZE && !flat_)
+            {
+                replacePage(page, zeroPage());
+                return true;
+            }
+
+            std::memset(writeSpan(page) + off, value, n);
+            return true;
+        });
+    }
+
+    //> memcmp of guest memory at addr against src
+    int Compare(u32 addr, const u8* src, u32 len) const
+    {
+        int result = 0;
+
+        forSpans(addr, len, [&](u32 page, u32 off, u32 n, u32 done) {
+            const u8* p = readSpan(page);
+
+            if (p)
+            {
+                result = std::memcmp(p + off, src + done, n);
+            }
+            else
+            {
+                for (u32 i = 0; i < n && !result; ++i)
+                    result = src[done + i] ? -1 : 0;
+            }
+
+            return result == 0;
+        });
+
+        return result;
+    }
+
+    //> Host memory behind [addr, addr + len), for handing guest buffers to host
+    //> I/O without a copy: fn(data, n) for each run that is contiguous on the
+    //> host, in order, while it returns true. Writable spans are made the
+    //> guest's own and marked written like a store; read-only ones over pages
+    //> never written point into the zero page and must not be written.
+    template<typename Fn>
+    void HostSpans(u32 addr, u32 len, bool writable, Fn&& fn)
+    {
+        u8*  run     = nullptr;
+        u32  run_len = 0;
+        bool more    = true;
+
+        forSpans(addr, len, [&](u32 page, u32 off, u32 n, u32) {
+            const u8* r = writable ? nullptr : readSpan(page);
+            u8*       p = writable ? writeSpan(page) + off
+                                   : const_cast<u8*>((r ? r : zeroPage()) + off);
+
+            if (run && run + run_len == p)
+            {
+                run_len += n;
+                return true;
+            }
+
+            if (run && !(more = fn(run, run_len)))
+                return false;
+
+            run     = p;
+            run_len = n;
+            return true;
+        });
+
+        if (run && more)
+            fn(run, run_len);
+    }
+
+    size_t numPages() const { return flat_ ? flat_pages_ : pages_.size(); }
+
+    //> What this guest's memory costs the host
+    struct Usage
+    {
+        size_t pages      = 0; // guest pages in use, as numPages()
+        size_t free_pages = 0; // released pages kept for reuse
+        size_t slabs      = 0;
+        size_t host_bytes = 0; // reserved from the host: slabs, or touched pages when flat
+        size_t shared     = 0; // pages still shared with a fork relative or a mapped file, not in host_bytes
+    };
+
+    Usage usage() const
+    {
+        if (flat_)
+            return {flat_pages_, 0, 0, flat_pages_ * PAGE_SIZE, 0};
+
+        return {pages_.size(), pool_->freePages(), pool_->slabs(), pool_->hostBytes(), shared_pages_};
+    }
+
+    //> Back slabs reserved from now on with host huge pages, where the host has them
+    void setHugePages(bool on) { pool_->setHugePages(on); }
+
+    //> Backs the pages [addr, addr + len) with the file from offset on without
+    //> reading it: the page map reads them straight from the file's mapping
+    //> until they are written, flat maps the file there privately; either way
+    //> the host reads a page of the file when the guest first touches it, and
+    //> copies it on the first write. Whatever the pages held before is gone.
+    //> File pages nothing wrote to are not in numPages() on the page map.
+    //> All three must be page aligned. False, with nothing done, if they are
+    //> not or the host cannot map the file.
+    bool mapFile(u32 addr, std::shared_ptr<const MappedFile> file, u64 offset, u32 len);
+
+    //> Gives the pages [addr, addr + len) back as if they were never written:
+    //> they read as zero again and cost the host nothing (page map pages go
+    //> back to the pool, flat ones to the host, a file mapped there is
+    //> dropped). With a baseline set they are filled with zeros instead, so
+    //> resetToBaseline() can still put them back. Both must be page aligned;
+    //> false, with nothing done, if they are not.
+    bool discard(u32 addr, u32 len);
+
+    //> One read-only page of zeros that all-zero page map pages share
+    static const u8* zeroPage();
+
+    //> Turns every private page map page that is all zeros into the shared
+    //> zero page and gives its own copy back to the pool; returns how many.
+    //> Pages nothing was written to have no page at all already.
+    size_t shareZeroPages();
+
+    //> Page map pages with a private copy: the ones sharing could save
+    std::vector<u32> privatePages() const;
+
+    //> A page's data to read in place, null if it was never written; good
+    //> until the next store into the memory
+    const u8* peekPage(u32 page_index) const { return readSpan(page_index); }
+
+    //> Makes a private page a snapshot other memories may point at. Returns
+    //> its data and the pool it is from, which counts the caller as one of
+    //> its holders until it releases the page there; null if the page is not
+    //> private (or the memory is flat).
+    std::pair<const u8*, std::shared_ptr<PagePool>> shareOut(u32 page_index);
+
+    //> Swaps a private page for snapshot data with the very same contents,
+    //> from the pool given (null for data that is not from a pool, like the
+    //> zero page), and gives its own copy back to the pool. False, with
+    //> nothing done, if the contents differ or the page is not private.
+    bool mergePage(u32 page_index, const u8* data, std::shared_ptr<PagePool> from);
+
+    //> Hands the memory of pages given back to the pool to the host
+    void trimPool() { pool_->trim(); }
+
+    //> Takes the current contents as the baseline and starts tracking writes
+    void markBaseline();
+
+    //> Puts every page written since markBaseline() back, in time proportional
+    //> to their number; pages created since are dropped. Permissions changed
+    //> since go back too. Keeps the baseline.
+    void resetToBaseline();
+
+    //> Pages written since the baseline, in the order of their first write
+    const std::vector<u32>& dirtyPages() const { return dirty_; }
+
+    //> Streams the current contents of the dirty pages as an incremental
+    //> checkpoint; readPages() applies one (or a whole series, in order)
+    void writeDirtyPages(std::ostream& out) const;
+    void readPages(std::istream& in);
+
+    //> Drops everything here and becomes a copy of parent: copy-on-write when
+    //> both are page maps (parent's pages turn into snapshots too), a plain copy
+    //> of every page otherwise. Permissions come along, code marks do not.
+    void forkFrom(SparseMemory& parent);
+
+    void setCodeWriteHook(CodeWriteHook hook) { on_code_write_ = std::move(hook); }
+
+    //> Marks the page holding addr as code, so the next store into it fires the hook
+    void markCode(u32 addr)
+    {
+        const u32 page = addr / PAGE_SIZE;
+
+        if (!flat_)
+        {
+            getPage(page).code = true;
+
+            // Stores into it have to see the mark again
+            if (write_tlb_[page % TLB_SIZE].page == page)
+                write_tlb_[page % TLB_SIZE] = {};
+
+            return;
+        }
+
+        if (!(flags_[page] & PAGE_TOUCHED))
+            ++flat_pages_;
+
+        flags_[page] = u8(flags_[page] | PAGE_TOUCHED | PAGE_CODE);
+    }
 
     void clear() 
     {
+        if (flat_)
+        {
+            releaseFlat();
+            dropBaseline();
+            kept_.clear();
+            return;
+        }
+
+        for (auto& [index, page] : pages_)
+        {
+            if (page.code)
+                codeWritten(index, page);
+
+            releaseSlot(page);
+        }
+
+        // Before the pools go: the baseline may hold pages from them too
+        dropBaseline();
+
         pages_.clear();
+        file_ranges_.clear();
+        flags_.reset();
+        kept_.clear();
+        shared_pages_ = 0;
+        flushTlbs();
     }
 
     void dump(u32 addr, u32 len = 16) const
@@ -166,6 +166,9 @@ struct LuiOp
 
 struct AuipcOp  { static constexpr const char* name = "auipc"; };
 
+struct FenceOp  { static constexpr const char* name = "fence"; };
+struct FenceIOp { static constexpr const char* name = "fence.i"; };
+
 struct LbOp     { static constexpr const char* name = "lb"; };
 struct LbuOp    { static constexpr const char* name = "lbu"; };
 struct LhOp     { static constexpr const char* name = "lh"; };
@@ -0,0 +1,74 @@
+#pragma once
+
+//> Keeps one copy of pages that are the same across many guests, the way KSM
+//> does for host processes. Pages the guest may not write (text, rodata) are
+//> hashed and merged into the first copy seen with those contents; pages that
+//> are all zeros become the shared zero page whatever their permissions. Merged
+//> pages are copy-on-write snapshots like a fork's, so a guest that writes one
+//> later just gets a copy of its own again.
+//>
+//> scan() looks at a bounded number of pages and picks up where the last call
+//> stopped, so a host running many guests can spread the work between their
+//> time slices. It changes the guests' page maps: none of them may be running
+//> while it does. Flat memories have no page map and are skipped.
+
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Memory.hpp"
+
+namespace rv32i {
+
+class PageMerger
+{
+    //> First copy of some contents, the one later copies are merged into
+    struct Stable
+    {
+        const u8*                 data;
+        std::shared_ptr<PagePool> from; // counts the merger as one of the page's holders
+    };
+
+    std::vector<SparseMemory*>                 memories_;
+    std::unordered_multimap<u64, Stable>       stable_; // by content hash
+    std::vector<std::pair<SparseMemory*, u32>> queue_;  // pages left of this round
+
+    size_t mergeOne(SparseMemory& m, u32 page_index);
+
+public:
+
+    struct Stats
+    {
+        size_t scanned = 0; // pages looked at
+        size_t zero    = 0; // pages that became the zero page
+        size_t merged  = 0; // pages that became another page's copy
+        size_t rounds  = 0; // passes over every guest
+
+        size_t savedBytes() const { return (zero + merged) * SparseMemory::PAGE_SIZE; }
+    };
+
+    Stats stats;
+
+    bool writable = false; // also merge pages the guest may write
+
+    //> The memory must outlive the merger or be removed first
+    void add(SparseMemory& m);
+    void remove(SparseMemory& m);
+
+    //> Looks at up to max_pages pages; returns how many it merged. A round
+    //> ends once every page of every guest was looked at, the next call starts
+    //> another one.
+    size_t scan(size_t max_pages = ~size_t(0));
+
+    PageMerger() = default;
+    ~PageMerger() { forget(); }
+
+    PageMerger(const PageMerger&)            = delete;
+    PageMerger& operator=(const PageMerger&) = delete;
+
+    //> Lets go of the first copies kept so far, and the pools they came from
+    void forget();
+};
+
+} // namespace rv32i
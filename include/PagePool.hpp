@@ -0,0 +1,122 @@
+#pragma once
+
+//> Allocator for guest pages.
+//> Pages are carved from 2 MiB slabs reserved from the host in one go, aligned
+//> so the host can back a slab with a huge page when asked to. Released pages
+//> go to a free list and are handed out again (zeroed) before a new slab is
+//> touched; slabs only go back to the host with the pool, but trim() lets the
+//> host take back the memory behind the free list.
+//>
+//> A page may have several holders (fork relatives, a baseline, the page
+//> merger): share() counts one more, and release() only frees the page with
+//> the last one. Relatives on other threads release into the same pool, so
+//> the pool locks.
+
+#include <cstddef>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+class PagePool
+{
+public:
+
+    static constexpr size_t PAGE_SIZE  = 4096;
+    static constexpr size_t SLAB_SIZE  = size_t(2) << 20;
+    static constexpr size_t SLAB_PAGES = SLAB_SIZE / PAGE_SIZE;
+
+private:
+
+    std::vector<u8*> slabs_;
+    std::vector<u8*> free_;               // released pages, zeroed again on reuse
+    size_t           untrimmed_ = 0;      // pages at the back of free_ since the last trim()
+    size_t           carved_ = SLAB_PAGES; // pages handed out from the newest slab
+    size_t           in_use_ = 0;
+    bool             huge_   = false;
+
+    std::unordered_map<const u8*, u32> holders_; // of pages shared at least once; the rest have one
+    mutable std::mutex                 lock_;
+
+    u8*  newSlab();
+    void freeSlab(u8* slab);
+
+public:
+
+    PagePool() = default;
+    ~PagePool();
+
+    PagePool(const PagePool&)            = delete;
+    PagePool& operator=(const PagePool&) = delete;
+
+    //> A zeroed page, with one holder
+    u8* allocate()
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        ++in_use_;
+
+        if (!free_.empty())
+        {
+            u8* p = free_.back();
+            free_.pop_back();
+
+            if (untrimmed_)
+                --untrimmed_;
+
+            std::memset(p, 0, PAGE_SIZE);
+            return p;
+        }
+
+        if (carved_ == SLAB_PAGES)
+        {
+            slabs_.push_back(newSlab());
+            carved_ = 0;
+        }
+
+        return slabs_.back() + PAGE_SIZE * carved_++;
+    }
+
+    //> One more holder of a page from this pool
+    void share(const u8* page)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        ++holders_.try_emplace(page, 1).first->second;
+    }
+
+    //> One holder fewer; the last one gives the page back
+    void release(u8* page)
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+
+        if (auto it = holders_.find(page); it != holders_.end())
+        {
+            if (--it->second > 0)
+                return;
+
+            holders_.erase(it);
+        }
+
+        --in_use_;
+        free_.push_back(page);
+        ++untrimmed_;
+    }
+
+    //> Lets the host drop the pages on the free list until they are reused
+    void trim();
+
+    //> Ask the host for huge pages on slabs reserved from now on (Linux only)
+    void setHugePages(bool on) { huge_ = on; }
+
+    size_t inUse()     const { std::lock_guard<std::mutex> guard(lock_); return in_use_; }
+    size_t freePages() const { std::lock_guard<std::mutex> guard(lock_); return free_.size(); }
+    size_t slabs()     const { std::lock_guard<std::mutex> guard(lock_); return slabs_.size(); }
+    size_t hostBytes() const { return slabs() * SLAB_SIZE; }
+};
+
+} // namespace rv32i
@@ -13,6 +13,19 @@ struct ExecutionResult
     int exit_code;
 };
 
-ExecutionResult run_program(Interpreter& cpu, size_t cycle_limit = 1'000'000'000'000'000);
+inline constexpr size_t DEFAULT_CYCLE_LIMIT = 1'000'000'000'000'000;
+
+enum class Engine
+{
+    Interpreter, // one instruction per step through the decode cache
+    Block,       // threaded basic blocks, see BlockEngine.hpp
+    Jit,         // threaded blocks, hot ones compiled to host code (Jit.hpp)
+    Trace,       // threaded blocks, hot loops run as traces (Trace.hpp)
+    Tiered       // interpreter for cold code, threaded blocks once warm, JIT once hot (Tiering.hpp)
+};
+
+ExecutionResult run_program(Interpreter& cpu,
+                            size_t cycle_limit = DEFAULT_CYCLE_LIMIT,
+                            Engine engine = Engine::Interpreter);
 
 } // namespace rv32i
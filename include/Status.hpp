@@ -8,6 +8,7 @@ enum class ExecutionStatus
     TrapIllegal,
     TrapLoadFault,
     TrapStoreFault,
+    TrapFetchFault,
     ProgramExit
 };
 
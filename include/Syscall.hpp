@@ -5,14 +5,34 @@
 
 namespace rv32i {
 
+//> RISC-V Linux numbers (asm-generic). On RV32 LSEEK is _llseek and 64-bit
+//> offsets come in two registers, low word first; MMAP is mmap2, with the
+//> file offset in pages.
 enum Syscall : u32 
 {
-    READ   = 63,
-    WRITE  = 64,
-    EXIT   = 93
+    OPENAT     = 56,
+    CLOSE      = 57,
+    LSEEK      = 62,
+    READ       = 63,
+    WRITE      = 64,
+    READV      = 65,
+    WRITEV     = 66,
+    PREAD64    = 67,
+    PWRITE64   = 68,
+    FSTAT      = 80,
+    EXIT       = 93,
+    EXIT_GROUP = 94,
+    BRK        = 214,
+    MUNMAP     = 215,
+    MMAP       = 222,
+    MPROTECT   = 226
 };
 
+//> What a syscall that failed with err leaves in a0: -err, as Linux returns it.
+//> Every guest-visible error is made with this; the host-side tables below it
+//> (FileTable, AddressSpace) return -errno in signed results instead.
+constexpr u32 errno_result(int err) { return u32(-err); }
+
 ExecutionStatus handle_syscall(InterpreterState& s);
 
 } // namespace rv32i
-
@@ -0,0 +1,67 @@
+#pragma once
+
+//> Tier bookkeeping for the block engine.
+//> With tiering on, code starts cold and runs on the interpreter; a block entry
+//> that was reached warm_threshold times gets translated into a threaded block,
+//> and a threaded block that ran Jit::hot_threshold times is compiled. Promotion
+//> happens between two blocks, so the guest never waits for more than one
+//> translation. Dropped blocks (code writes, JIT flushes) start cold again.
+
+#include <array>
+#include <unordered_map>
+
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+enum Tier : u8
+{
+    TIER_INTERPRETER, // one decoded instruction at a time
+    TIER_THREADED,    // threaded blocks
+    TIER_TRACE,       // loop traces
+    TIER_NATIVE,      // JIT-compiled blocks
+
+    TIER_COUNT
+};
+
+class TierManager
+{
+    std::unordered_map<u32, u32> heat_; // entries into cold code, by pc
+
+public:
+
+    static constexpr u32 DEFAULT_WARM_THRESHOLD = 16;
+
+    struct Stats
+    {
+        std::array<u64, TIER_COUNT> retired{}; // instructions, by the tier they ran on
+        u64 promoted = 0;                      // cold entries that became blocks
+    };
+
+    Stats stats;
+
+    u32 warm_threshold = DEFAULT_WARM_THRESHOLD; // cold entries before translating
+
+    //> Counts an entry into cold code at pc; true once it is warm enough for a block
+    bool warm(u32 pc)
+    {
+        if (warm_threshold <= 1)
+            return true;
+
+        auto it = heat_.try_emplace(pc, 0).first;
+
+        if (++it->second < warm_threshold)
+            return false;
+
+        heat_.erase(it);
+        ++stats.promoted;
+
+        return true;
+    }
+
+    void retire(Tier t, u64 n) { stats.retired[t] += n; }
+
+    void clear() { heat_.clear(); }
+};
+
+} // namespace rv32i
@@ -0,0 +1,101 @@
+#pragma once
+
+//> Loop traces for the block engine.
+//> Backward branches and jumps taken into a block make it a loop header. Once
+//> one is hot, the next blocks that run are recorded until the path returns to
+//> the header, and their ops are joined into a single trace. Inside a trace every
+//> branch, jump and call checks that the pc went where it did while recording
+//> and leaves through a side exit otherwise; the last op loops straight back to
+//> the first without returning to the dispatcher.
+//>
+//> Traces are Blocks kept in a BlockCache of their own and reached through the
+//> header's `trace` link, so they are dropped like blocks on code writes.
+
+#include <vector>
+
+#include "Block.hpp"
+#include "IntTypes.hpp"
+
+namespace rv32i {
+
+class TraceRecorder
+{
+    std::vector<Block*> path_;
+    u32                 header_ = 0;
+    u64                 epoch_  = 0; // BlockCache epoch the recording started in
+    bool                active_ = false;
+
+public:
+
+    static constexpr u32 DEFAULT_HOT_LOOP = 64; // backward branches into a header before recording
+    static constexpr u32 MAX_TRACE_BLOCKS = 32;
+
+    struct Stats
+    {
+        u64 started    = 0;
+        u64 aborted    = 0; // path too long, left the engine or the blocks changed
+        u64 compiled   = 0;
+        u64 entered    = 0;
+        u64 loops      = 0; // iterations that went around without leaving the trace
+        u64 side_exits = 0; // left at a guard rather than at the loop end
+    };
+
+    Stats stats;
+
+    u32 hot_loop = DEFAULT_HOT_LOOP;
+
+    bool recording() const { return active_; }
+
+    u32 header() const { return header_; }
+
+    const std::vector<Block*>& path() const { return path_; }
+
+    void start(u32 header_pc, u64 epoch)
+    {
+        path_.clear();
+
+        header_ = header_pc;
+        epoch_  = epoch;
+        active_ = true;
+
+        ++stats.started;
+    }
+
+    //> Appends a block that just ran whole; false (and recording stops) if the
+    //> path can not become a trace
+    bool extend(Block& b, u64 epoch)
+    {
+        const bool ok = epoch == epoch_ && path_.size() < MAX_TRACE_BLOCKS
+                     && (!path_.empty() || b.start_pc == header_);
+
+        if (!ok)
+        {
+            abort();
+            return false;
+        }
+
+        path_.push_back(&b);
+        return true;
+    }
+
+    void abort()
+    {
+        if (!active_)
+            return;
+
+        active_ = false;
+        path_.clear();
+
+        ++stats.aborted;
+    }
+
+    void finish()
+    {
+        active_ = false;
+        path_.clear();
+
+        ++stats.compiled;
+    }
+};
+
+} // namespace rv32i
@@ -0,0 +1,364 @@
+#include <algorithm>
+#include <cerrno>
+#include <iterator>
+
+#include "AddressSpace.hpp"
+#include "Syscall.hpp"
+
+namespace rv32i {
+
+static constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+//> v rounded up to a page; callers keep it under SPACE_TOP
+static u32 page_up(u32 v) { return u32((u64(v) + PAGE - 1) & ~u64(PAGE - 1)); }
+
+//> PROT_* are the Perm bits; write-only pages are read/write, as on Linux
+static u8 perm_of(u32 prot)
+{
+    const u8 perm = u8(prot & SparseMemory::PERM_RWX);
+
+    return perm & SparseMemory::PERM_W ? u8(perm | SparseMemory::PERM_R) : perm;
+}
+
+void AddressSpace::reset(u32 image_begin, u32 heap_begin, u32 heap_limit,
+                         u32 stack_limit, u32 stack_top, bool protect)
+{
+    areas_.clear();
+    stats = {};
+
+    heap_begin_ = heap_begin;
+    brk_        = heap_begin;
+    heap_limit_ = std::max(heap_begin, heap_limit & ~(PAGE - 1));
+    protect_    = protect;
+
+    if (heap_begin > image_begin)
+        insert(image_begin & ~(PAGE - 1), heap_begin, Kind::Image);
+
+    const u32 stack_begin = stack_limit & ~(PAGE - 1);
+    const u32 stack_end   = u32(std::min<u64>(u64(stack_top) + PAGE - 1, SPACE_TOP) & ~u64(PAGE - 1));
+
+    if (stack_end > stack_begin && !overlaps(stack_begin, stack_end))
+        insert(stack_begin, stack_end, Kind::Stack);
+}
+
+u32 AddressSpace::brk(SparseMemory& m, u32 addr)
+{
+    ++stats.brk_calls;
+
+    if (addr == 0)
+        return brk_;
+
+    if (addr < heap_begin_ || addr > heap_limit_)
+    {
+        ++stats.failed;
+        return brk_;
+    }
+
+    const u32 old_end = page_up(brk_);
+    const u32 new_end = page_up(addr);
+
+    if (new_end > old_end)
+    {
+        if (overlaps(old_end, new_end))
+        {
+            ++stats.failed;
+            return brk_;
+        }
+
+        insert(old_end, new_end, Kind::Heap);
+
+        if (protect_)
+            m.protect(old_end, new_end - old_end, SparseMemory::PERM_RW);
+    }
+    else if (new_end < old_end)
+    {
+        remove(m, new_end, old_end);
+    }
+
+    brk_ = addr;
+
+    stats.heap_bytes = brk_ - heap_begin_;
+    stats.heap_peak  = std::max(stats.heap_peak, stats.heap_bytes);
+
+    return brk_;
+}
+
+u32 AddressSpace::mmap(SparseMemory& m, u32 addr, u32 len, u32 prot, u32 flags,
+                       std::shared_ptr<const MappedFile> file, u64 offset)
+{
+    ++stats.mmap_calls;
+
+    auto fail = [&](int err) {
+        ++stats.failed;
+        return errno_result(err);
+    };
+
+    const u32 type = flags & MAP_TYPE;
+
+    if (len == 0 || (type != MAP_SHARED && type != MAP_PRIVATE))
+        return fail(EINVAL);
+
+    const bool anonymous = flags & MAP_ANONYMOUS;
+
+    if (!anonymous && !file)
+        return fail(ENODEV);
+
+    if (!anonymous && offset % PAGE)
+        return fail(EINVAL);
+
+    if (!anonymous && type == MAP_SHARED && (prot & PROT_WRITE))
+        return fail(EACCES);
+
+    if (len > SPACE_TOP)
+        return fail(ENOMEM);
+
+    const u32 size = page_up(len);
+    u32       at   = 0;
+
+    if (flags & (MAP_FIXED | MAP_FIXED_NOREPLACE))
+    {
+        if (addr % PAGE)
+            return fail(EINVAL);
+
+        if (u64(addr) + size > SPACE_TOP)
+            return fail(ENOMEM);
+
+        if (overlaps(addr, addr + size))
+        {
+            if (flags & MAP_FIXED_NOREPLACE)
+                return fail(EEXIST);
+
+            remove(m, addr, addr + size);
+        }
+
+        at = addr;
+    }
+    else
+    {
+        // A hint is taken where it is free and leaves the heap its room
+        const u32 hint = addr & ~(PAGE - 1);
+
+        if (hint && hint >= heap_limit_ && u64(hint) + size <= SPACE_TOP && !overlaps(hint, hint + size))
+            at = hint;
+
+        if (!at)
+            at = findGap(size, heap_limit_, MMAP_TOP);
+
+        if (!at)
+            at = findGap(size, std::max(heap_limit_, MMAP_TOP), SPACE_TOP);
+
+        if (!at)
+            return fail(ENOMEM);
+    }
+
+    insert(at, at + size, anonymous ? Kind::Anonymous : type == MAP_SHARED ? Kind::SharedFile : Kind::File);
+
+    if (!anonymous)
+    {
+        // Whole pages straight from the file; a partial last one is copied,
+        // the rest of it reads as zero
+        const u64 avail = file->size() > offset ? std::min<u64>(file->size() - offset, size) : 0;
+        const u32 whole = u32(avail) & ~(PAGE - 1);
+        const u8* data  = file->data() + offset;
+
+        if (whole && !m.mapFile(at, file, offset, whole))
+            m.WriteBlock(at, data, whole);
+
+        m.WriteBlock(at + whole, data + whole, u32(avail) - whole);
+    }
+
+    if (protect_)
+        m.protect(at, size, perm_of(prot));
+
+    return at;
+}
+
+s32 AddressSpace::munmap(SparseMemory& m, u32 addr, u32 len)
+{
+    ++stats.munmap_calls;
+
+    if (addr % PAGE || len == 0 || u64(addr) + len > SPACE_TOP)
+    {
+        ++stats.failed;
+        return -EINVAL;
+    }
+
+    remove(m, addr, addr + page_up(len));
+
+    return 0;
+}
+
+s32 AddressSpace::mprotect(SparseMemory& m, u32 addr, u32 len, u32 prot)
+{
+    if (addr % PAGE)
+    {
+        ++stats.failed;
+        return -EINVAL;
+    }
+
+    if (len == 0)
+        return 0;
+
+    if (u64(addr) + len > SPACE_TOP || !covered(addr, addr + page_up(len)))
+    {
+        ++stats.failed;
+        return -ENOMEM;
+    }
+
+    const u32 end = addr + page_up(len);
+
+    if (prot & PROT_WRITE)
+    {
+        for (auto it = std::prev(areas_.upper_bound(addr)); it != areas_.end() && it->first < end; ++it)
+        {
+            if (it->second.kind == Kind::SharedFile)
+            {
+                ++stats.failed;
+                return -EACCES;
+            }
+        }
+    }
+
+    if (protect_)
+        m.protect(addr, end - addr, perm_of(prot));
+
+    return 0;
+}
+
+bool AddressSpace::overlaps(u32 begin, u32 end) const
+{
+    // Areas are sorted and apart: the last one starting before end reaches furthest
+    auto it = areas_.lower_bound(end);
+
+    if (it == areas_.begin())
+        return false;
+
+    return std::prev(it)->second.end > begin;
+}
+
+bool AddressSpace::covered(u32 begin, u32 end) const
+{
+    auto it = areas_.upper_bound(begin);
+
+    if (it == areas_.begin())
+        return false;
+
+    --it;
+
+    for (u32 at = begin; at < end; ++it)
+    {
+        if (it == areas_.end() || it->first > at || it->second.end <= at)
+            return false;
+
+        at = it->second.end;
+    }
+
+    return true;
+}
+
+void AddressSpace::split(u32 addr)
+{
+    auto it = areas_.upper_bound(addr);
+
+    if (it == areas_.begin())
+        return;
+
+    --it;
+
+    if (it->first < addr && addr < it->second.end)
+    {
+        areas_.emplace_hint(std::next(it), addr, Area{it->second.end, it->second.kind});
+        it->second.end = addr;
+    }
+}
+
+void AddressSpace::insert(u32 begin, u32 end, Kind kind)
+{
+    count(kind, s64(end) - begin);
+
+    auto next = areas_.lower_bound(begin);
+
+    if (next != areas_.end() && next->first == end && next->second.kind == kind)
+    {
+        end  = next->second.end;
+        next = areas_.erase(next);
+    }
+
+    if (next != areas_.begin())
+    {
+        auto prev = std::prev(next);
+
+        if (prev->second.end == begin && prev->second.kind == kind)
+        {
+            prev->second.end = end;
+            return;
+        }
+    }
+
+    areas_.emplace_hint(next, begin, Area{end, kind});
+}
+
+void AddressSpace::remove(SparseMemory& m, u32 begin, u32 end)
+{
+    split(begin);
+    split(end);
+
+    for (auto it = areas_.lower_bound(begin); it != areas_.end() && it->first < end; )
+    {
+        const u32 b = it->first;
+        const u32 e = it->second.end;
+
+        count(it->second.kind, s64(b) - e);
+
+        m.discard(b, e - b);
+
+        if (protect_)
+            m.protect(b, e - b, SparseMemory::PERM_NONE);
+
+        it = areas_.erase(it);
+    }
+}
+
+u32 AddressSpace::findGap(u32 len, u32 floor, u32 top) const
+{
+    floor = std::max(floor, PAGE);
+
+    if (top <= floor || top - floor < len)
+        return 0;
+
+    // Down from top: each time the gap between the next area below and hi
+    u32  hi = top;
+    auto it = areas_.lower_bound(top);
+
+    while (true)
+    {
+        const bool below = it != areas_.begin();
+        const u32  lo    = below ? std::max(floor, std::prev(it)->second.end) : floor;
+
+        if (hi > lo && hi - lo >= len)
+            return hi - len;
+
+        if (!below)
+            return 0;
+
+        --it;
+        hi = std::min(hi, it->first);
+
+        if (hi <= floor)
+            return 0;
+    }
+}
+
+void AddressSpace::count(Kind kind, s64 bytes)
+{
+    if (kind == Kind::File || kind == Kind::SharedFile)
+        stats.file_bytes = u32(s64(stats.file_bytes) + bytes);
+
+    if (kind != Kind::Anonymous)
+        return;
+
+    stats.mapped_bytes = u32(s64(stats.mapped_bytes) + bytes);
+    stats.mapped_peak  = std::max(stats.mapped_peak, stats.mapped_bytes);
+}
+
+} // namespace rv32i
@@ -0,0 +1,306 @@
+#include <array>
+#include <iomanip>
+#include <iostream>
+#include <optional>
+#include <sstream>
+
+#include "Aot.hpp"
+#include "Block.hpp"
+#include "BlockEngine.hpp"
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Runner.hpp"
+
+namespace rv32i {
+
+namespace {
+
+struct OpName
+{
+    const char* format;
+    const char* oper;
+};
+
+//> Format and Oper spelled the way generated code names them, by op id
+const std::array<OpName, OP_EXIT_CALL>& op_names()
+{
+    static const std::array<OpName, OP_EXIT_CALL> names = [] {
+        std::array<OpName, OP_EXIT_CALL> n{};
+
+#define RV32I_OP_NAME(FORMAT, OPER) n[OP_##FORMAT##_##OPER] = {#FORMAT, #OPER};
+        RV32I_STRAIGHT_OPS(RV32I_OP_NAME)
+        RV32I_CONTROL_OPS(RV32I_OP_NAME)
+#undef RV32I_OP_NAME
+
+        return n;
+    }();
+
+    return names;
+}
+
+std::string hex(u32 v)
+{
+    std::ostringstream os;
+    os << "0x" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << v << "u";
+    return os.str();
+}
+
+std::string label(u32 pc)
+{
+    std::ostringstream os;
+    os << "L_" << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << pc;
+    return os.str();
+}
+
+} // namespace
+
+void StaticTranslator::discover(u32 entry)
+{
+    std::vector<u32> work;
+
+    auto leader = [&](u32 pc) {
+        if (inText(pc) && leaders_.insert(pc).second)
+            work.push_back(pc);
+    };
+
+    leader(entry);
+
+    while (!work.empty())
+    {
+        u32 pc = work.back();
+        work.pop_back();
+
+        // Registers holding a known constant, only tracked within one run of code
+        std::array<std::optional<u32>, 32> known{};
+        known[0] = 0;
+
+        for (; inText(pc) && !code_.count(pc); pc += 4)
+        {
+            const DecodedInstr& d = cpu_.fetch(pc);
+            const InstrInfo&    i = d.info;
+            const u16           op = block_op(d.handler);
+
+            code_.emplace(pc, Instr{i, op});
+
+            if (op == OP_EXIT_CALL)
+            {
+                ++stats.exits;
+                leader(pc + 4);
+                break;
+            }
+
+            if (op == OP_FormatJ_JalOp)
+            {
+                leader(pc + i.imm);
+
+                if (i.rd != 0)
+                    leader(pc + 4);
+
+                break;
+            }
+
+            if (op == OP_FormatJalr_JalrOp)
+            {
+                ++stats.indirect;
+
+                if (known[i.rs1])
+                {
+                    ++stats.resolved;
+                    leader((*known[i.rs1] + i.imm) & ~u32(1));
+                }
+
+                if (i.rd != 0)
+                    leader(pc + 4);
+
+                break;
+            }
+
+            if (op >= OP_FIRST_CONTROL)
+            {
+                leader(pc + i.imm);
+                leader(pc + 4);
+                break;
+            }
+
+            std::optional<u32> value;
+
+            if (op == OP_FormatU_LuiOp)
+                value = i.imm;
+            else if (op == OP_FormatU_AuipcOp)
+                value = pc + i.imm;
+            else if (op == OP_FormatI_AddiOp && known[i.rs1])
+                value = *known[i.rs1] + i.imm;
+
+            // `la` of a code address is most likely a function pointer
+            if (op == OP_FormatI_AddiOp && value)
+                leader(*value);
+
+            if (i.rd != 0)
+                known[i.rd] = value;
+        }
+    }
+
+    stats.blocks       = leaders_.size();
+    stats.instructions = code_.size();
+}
+
+std::string StaticTranslator::jumpTo(u32 pc) const
+{
+    if (leaders_.count(pc))
+        return "goto " + label(pc) + ";";
+
+    return "{ s.pc = " + hex(pc) + "; return ExecutionStatus::Success; }";
+}
+
+void StaticTranslator::emit(std::ostream& out, const std::vector<u8>& image, const std::string& name) const
+{
+    const auto& names = op_names();
+
+    out << "// Generated by rv32i_aot from " << name << ", do not edit\n\n"
+        << "#include \"Aot.hpp\"\n\n"
+        << "using namespace rv32i;\n\n"
+        << "namespace {\n\n"
+        << "const u8 ELF_IMAGE[] = {";
+
+    for (size_t i = 0; i < image.size(); ++i)
+        out << (i % 16 ? " " : "\n    ") << unsigned(image[i]) << ",";
+
+    out << "\n};\n\n"
+        << "ExecutionStatus translated(InterpreterState& s, u64& cycles)\n"
+        << "{\n"
+        << "    for (;;)\n"
+        << "    {\n"
+        << "        switch (s.pc)\n"
+        << "        {\n";
+
+    for (auto it = code_.begin(); it != code_.end(); ++it)
+    {
+        const u32        pc = it->first;
+        const InstrInfo& i  = it->second.info;
+        const u16        op = it->second.op;
+
+        if (leaders_.count(pc))
+        {
+            // Cycles of the block: up to its control op, the next leader or a gap;
+            // an exit call is counted by the interpreter that runs it
+            u32 length = 0;
+
+            for (auto b = it; b != code_.end() && b->first == pc + 4 * length; ++b)
+            {
+                if (length && leaders_.count(b->first))
+                    break;
+
+                if (b->second.op == OP_EXIT_CALL)
+                    break;
+
+                ++length;
+
+                if (b->second.op >= OP_FIRST_CONTROL)
+                    break;
+            }
+
+            out << "        case " << hex(pc) << ": " << label(pc) << ":\n";
+
+            if (length)
+                out << "            cycles += " << length << ";\n";
+        }
+
+        if (op == OP_EXIT_CALL)
+        {
+            out << "            s.pc = " << hex(pc) << ";\n"
+                << "            return ExecutionStatus::Success;\n";
+            continue;
+        }
+
+        const OpName& n = names[op];
+
+        if (op == OP_FormatJ_JalOp)
+        {
+            if (i.rd != 0)
+                out << "            s.regs[" << unsigned(i.rd) << "] = " << hex(pc + 4) << ";\n";
+
+            out << "            " << jumpTo(pc + i.imm) << "\n";
+        }
+        else if (op == OP_FormatJalr_JalrOp)
+        {
+            out << "            s.pc = (s.regs[" << unsigned(i.rs1) << "] + " << hex(i.imm) << ") & ~1u;\n";
+
+            if (i.rd != 0)
+                out << "            s.regs[" << unsigned(i.rd) << "] = " << hex(pc + 4) << ";\n";
+
+            out << "            continue;\n";
+        }
+        else if (op >= OP_FIRST_CONTROL)
+        {
+            out << "            if (" << n.oper << "::cond(s.regs[" << unsigned(i.rs1) << "], s.regs[" << unsigned(i.rs2) << "]))\n"
+                << "                " << jumpTo(pc + i.imm) << "\n"
+                << "            " << jumpTo(pc + 4) << "\n";
+        }
+        else
+        {
+            out << "            RV32I_AOT_STEP(" << n.format << ", " << n.oper << ", " << hex(pc)
+                << ", " << unsigned(i.rd) << ", " << unsigned(i.rs1) << ", " << unsigned(i.rs2)
+                << ", " << unsigned(i.rs3) << ", " << hex(i.imm) << ", " << unsigned(i.shamt) << ")\n";
+
+            if (!code_.count(pc + 4))
+                out << "            " << jumpTo(pc + 4) << "\n";
+        }
+    }
+
+    out << "        default:\n"
+        << "            return ExecutionStatus::Success;\n"
+        << "        }\n"
+        << "    }\n"
+        << "}\n\n"
+        << "} // namespace\n\n"
+        << "int main(int argc, char* argv[])\n"
+        << "{\n"
+        << "    return aot_main(argc, argv, ELF_IMAGE, sizeof(ELF_IMAGE), translated);\n"
+        << "}\n";
+}
+
+int aot_main(int argc, char* argv[], const u8* image, size_t size, AotEntry entry)
+{
+    std::vector<std::string> args(argv, argv + argc);
+    Interpreter cpu{MemoryBackend::Flat}; // falls back to the page map where unsupported
+
+    std::istringstream elf(std::string(reinterpret_cast<const char*>(image), size));
+
+    loadElf(cpu, elf, args.empty() ? "aot" : args[0], args);
+
+    register_all_handlers(cpu);
+
+    u64 cycles = 0;
+
+    while (cycles < DEFAULT_CYCLE_LIMIT)
+    {
+        ExecutionStatus st = entry(cpu.state, cycles);
+
+        if (st == ExecutionStatus::Success)
+        {
+            // Left the translation: one instruction on the interpreter
+            const DecodedInstr& d = cpu.fetch(cpu.pc());
+
+            st = d.handler(cpu.state, d.info);
+            ++cycles;
+        }
+
+        if (st == ExecutionStatus::ProgramExit)
+            return static_cast<int>(cpu.state.regs[10]); // a0
+
+        if (st != ExecutionStatus::Success)
+        {
+            std::cerr << "Trap! on instruction: " << cpu.pc() << "\n";
+            std::cerr << "Cycles: " << cycles << "\n";
+            std::cerr << "Program ended with status " << int(st) << "\n";
+
+            return -1;
+        }
+    }
+
+    std::cerr << "Program ended with status " << int(ExecutionStatus::TrapIllegal) << "\n";
+
+    return -1;
+}
+
+} // namespace rv32i
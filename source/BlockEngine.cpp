@@ -0,0 +1,678 @@
+#include <unordered_map>
+
+#include "BlockEngine.hpp"
+#include "Block.hpp"
+#include "BranchPredictor.hpp"
+#include "Formats.hpp"
+#include "Status.hpp"
+#include "Trace.hpp"
+
+#if defined(__GNUC__) || defined(__clang__)
+#define RV32I_THREADED_DISPATCH 1
+#else
+#define RV32I_THREADED_DISPATCH 0
+#endif
+
+namespace rv32i {
+
+static constexpr u32 MAX_BLOCK_LENGTH = 64;
+static constexpr u32 PAGE_SIZE        = SparseMemory::PAGE_SIZE;
+
+//> Handlers the engine can run inline, keyed by the pointer make_handler gives out
+static const std::unordered_map<Handler, u16>& inline_ops()
+{
+    static const std::unordered_map<Handler, u16> ops = [] {
+        std::unordered_map<Handler, u16> m;
+
+#define RV32I_MAP_OP(FORMAT, OPER) m.emplace(make_handler<FORMAT, OPER>(), OP_##FORMAT##_##OPER);
+        RV32I_STRAIGHT_OPS(RV32I_MAP_OP)
+        RV32I_CONTROL_OPS(RV32I_MAP_OP)
+#undef RV32I_MAP_OP
+
+        return m;
+    }();
+
+    return ops;
+}
+
+u16 block_op(Handler h)
+{
+    const auto& known = inline_ops();
+
+    auto it = known.find(h);
+
+    return it == known.end() ? u16(OP_EXIT_CALL) : it->second;
+}
+
+static bool is_branch(u16 op)
+{
+    return op >= OP_FormatB_BeqOp && op <= OP_FormatB_BgeuOp;
+}
+
+static bool is_control(u16 op)
+{
+    return op >= OP_FIRST_CONTROL && op <= OP_FormatJalr_JalrOp;
+}
+
+//> True if a's result is an operand of b, which is what makes the pair an idiom
+static bool feeds(const BlockOp& a, const BlockOp& b)
+{
+    if (a.info.rd == 0)
+        return false;
+
+    return b.info.rs1 == a.info.rd || (is_branch(b.op) && b.info.rs2 == a.info.rd);
+}
+
+//> Fusion pass: rewrites the first op of every known pair to the fused id.
+//> Both ops stay in place, so a trap or the cycle count still sees one op per
+//> instruction; a jump into the second instruction starts a block of its own.
+static void fuse(Block& b)
+{
+    for (size_t i = 0; i + 1 < b.ops.size(); ++i)
+    {
+        BlockOp& first  = b.ops[i];
+        BlockOp& second = b.ops[i + 1];
+
+        const u16 id = fused_op(first.op, second.op);
+
+        if (id == OP_COUNT || !feeds(first, second))
+            continue;
+
+        first.op = id;
+        b.fused += 1;
+        i       += 1;
+    }
+}
+
+static std::unique_ptr<Block> translate(Interpreter& cpu, u32 pc)
+{
+    auto b = std::make_unique<Block>();
+    b->start_pc = pc;
+
+    const u32 page = pc / PAGE_SIZE;
+
+    for (;;)
+    {
+        const DecodedInstr& d = cpu.fetch(pc);
+
+        BlockOp op{d.info, d.handler, block_op(d.handler)};
+
+        b->ops.push_back(op);
+        b->length += 1;
+        pc        += 4;
+
+        if (op.op >= OP_FIRST_CONTROL)
+            break;
+
+        if (b->length == MAX_BLOCK_LENGTH || pc / PAGE_SIZE != page)
+        {
+            b->ops.push_back(BlockOp{});
+            break;
+        }
+    }
+
+    b->end_pc = pc;
+
+    const BlockOp& last = b->ops.back();
+
+    if (is_branch(last.op))
+    {
+        b->exits[0]  = {last.info.pc + last.info.imm, nullptr};
+        b->exits[1]  = {b->end_pc, nullptr};
+        b->num_exits = 2;
+    }
+    else if (last.op == OP_FormatJ_JalOp)
+    {
+        b->exits[0]  = {last.info.pc + last.info.imm, nullptr};
+        b->num_exits = 1;
+    }
+    else if (last.op == OP_END)
+    {
+        b->exits[0]  = {b->end_pc, nullptr};
+        b->num_exits = 1;
+    }
+
+    b->ret = {b->end_pc, nullptr};
+
+    fuse(*b);
+
+    return b;
+}
+
+//> Block at pc, translated on first entry. With tiering, null while the entry
+//> is still cold: the interpreter runs it then.
+static Block* lookup(Interpreter& cpu, BlockCache& cache, u32 pc, bool tiered)
+{
+    if (Block* b = cache.find(pc))
+        return b;
+
+    if (tiered && !cpu.tiers().warm(pc))
+        return nullptr;
+
+    return cache.insert(translate(cpu, pc));
+}
+
+//> Successor through a jalr exit: returns are predicted by the shadow stack,
+//> other jumps by the per-site target cache. Mispredictions look the block up.
+static Block* follow_indirect(Interpreter& cpu, const InstrInfo& jalr, u32 pc, bool tiered)
+{
+    BlockCache&      cache = cpu.blocks();
+    BranchPredictor& bp    = cpu.predictor();
+
+    if (jalr.rd == 0 && is_link_reg(jalr.rs1))
+    {
+        BranchPredictor::ReturnEntry e = bp.pop();
+
+        if (e.pc == pc)
+        {
+            ++bp.stats.ras_hits;
+
+            if (e.block && e.epoch == cache.epoch())
+                return e.block;
+
+            Block* to = lookup(cpu, cache, pc, tiered);
+
+            // Teach the caller where its call returns to, unless it was dropped
+            // meanwhile (the lookup may have flushed too): check before touching it
+            if (to && e.fill && e.epoch == cache.epoch() && !e.fill->target)
+                BlockCache::link(*e.fill, to);
+
+            return to;
+        }
+
+        ++bp.stats.ras_misses;
+    }
+
+    BranchPredictor::IndirectEntry& e = bp.site(jalr.pc);
+
+    if (e.site == jalr.pc && e.pc == pc && e.epoch == cache.epoch())
+    {
+        ++bp.stats.itc_hits;
+        return e.block;
+    }
+
+    ++bp.stats.itc_misses;
+
+    Block* to = lookup(cpu, cache, pc, tiered);
+
+    if (to)
+        e = {jalr.pc, pc, to, cache.epoch()};
+
+    return to;
+}
+
+//> Successor of `from` after it left with s.pc == pc. Static exits are linked
+//> on first use, so later visits skip the lookup entirely. Null if pc is cold.
+static Block* follow(Interpreter& cpu, Block& from, u32 pc, bool tiered)
+{
+    BlockCache&    cache = cpu.blocks();
+    const BlockOp& last  = from.ops.back();
+
+    Block* to     = nullptr;
+    bool   direct = false; // left through one of its static exits
+
+    for (u32 i = 0; i < from.num_exits && !direct; ++i)
+    {
+        BlockLink& exit = from.exits[i];
+
+        if (exit.pc != pc)
+            continue;
+
+        direct = true;
+
+        if (exit.target)
+        {
+            ++cache.stats.chained;
+            to = exit.target;
+            break;
+        }
+
+        ++cache.stats.unchained;
+
+        to = lookup(cpu, cache, pc, tiered);
+
+        // from may have been dropped by its own stores or by a cache flush
+        if (from.valid && to)
+            BlockCache::link(exit, to);
+    }
+
+    if (!direct)
+    {
+        ++cache.stats.indirect;
+
+        to = last.op == OP_FormatJalr_JalrOp ? follow_indirect(cpu, last.info, pc, tiered)
+                                             : lookup(cpu, cache, pc, tiered);
+    }
+
+    // Calls push their return address for the matching ret
+    if ((last.op == OP_FormatJ_JalOp || last.op == OP_FormatJalr_JalrOp) && is_link_reg(last.info.rd))
+        cpu.predictor().push(from.end_pc, from.valid ? &from.ret : nullptr, cache.epoch());
+
+    return to;
+}
+
+//> Joins the recorded blocks into one loop trace. Control ops become guards on
+//> the pc the path went on at, so fused control pairs are split up again.
+static std::unique_ptr<Block> build_trace(const std::vector<Block*>& path)
+{
+    auto t = std::make_unique<Block>();
+
+    t->start_pc = path.front()->start_pc;
+    t->end_pc   = path.back()->end_pc;
+
+    for (size_t i = 0; i < path.size(); ++i)
+    {
+        const Block& b    = *path[i];
+        const u32    next = i + 1 < path.size() ? path[i + 1]->start_pc : t->start_pc;
+
+        for (size_t n = 0; n < b.ops.size(); ++n)
+        {
+            BlockOp op = b.ops[n];
+
+            if (op.op == OP_END)
+                continue;
+
+            if (n + 1 < b.ops.size() && is_control(b.ops[n + 1].op))
+                op.op = unfused_op(op.op);
+
+            if (is_control(op.op) || op.op == OP_EXIT_CALL)
+                op.next = next;
+
+            t->ops.push_back(op);
+        }
+
+        t->length += b.length;
+        t->fused  += b.fused;
+    }
+
+    t->ops.push_back(BlockOp{InstrInfo{}, nullptr, OP_LOOP});
+
+    return t;
+}
+
+//> Trace bookkeeping after `ran` went through whole and `next` comes after it:
+//> extends a running recording or counts backward branches into `next`.
+static void record(Interpreter& cpu, Block& ran, Block& next)
+{
+    TraceRecorder& rec   = cpu.recorder();
+    BlockCache&    cache = cpu.blocks();
+
+    if (rec.recording())
+    {
+        if (!rec.extend(ran, cache.epoch()) || next.start_pc != rec.header())
+            return;
+
+        // The epoch has not moved, so every block on the path is still alive
+        Block* header = rec.path().front();
+        Block* t      = cpu.traces().find(header->start_pc);
+
+        if (!t)
+            t = cpu.traces().insert(build_trace(rec.path()));
+
+        BlockCache::link(header->trace, t);
+        rec.finish();
+        return;
+    }
+
+    const BlockOp& last = ran.ops.back();
+
+    const bool backward = (is_branch(last.op) || last.op == OP_FormatJ_JalOp)
+                       && next.start_pc <= last.info.pc;
+
+    if (backward && !next.trace.target && ++next.loop_heat == rec.hot_loop)
+        rec.start(next.start_pc, cache.epoch());
+}
+
+struct BlockExit
+{
+    ExecutionStatus status;
+    const BlockOp*  last;      // last op that ran
+    size_t          loops = 0; // traces: times OP_LOOP went back to the start
+};
+
+#if RV32I_THREADED_DISPATCH
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wpedantic"
+#endif
+
+//> Runs a block, or with Trace set a loop trace for at most `iters` iterations.
+//> In a trace every control op is a guard: it runs as usual and the trace only
+//> goes on if the pc is the one recorded in op->next.
+template<bool Trace>
+static BlockExit execute(InterpreterState& s, const Block& b, size_t iters = 1)
+{
+    const BlockOp*  op    = b.ops.data();
+    ExecutionStatus st    = ExecutionStatus::Success;
+    size_t          loops = 0;
+
+#if RV32I_THREADED_DISPATCH
+
+#define RV32I_LABEL_ADDR(FORMAT, OPER) &&L_OP_##FORMAT##_##OPER,
+
+    static void* const labels[OP_COUNT] = {
+        RV32I_STRAIGHT_OPS(RV32I_LABEL_ADDR)
+        RV32I_CONTROL_OPS(RV32I_LABEL_ADDR)
+        &&L_OP_EXIT_CALL,
+        &&L_OP_END,
+        &&L_OP_LOOP,
+
+#define RV32I_FUSED_LABEL_ADDR(NAME, F1, O1, F2, O2) &&L_OP_FUSED_##NAME,
+
+        RV32I_FUSED_STRAIGHT_OPS(RV32I_FUSED_LABEL_ADDR)
+        RV32I_FUSED_CONTROL_OPS(RV32I_FUSED_LABEL_ADDR)
+    };
+
+#undef RV32I_LABEL_ADDR
+#undef RV32I_FUSED_LABEL_ADDR
+
+#define BLOCK_OP(ID)      L_##ID
+#define BLOCK_DISPATCH()  goto *labels[op->op]
+
+    BLOCK_DISPATCH();
+
+#else
+
+#define BLOCK_OP(ID)      case ID
+#define BLOCK_DISPATCH()  continue
+
+    for (;;) switch (op->op) {
+
+#endif
+
+#define RV32I_GUARD()                                                   \
+        if (!Trace || st != ExecutionStatus::Success || s.pc != op->next) \
+            return {st, op, loops};                                     \
+        ++op;                                                           \
+        BLOCK_DISPATCH();
+
+#define RV32I_STRAIGHT_CASE(FORMAT, OPER)                               \
+    BLOCK_OP(OP_##FORMAT##_##OPER):                                     \
+        st = FORMAT::template apply<OPER>(s, op->info);                 \
+        if (st != ExecutionStatus::Success) [[unlikely]]                \
+            goto trap;                                                  \
+        ++op;                                                           \
+        BLOCK_DISPATCH();
+
+#define RV32I_CONTROL_CASE(FORMAT, OPER)                                \
+    BLOCK_OP(OP_##FORMAT##_##OPER):                                     \
+        st = FORMAT::template execute<OPER>(s, op->info);               \
+        RV32I_GUARD()
+
+    RV32I_STRAIGHT_OPS(RV32I_STRAIGHT_CASE)
+    RV32I_CONTROL_OPS(RV32I_CONTROL_CASE)
+
+    // Fused pairs step over both ops; a trap in the second one reports its pc.
+    // Traces are built with the control pairs split up again.
+#define RV32I_FUSED_STRAIGHT_CASE(NAME, F1, O1, F2, O2)                 \
+    BLOCK_OP(OP_FUSED_##NAME):                                          \
+        st = F1::template apply<O1>(s, op->info);                       \
+        if (st != ExecutionStatus::Success) [[unlikely]]                \
+            goto trap;                                                  \
+        ++op;                                                           \
+        st = F2::template apply<O2>(s, op->info);                       \
+        if (st != ExecutionStatus::Success) [[unlikely]]                \
+            goto trap;                                                  \
+        ++op;                                                           \
+        BLOCK_DISPATCH();
+
+#define RV32I_FUSED_CONTROL_CASE(NAME, F1, O1, F2, O2)                  \
+    BLOCK_OP(OP_FUSED_##NAME):                                          \
+        st = F1::template apply<O1>(s, op->info);                       \
+        if (st != ExecutionStatus::Success) [[unlikely]]                \
+            goto trap;                                                  \
+        ++op;                                                           \
+        return {F2::template execute<O2>(s, op->info), op, loops};
+
+    RV32I_FUSED_STRAIGHT_OPS(RV32I_FUSED_STRAIGHT_CASE)
+    RV32I_FUSED_CONTROL_OPS(RV32I_FUSED_CONTROL_CASE)
+
+#undef RV32I_STRAIGHT_CASE
+#undef RV32I_CONTROL_CASE
+#undef RV32I_FUSED_STRAIGHT_CASE
+#undef RV32I_FUSED_CONTROL_CASE
+
+    BLOCK_OP(OP_EXIT_CALL):
+        s.pc = op->info.pc;
+        st   = op->handler(s, op->info);
+
+        // A trace goes on past calls, but not once its code was written to:
+        // fence.i, or a syscall reading into it, has to see the new code
+        if (!b.valid)
+            return {st, op, loops};
+
+        RV32I_GUARD()
+
+#undef RV32I_GUARD
+
+    BLOCK_OP(OP_END):
+        s.pc = b.end_pc;
+        return {ExecutionStatus::Success, op - 1, loops};
+
+    BLOCK_OP(OP_LOOP):
+        // Stores into the trace's own code drop it; finish the iteration and leave
+        if (--iters != 0 && b.valid)
+        {
+            ++loops;
+            op = b.ops.data();
+            BLOCK_DISPATCH();
+        }
+
+        s.pc = b.start_pc;
+        return {ExecutionStatus::Success, op - 1, loops};
+
+#if !RV32I_THREADED_DISPATCH
+    default:
+        return {ExecutionStatus::TrapIllegal, op, loops};
+    }
+#endif
+
+#undef BLOCK_OP
+#undef BLOCK_DISPATCH
+
+trap:
+    s.pc = op->info.pc;
+    return {st, op, loops};
+}
+
+#if RV32I_THREADED_DISPATCH
+#pragma GCC diagnostic pop
+#endif
+
+ExecutionResult run_blocks(Interpreter& cpu, size_t cycle_limit, BlockEngineConfig config)
+{
+    ExecutionResult res{ExecutionStatus::Success, 0, 0, 0};
+
+    InterpreterState& s      = cpu.state;
+    BlockCache&       cache  = cpu.blocks();
+    BlockCache&       traces = cpu.traces();
+    TraceRecorder&    rec    = cpu.recorder();
+    Jit&              host   = cpu.jit();
+    TierManager&      tiers  = cpu.tiers();
+
+    const bool tiered = config.tiered;
+
+    size_t cycles = 0;
+    Block* next   = nullptr;
+    bool   cold   = false; // next pc was looked up and is still cold
+
+    while (cycles < cycle_limit)
+    {
+        if (config.jit && host.full()) [[unlikely]]
+        {
+            // Host code is only freed all at once, so every block goes with it
+            cache.clear();
+            host.reset();
+            ++host.stats.flushes;
+            next = nullptr;
+        }
+
+        if (cache.hasRetired()) [[unlikely]]
+            cache.reclaim();
+
+        if (traces.hasRetired()) [[unlikely]]
+            traces.reclaim();
+
+        Block* b = next ? next : cold ? nullptr : lookup(cpu, cache, s.pc, tiered);
+
+        next = nullptr;
+        cold = false;
+
+        if (!b)
+        {
+            // Cold code: interpret up to the next jump, where the entry gets counted
+            ExecutionStatus st;
+            size_t          ran = 0;
+            u32             at;
+
+            do
+            {
+                const DecodedInstr& d = cpu.fetch(s.pc);
+
+                at = d.info.pc;
+                st = d.handler(s, d.info);
+
+                ++ran;
+            }
+            while (st == ExecutionStatus::Success && s.pc == at + 4 && cycles + ran < cycle_limit);
+
+            cycles += ran;
+            res.pc  = at;
+            tiers.retire(TIER_INTERPRETER, ran);
+
+            res.cycles = static_cast<int>(cycles);
+
+            if (st == ExecutionStatus::ProgramExit)
+            {
+                res.status    = st;
+                res.exit_code = static_cast<int>(s.regs[10]); // a0
+                return res;
+            }
+
+            if (st != ExecutionStatus::Success)
+            {
+                res.status = st;
+                return res;
+            }
+
+            rec.abort();
+            continue;
+        }
+
+        const bool trace = config.traces && b->trace.target;
+
+        if (trace)
+            b = b->trace.target;
+
+        ExecutionStatus st;
+        bool            whole = b->length <= cycle_limit - cycles;
+
+        if (whole && trace)
+        {
+            BlockExit exit = execute<true>(s, *b, (cycle_limit - cycles) / b->length);
+
+            const size_t ran = exit.loops * b->length + size_t(exit.last - b->ops.data()) + 1;
+
+            cycles += ran;
+            res.pc  = exit.last->info.pc;
+            st      = exit.status;
+
+            tiers.retire(TIER_TRACE, ran);
+
+            ++rec.stats.entered;
+            rec.stats.loops += exit.loops;
+
+            if (st == ExecutionStatus::Success && s.pc != b->start_pc)
+                ++rec.stats.side_exits;
+        }
+        else if (whole && b->native)
+        {
+            st = b->native(&s, s.regs.data(), &s.pc);
+
+            // A trap leaves the pc at the faulting instruction
+            const u32 last = st == ExecutionStatus::Success ? b->end_pc - 4 : s.pc;
+
+            const size_t ran = (last - b->start_pc) / 4 + 1;
+
+            cycles += ran;
+            res.pc  = last;
+
+            tiers.retire(TIER_NATIVE, ran);
+
+            ++host.stats.executed;
+        }
+        else if (whole) [[likely]]
+        {
+            BlockExit exit = execute<false>(s, *b);
+
+            const size_t ran = size_t(exit.last - b->ops.data()) + 1;
+
+            cycles += ran;
+            res.pc  = exit.last->info.pc;
+            st      = exit.status;
+
+            tiers.retire(TIER_THREADED, ran);
+
+            ++cache.stats.executed;
+
+            // Only a trap stops a block before its last op
+            if (st == ExecutionStatus::Success || exit.last == &b->ops.back())
+                cache.stats.fused += b->fused;
+
+            if (config.jit && ++b->heat == host.hot_threshold)
+                host.compile(*b);
+        }
+        else
+        {
+            // Not enough budget left for the whole block: finish one instruction at a time
+            const DecodedInstr& d = cpu.fetch(s.pc);
+
+            res.pc = d.info.pc;
+            st     = d.handler(s, d.info);
+
+            cycles += 1;
+            tiers.retire(TIER_INTERPRETER, 1);
+        }
+
+        res.cycles = static_cast<int>(cycles);
+
+        if (st == ExecutionStatus::ProgramExit)
+        {
+            res.status    = st;
+            res.exit_code = static_cast<int>(s.regs[10]); // a0
+            return res;
+        }
+
+        if (st != ExecutionStatus::Success)
+        {
+            res.status = st;
+            return res;
+        }
+
+        if (!whole || trace)
+        {
+            // Recordings only take whole blocks straight from the dispatcher
+            rec.abort();
+
+            if (whole)
+            {
+                next = lookup(cpu, cache, s.pc, tiered);
+                cold = !next;
+            }
+        }
+        else
+        {
+            next = follow(cpu, *b, s.pc, tiered);
+            cold = !next;
+
+            if (config.traces && next)
+                record(cpu, *b, *next);
+            else
+                rec.abort();
+        }
+    }
+
+    res.status = ExecutionStatus::TrapIllegal; // timeout / exceeded cycles
+    return res;
+}
+
+} // namespace rv32i
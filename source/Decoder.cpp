@@ -54,6 +54,11 @@ std::pair<InstrInfo, u32> Decoder::decode(u32 instr_word, u32 pc)
             info.imm = static_cast<u32>(get_imm_j(instr_word));
             break;
 
+        case Opcode::FENCE:
+            key |= u32(funct3) << 8; // fence, fence.i
+            info.imm = static_cast<u32>(get_imm_i(instr_word));
+            break;
+
         case Opcode::F_LOAD:
             key |= u32(funct3) << 8;
             info.imm = static_cast<u32>(get_imm_i(instr_word));
@@ -3,8 +3,11 @@
 #include <stdexcept>
 
 #include "ElfLoader.hpp"
+#include "MappedFile.hpp"
 namespace rv32i {
 
+static constexpr u32 PAGE_SIZE = SparseMemory::PAGE_SIZE;
+
 static inline u32 align_up(u32 v, u32 a)   { return (v + (a - 1)) & ~(a - 1); }
 static inline u32 align_down(u32 v, u32 a) { return v & ~(a - 1); }
 
@@ -64,17 +67,14 @@ static u32 setupStack(Interpreter& cpu,
     return sp;
 }
 
-ElfLoadResult loadElf(
+static ElfLoadResult mapElf(
     Interpreter& cpu,
+    ELFIO::elfio& reader,
+    const std::shared_ptr<const MappedFile>& file,
     const std::string& elf_path,
     const std::vector<std::string>& args,
-    u32 stack_top_hint)
+    const GuestLayout& layout)
 {
-    ELFIO::elfio reader;
-
-    if (!reader.load(elf_path))
-        throw std::runtime_error("Failed to load ELF: " + elf_path);
-
     // Basic sanity for your RV32I interpreter
     if (reader.get_class()    != ELFIO::ELFCLASS32)  
         throw std::runtime_error("ELF is not 32-bit");
@@ -91,6 +91,12 @@ ElfLoadResult loadElf(
     ElfLoadResult res{};
     res.entry = static_cast<u32>(reader.get_entry());
 
+    SparseMemory& mem = cpu.state.memory;
+
+    // Everything the layout does not grant below faults
+    if (layout.protect)
+        mem.protectAll(SparseMemory::PERM_NONE);
+
     // Map loadable segments
     for (auto& seg : reader.segments) 
     {
@@ -100,29 +106,59 @@ ElfLoadResult loadElf(
         const u32 vaddr  = static_cast<u32>(seg->get_virtual_address());
         const u32 filesz = static_cast<u32>(seg->get_file_size());
         const u32 memsz  = static_cast<u32>(seg->get_memory_size());
-        const char* data = seg->get_data();
+        const u64 offset = seg->get_offset();
 
         if (memsz == 0) 
             continue;
 
-        // Copy file-backed part
-        if (filesz)
-            cpu.writeBlock(vaddr, reinterpret_cast<const u8*>(data), filesz);
+        // Copy file-backed part, or map the pages it covers whole straight
+        // from the file and only copy the partial ones at either end
+        if (filesz && file && layout.demand_paging && offset + filesz <= file->size()
+                   && (vaddr - offset) % PAGE_SIZE == 0)
+        {
+            const u8* data  = file->data() + offset;
+            const u32 begin = std::min(align_up(vaddr, PAGE_SIZE) - vaddr, filesz);
+            const u32 end   = std::max(align_down(vaddr + filesz, PAGE_SIZE), vaddr + begin) - vaddr;
+
+            if (end == begin || !mem.mapFile(vaddr + begin, file, offset + begin, end - begin))
+                cpu.writeBlock(vaddr + begin, data + begin, end - begin);
+
+            cpu.writeBlock(vaddr, data, begin);
+            cpu.writeBlock(vaddr + end, data + end, filesz - end);
+        }
+        else if (filesz)
+        {
+            cpu.writeBlock(vaddr, reinterpret_cast<const u8*>(seg->get_data()), filesz);
+        }
 
-        // Zero BSS tail
+        // Zero BSS tail: only pages something was already written to get
+        // touched, the rest of it reads as zero as it is
         if (memsz > filesz) 
+            cpu.fill(vaddr + filesz, 0, memsz - filesz);
+
+        // Segments sharing a page share their permissions
+        if (layout.protect)
         {
-            const u32 zero_base = vaddr + filesz;
-            const u32 zero_len  = memsz - filesz;
+            const u32 flags = seg->get_flags();
+            const u8  perm  = u8((flags & ELFIO::PF_R ? SparseMemory::PERM_R : 0)
+                               | (flags & ELFIO::PF_W ? SparseMemory::PERM_W : 0)
+                               | (flags & ELFIO::PF_X ? SparseMemory::PERM_X : 0));
+
+            const u32 first = vaddr / PAGE_SIZE;
+            const u32 last  = (vaddr + memsz - 1) / PAGE_SIZE;
 
-            for (u32 i = 0; i < zero_len; ++i)
-            {
-                cpu.store<u8>(zero_base + i, 0);
-            }
+            for (u32 page = first; page <= last; ++page)
+                mem.protect(page * PAGE_SIZE, PAGE_SIZE, u8(mem.permissions(page * PAGE_SIZE) | perm));
         }
 
         res.min_vaddr = std::min(res.min_vaddr, vaddr);
         res.max_vaddr = std::max(res.max_vaddr, vaddr + memsz);
+
+        if (seg->get_flags() & ELFIO::PF_X)
+        {
+            res.text_begin = std::min(res.text_begin, vaddr);
+            res.text_end   = std::max(res.text_end, vaddr + memsz);
+        }
     }
 
     if (res.max_vaddr == 0)
@@ -130,21 +166,38 @@ ElfLoadResult loadElf(
 
     // Choose a stack top:
     // - if caller gives a hint, use it (align to 16)
-    // - otherwise put it >= max_vaddr + 1MB, and at least 16MB total space
+    // - otherwise put it >= max_vaddr + 1MB, and at least 16MB total space,
+    //   and high enough that the whole heap fits between the image and the stack
 
     u32 stack_top = 0;
-    if (stack_top_hint != 0) 
+    if (layout.stack_top != 0) 
     {
-        stack_top = align_down(stack_top_hint, 16u);
+        stack_top = align_down(layout.stack_top, 16u);
     } 
     else 
     {
         const u32 min_stack_top = 16u * 1024u * 1024u; // 16MB default ceiling minimum
         const u32 above = align_up(res.max_vaddr + 1u * 1024u * 1024u, 16u);
+        const u64 room  = u64(align_up(res.max_vaddr, PAGE_SIZE)) + layout.heap_size + layout.stack_size;
 
-        stack_top = std::max(min_stack_top, above);
+        stack_top = std::max({min_stack_top, above, u32(std::min<u64>(room, 0xFFFFF000u))});
     }
 
+    // Heap right after the image, stack below its top; the stack wins where they meet
+    res.heap_begin  = align_up(res.max_vaddr, PAGE_SIZE);
+    res.stack_limit = stack_top - std::min(stack_top, layout.stack_size);
+
+    if (stack_top > res.heap_begin)
+        res.stack_limit = std::max(res.stack_limit, res.heap_begin);
+
+    res.heap_end = res.heap_begin + std::min(layout.heap_size, res.stack_limit > res.heap_begin ? res.stack_limit - res.heap_begin : 0u);
+
+    // The heap is brk's to hand out, from nothing up to heap_end
+    if (layout.protect)
+        mem.protect(res.stack_limit, stack_top - res.stack_limit, SparseMemory::PERM_RW);
+
+    cpu.state.vm.reset(res.min_vaddr, res.heap_begin, res.heap_end, res.stack_limit, stack_top, layout.protect);
+
     // Build argv for stack. If caller passed no args, emulate typical argv[0]
     std::vector<std::string> argv_vec = args;
     if (argv_vec.empty())
@@ -158,5 +211,36 @@ ElfLoadResult loadElf(
     return res;
 }
 
+ElfLoadResult loadElf(
+    Interpreter& cpu,
+    const std::string& elf_path,
+    const std::vector<std::string>& args,
+    const GuestLayout& layout)
+{
+    std::shared_ptr<const MappedFile> file = MappedFile::open(elf_path);
+    ELFIO::elfio reader;
+
+    // Lazy: segment data is only read if a segment ends up copied after all
+    if (!file || !reader.load(elf_path, true))
+        throw std::runtime_error("Failed to load ELF: " + elf_path);
+
+    return mapElf(cpu, reader, file, elf_path, args, layout);
+}
+
+ElfLoadResult loadElf(
+    Interpreter& cpu,
+    std::istream& elf,
+    const std::string& elf_name,
+    const std::vector<std::string>& args,
+    const GuestLayout& layout)
+{
+    ELFIO::elfio reader;
+
+    if (!reader.load(elf))
+        throw std::runtime_error("Failed to load ELF: " + elf_name);
+
+    return mapElf(cpu, reader, nullptr, elf_name, args, layout);
+}
+
 } // namespace rv32i
 
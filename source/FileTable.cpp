@@ -0,0 +1,373 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include "FileTable.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#define RV32I_HOST_FILES 1
+#else
+#define RV32I_HOST_FILES 0
+#endif
+
+#if defined(__linux__)
+#include <sys/syscall.h>
+#if defined(SYS_openat2) && __has_include(<linux/openat2.h>)
+#include <linux/openat2.h>
+#define RV32I_OPENAT2 1
+#endif
+#endif
+
+#ifndef RV32I_OPENAT2
+#define RV32I_OPENAT2 0
+#endif
+
+namespace rv32i {
+
+//> Little-endian field of the guest's struct stat
+template<typename T>
+static void put(u8* out, u32 at, T v)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+        out[at + i] = u8(u64(v) >> (8 * i));
+}
+
+//> path inside the root as a path relative to it, without "." and ".."
+//> ("." for the root itself); relative paths start from base
+static std::string resolve(const std::string& base, const std::string& path)
+{
+    std::vector<std::string> parts;
+
+    auto walk = [&](const std::string& p) {
+        for (size_t at = 0; at <= p.size(); )
+        {
+            const size_t end = std::min(p.find('/', at), p.size());
+            const std::string part = p.substr(at, end - at);
+
+            if (part == "..")
+            {
+                if (!parts.empty())
+                    parts.pop_back();
+            }
+            else if (!part.empty() && part != ".")
+            {
+                parts.push_back(part);
+            }
+
+            at = end + 1;
+        }
+    };
+
+    if (path.empty() || path[0] != '/')
+        walk(base);
+
+    walk(path);
+
+    std::string out;
+
+    for (const auto& part : parts)
+        out += (out.empty() ? "" : "/") + part;
+
+    return out.empty() ? "." : out;
+}
+
+const FileTable::File* FileTable::find(u32 fd) const
+{
+    if (fd < FIRST || fd - FIRST >= files_.size() || files_[fd - FIRST].host < 0)
+        return nullptr;
+
+    return &files_[fd - FIRST];
+}
+
+int FileTable::host(u32 fd) const
+{
+    const File* f = find(fd);
+
+    return f ? f->host : -1;
+}
+
+void FileTable::statStream(u8 (&out)[STAT_SIZE])
+{
+    std::memset(out, 0, STAT_SIZE);
+
+    put<u32>(out, 16, 0010600); // S_IFIFO, rw-------
+    put<u32>(out, 20, 1);
+    put<s32>(out, 56, 4096);
+}
+
+#if RV32I_HOST_FILES
+
+//> Guest (asm-generic) open flags to the host's
+static int host_flags(u32 flags)
+{
+    static const struct { u32 guest; int host; } bits[] = {
+        {00000100, O_CREAT},     {00000200, O_EXCL},      {00000400, O_NOCTTY},
+        {00001000, O_TRUNC},     {00002000, O_APPEND},    {00004000, O_NONBLOCK},
+        {00200000, O_DIRECTORY}, {00400000, O_NOFOLLOW},
+    };
+
+    int out = (flags & 3) == 1 ? O_WRONLY : (flags & 3) == 2 ? O_RDWR : O_RDONLY;
+
+    for (const auto& b : bits)
+        if (flags & b.guest)
+            out |= b.host;
+
+    return out | O_CLOEXEC;
+}
+
+FileTable::~FileTable()
+{
+    for (const File& f : files_)
+        if (f.host >= 0)
+            ::close(f.host);
+
+    if (root_fd_ >= 0)
+        ::close(root_fd_);
+}
+
+void FileTable::setRoot(std::string path)
+{
+    if (root_fd_ >= 0)
+        ::close(root_fd_);
+
+    root_    = std::move(path);
+    root_fd_ = -1;
+}
+
+void FileTable::forkFrom(const FileTable& parent)
+{
+    for (File& f : files_)
+        if (f.host >= 0)
+            ::close(f.host);
+
+    files_ = parent.files_;
+
+    // A descriptor the host won't duplicate is closed in the child
+    for (File& f : files_)
+        if (f.host >= 0 && (f.host = ::fcntl(f.host, F_DUPFD_CLOEXEC, 0)) < 0)
+            f = File{};
+
+    setRoot(parent.root_);
+}
+
+s32 FileTable::open(s32 dirfd, const std::string& path, u32 flags, u32 mode)
+{
+    if (path.empty())
+        return -ENOENT;
+
+    std::string base;
+
+    if (dirfd != CWD && path[0] != '/')
+    {
+        const File* dir = find(u32(dirfd));
+
+        if (!dir)
+            return -EBADF;
+
+        base = dir->path;
+    }
+
+    if (root_fd_ < 0)
+        root_fd_ = ::open(root_.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    if (root_fd_ < 0)
+        return -errno;
+
+    auto slot = std::find_if(files_.begin(), files_.end(), [](const File& f) { return f.host < 0; });
+
+    if (slot == files_.end() && files_.size() >= MAX_FILES - FIRST)
+        return -EMFILE;
+
+    // Truncation waits until the file is known not to be mapped
+    const std::string rel   = resolve(base, path);
+    const int         how   = host_flags(flags) & ~O_TRUNC;
+    const bool        trunc = host_flags(flags) & O_TRUNC;
+    int               fd    = -1;
+
+#if RV32I_OPENAT2
+    open_how req{};
+    req.flags   = __u64(how);
+    req.mode    = how & O_CREAT ? mode & 07777 : 0;
+    req.resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS;
+
+    fd = int(::syscall(SYS_openat2, root_fd_, rel.c_str(), &req, sizeof(req)));
+
+    if (fd < 0 && errno == ENOSYS)
+#endif
+        fd = ::openat(root_fd_, rel.c_str(), how | O_NOFOLLOW, mode_t(mode & 07777));
+
+    if (fd < 0)
+        return -errno;
+
+    // A file some guest has mapped (the program it runs, say) can't shrink
+    // under it: the host would fault on the pages past the new end. Linux
+    // refuses to write a running program the same way.
+    if (trunc && MappedFile::mapped(fd))
+    {
+        ::close(fd);
+        return -ETXTBSY;
+    }
+
+    if (trunc && (flags & 3) != 0 && ::ftruncate(fd, 0) != 0)
+    {
+        const int err = errno;
+
+        ::close(fd);
+        return -err;
+    }
+
+    if (slot == files_.end())
+        slot = files_.insert(files_.end(), File{});
+
+    slot->host     = fd;
+    slot->readable = (flags & 3) != 1; // not O_WRONLY
+    slot->path     = rel;
+
+    return s32(FIRST + u32(slot - files_.begin()));
+}
+
+s32 FileTable::close(u32 fd)
+{
+    if (!find(fd))
+        return -EBADF;
+
+    File& f = files_[fd - FIRST];
+
+    ::close(f.host);
+    f = File{};
+
+    return 0;
+}
+
+s64 FileTable::transfer(u32 fd, bool out, const IoSpan* spans, int count, s64 offset)
+{
+    const int h = host(fd);
+
+    if (h < 0)
+        return -EBADF;
+
+    iovec iov[64];
+
+    count = std::min(count, 64);
+
+    for (int i = 0; i < count; ++i)
+        iov[i] = {spans[i].data, spans[i].len};
+
+    ssize_t n;
+
+    if (offset < 0)
+        n = out ? ::writev(h, iov, count) : ::readv(h, iov, count);
+#if defined(__linux__)
+    else
+        n = out ? ::pwritev(h, iov, count, off_t(offset)) : ::preadv(h, iov, count, off_t(offset));
+#else
+    else // a span at a time, the caller goes on with the rest
+        n = out ? ::pwrite(h, iov[0].iov_base, iov[0].iov_len, off_t(offset))
+                : ::pread(h, iov[0].iov_base, iov[0].iov_len, off_t(offset));
+#endif
+
+    return n < 0 ? -s64(errno) : s64(n);
+}
+
+s64 FileTable::seek(u32 fd, s64 offset, u32 whence)
+{
+    const int h = host(fd);
+
+    if (h < 0)
+        return -EBADF;
+
+    if (whence > 2) // SEEK_SET, SEEK_CUR, SEEK_END
+        return -EINVAL;
+
+    const off_t pos = ::lseek(h, off_t(offset), int(whence));
+
+    return pos < 0 ? -s64(errno) : s64(pos);
+}
+
+s32 FileTable::map(u32 fd, std::shared_ptr<const MappedFile>& out)
+{
+    // The standard streams are never files here
+    if (fd < FIRST)
+        return -ENODEV;
+
+    if (!find(fd))
+        return -EBADF;
+
+    File& f = files_[fd - FIRST];
+
+    if (!f.readable)
+        return -EACCES;
+
+    struct stat st{};
+
+    if (::fstat(f.host, &st) != 0)
+        return -errno;
+
+    if (!f.mapped || f.mapped->size() != size_t(st.st_size))
+        f.mapped = MappedFile::fromFd(f.host);
+
+    if (!f.mapped)
+        return -ENODEV;
+
+    out = f.mapped;
+
+    return 0;
+}
+
+s32 FileTable::statHost(int host_fd, u8 (&out)[STAT_SIZE])
+{
+    struct stat st{};
+
+    if (::fstat(host_fd, &st) != 0)
+        return -errno;
+
+    std::memset(out, 0, STAT_SIZE);
+
+    put<u64>(out,  0, st.st_dev);
+    put<u64>(out,  8, st.st_ino);
+    put<u32>(out, 16, st.st_mode);
+    put<u32>(out, 20, u32(st.st_nlink));
+    put<u32>(out, 24, st.st_uid);
+    put<u32>(out, 28, st.st_gid);
+    put<u64>(out, 32, st.st_rdev);
+    put<s64>(out, 48, st.st_size);
+    put<s32>(out, 56, s32(st.st_blksize));
+    put<s64>(out, 64, st.st_blocks);
+    put<s64>(out, 72, st.st_atime);
+    put<s64>(out, 88, st.st_mtime);
+    put<s64>(out, 104, st.st_ctime);
+
+#if defined(__linux__)
+    put<s64>(out, 80, st.st_atim.tv_nsec);
+    put<s64>(out, 96, st.st_mtim.tv_nsec);
+    put<s64>(out, 112, st.st_ctim.tv_nsec);
+#endif
+
+    return 0;
+}
+
+#else
+
+FileTable::~FileTable() = default;
+
+void FileTable::setRoot(std::string path) { root_ = std::move(path); }
+
+void FileTable::forkFrom(const FileTable& parent) { root_ = parent.root_; }
+
+s32 FileTable::open(s32, const std::string&, u32, u32) { return -ENOSYS; }
+s32 FileTable::close(u32) { return -EBADF; }
+
+s64 FileTable::transfer(u32, bool, const IoSpan*, int, s64) { return -EBADF; }
+s64 FileTable::seek(u32, s64, u32) { return -EBADF; }
+
+s32 FileTable::map(u32, std::shared_ptr<const MappedFile>&) { return -EBADF; }
+
+s32 FileTable::statHost(int, u8 (&)[STAT_SIZE]) { return -ENOSYS; }
+
+#endif
+
+} // namespace rv32i
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstring>
+
+#include "GuestIO.hpp"
+#include "Syscall.hpp"
+
+namespace rv32i {
+
+//> Spans gathered for one backend call
+static constexpr int SPAN_BATCH = 64;
+
+static constexpr u32 PAGE_SIZE = SparseMemory::PAGE_SIZE;
+
+//> Guest bytes one backend call covers at most: wherever they start, they
+//> lie on no more than SPAN_BATCH pages
+static constexpr u32 MAX_CHUNK = (SPAN_BATCH - 1) * PAGE_SIZE;
+
+//> A read's first bytes come through a copy of this size, see transferGuest
+static constexpr u32 BOUNCE_SIZE = PAGE_SIZE;
+
+//> Moves every span of spans[0, count) with move(spans, count) unless the
+//> input runs out or it fails first; bytes moved, or -errno if it failed
+//> before moving any
+template<typename Move>
+static s64 transfer(Move&& move, IoSpan* spans, int count)
+{
+    s64 done = 0;
+
+    for (;;)
+    {
+        while (count > 0 && spans->len == 0)
+        {
+            ++spans;
+            --count;
+        }
+
+        if (count == 0)
+            return done;
+
+        const s64 n = move(spans, count);
+
+        if (n == -EINTR)
+            continue;
+
+        if (n <= 0)
+            return n < 0 && done == 0 ? n : done;
+
+        done += n;
+
+        // Short transfer: skip what went through and go on from there
+        for (size_t left = size_t(n); left; )
+        {
+            const size_t step = std::min(left, spans->len);
+
+            spans->data += step;
+            spans->len  -= step;
+            left        -= step;
+
+            if (spans->len == 0)
+            {
+                ++spans;
+                --count;
+            }
+        }
+    }
+}
+
+//> Moves [addr, addr + len) of guest memory with move() a chunk at a time,
+//> until all of it went or a chunk comes up short. Reading makes pages the
+//> guest's own the way a store would, so it only hands over what the input is
+//> likely to fill: the first bytes go through a bounce buffer (most reads from
+//> a pipe or terminal end there), then chunks twice as big each time.
+template<typename Move>
+static u32 transferGuest(SparseMemory& m, bool out, u32 addr, u32 len, Move&& move)
+{
+    u32 total = 0;
+    u32 chunk = MAX_CHUNK;
+
+    if (!out && len > 0)
+    {
+        u8     bounce[BOUNCE_SIZE];
+        IoSpan span{bounce, std::min(len, BOUNCE_SIZE)};
+
+        const u32 want = u32(span.len);
+        const s64 n    = transfer(move, &span, 1);
+
+        if (n <= 0)
+            return u32(n);
+
+        m.WriteBlock(addr, bounce, u32(n));
+
+        if (u32(n) < want)
+            return u32(n);
+
+        total = want;
+        chunk = 2 * BOUNCE_SIZE;
+    }
+
+    while (total < len)
+    {
+        IoSpan spans[SPAN_BATCH];
+        int    count = 0;
+
+        const u32 want = std::min(len - total, chunk);
+
+        m.HostSpans(addr + total, want, !out, [&](u8* data, u32 n) {
+            spans[count++] = {data, n};
+            return true;
+        });
+
+        const s64 n = transfer(move, spans, count);
+
+        if (n < 0)
+            return total ? total : u32(n);
+
+        total += u32(n);
+
+        if (u32(n) < want)
+            break;
+
+        chunk = std::min(2 * chunk, MAX_CHUNK);
+    }
+
+    return total;
+}
+
+//> Straight between a guest file and guest memory, at offset unless it is
+//> negative (then at the file's own offset)
+static u32 transferFile(FileTable& files, SparseMemory& m, bool out, u32 fd, u32 addr, u32 len, s64 offset)
+{
+    if (files.host(fd) < 0)
+        return errno_result(EBADF);
+
+    return transferGuest(m, out, addr, len, [&](IoSpan* spans, int count) {
+        const s64 n = files.transfer(fd, out, spans, count, offset);
+
+        if (offset >= 0 && n > 0)
+            offset += n;
+
+        return n;
+    });
+}
+
+OutputBuffering GuestIO::mode()
+{
+    if (buffering == OutputBuffering::Auto)
+        buffering = backend->interactive(1) ? OutputBuffering::Line : OutputBuffering::Full;
+
+    return buffering;
+}
+
+u32 GuestIO::read(SparseMemory& m, u32 fd, u32 addr, u32 len)
+{
+    if (fd >= FileTable::FIRST)
+        return transferFile(files, m, false, fd, addr, len, -1);
+
+    if (fd != 0)
+        return errno_result(EBADF);
+
+    // Like stdio: a prompt shows up before the guest waits for its answer
+    if (mode() != OutputBuffering::Full)
+        flush();
+
+    return transferGuest(m, false, addr, len, [&](IoSpan* spans, int count) {
+        return backend->read(fd, spans, count);
+    });
+}
+
+u32 GuestIO::write(SparseMemory& m, u32 fd, u32 addr, u32 len)
+{
+    if (fd >= FileTable::FIRST)
+        return transferFile(files, m, true, fd, addr, len, -1);
+
+    if (fd != 1 && fd != 2)
+        return errno_result(EBADF);
+
+    const OutputBuffering how = fd == 2 ? OutputBuffering::None : mode();
+
+    if (how != OutputBuffering::None && len < BUFFER_SIZE)
+    {
+        if (pending_ + len > BUFFER_SIZE)
+            if (const int err = flush())
+                return errno_result(err);
+
+        if (buffer_.empty())
+            buffer_.resize(BUFFER_SIZE);
+
+        u8* at = buffer_.data() + pending_;
+
+        m.ReadBlock(addr, at, len);
+        pending_ += len;
+
+        if (how == OutputBuffering::Line && std::memchr(at, '\n', len))
+            if (const int err = flush())
+                return errno_result(err);
+
+        return len;
+    }
+
+    // Too big to be worth a copy: what was buffered goes first, then the pages
+    if (fd == 1)
+        if (const int err = flush())
+            return errno_result(err);
+
+    return transferGuest(m, true, addr, len, [&](IoSpan* spans, int count) {
+        return backend->write(fd, spans, count);
+    });
+}
+
+u32 GuestIO::pread(SparseMemory& m, u32 fd, u32 addr, u32 len, u64 offset)
+{
+    if (fd < FileTable::FIRST)
+        return errno_result(fd <= 2 ? ESPIPE : EBADF);
+
+    if (offset > u64(INT64_MAX))
+        return errno_result(EINVAL);
+
+    return transferFile(files, m, false, fd, addr, len, s64(offset));
+}
+
+u32 GuestIO::pwrite(SparseMemory& m, u32 fd, u32 addr, u32 len, u64 offset)
+{
+    if (fd < FileTable::FIRST)
+        return errno_result(fd <= 2 ? ESPIPE : EBADF);
+
+    if (offset > u64(INT64_MAX))
+        return errno_result(EINVAL);
+
+    return transferFile(files, m, true, fd, addr, len, s64(offset));
+}
+
+s64 GuestIO::seek(u32 fd, s64 offset, u32 whence)
+{
+    if (fd < FileTable::FIRST)
+        return fd <= 2 ? -ESPIPE : -EBADF;
+
+    return files.seek(fd, offset, whence);
+}
+
+s32 GuestIO::stat(u32 fd, u8 (&out)[FileTable::STAT_SIZE])
+{
+    if (fd >= FileTable::FIRST)
+    {
+        const int host = files.host(fd);
+
+        return host < 0 ? -EBADF : FileTable::statHost(host, out);
+    }
+
+    if (fd > 2)
+        return -EBADF;
+
+    const int host = backend->hostFd(fd);
+
+    if (host < 0 || FileTable::statHost(host, out) != 0)
+        FileTable::statStream(out);
+
+    return 0;
+}
+
+s32 GuestIO::close(u32 fd)
+{
+    if (fd >= FileTable::FIRST)
+        return files.close(fd);
+
+    if (fd > 2)
+        return -EBADF;
+
+    if (fd == 1)
+        flush();
+
+    return 0;
+}
+
+int GuestIO::flush()
+{
+    if (pending_ == 0)
+        return 0;
+
+    IoSpan    span{buffer_.data(), pending_};
+    const s64 n = transfer([&](IoSpan* spans, int count) { return backend->write(1, spans, count); },
+                           &span, 1);
+
+    // Dropped either way, so a stream that was closed is not retried forever
+    pending_ = 0;
+
+    return n < 0 ? int(-n) : 0;
+}
+
+} // namespace rv32i
@@ -71,6 +71,11 @@ void register_all_handlers(Interpreter& cpu)
     REG(key(Opcode::J_TYPE,  0x0, 0x00), FormatJ,    JalOp);
     REG(key(Opcode::I_JALR,  0x0, 0x00), FormatJalr, JalrOp);
 
+    REG(key(Opcode::FENCE, 0x0, 0x00), FormatFence, FenceOp);
+
+    // ---- Zifencei ----
+    REG(key(Opcode::FENCE, 0x1, 0x00), FormatFence, FenceIOp);
+
     // ---- RV32M ----
     REG(key(Opcode::R_TYPE, 0x0, 0x01), FormatR, MulOp);
     REG(key(Opcode::R_TYPE, 0x1, 0x01), FormatR, MulhOp);
@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+
+#include "IoBackend.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/uio.h>
+#include <unistd.h>
+#define RV32I_POSIX_IO 1
+#else
+#define RV32I_POSIX_IO 0
+#endif
+
+namespace rv32i {
+
+//> Spans a single readv/writev takes; GuestIO never hands over more
+static constexpr int MAX_SPANS = 64;
+
+#if RV32I_POSIX_IO
+
+static s64 host_transfer(bool out, int fd, const IoSpan* spans, int count)
+{
+    if (fd < 0)
+        return -EBADF;
+
+    iovec iov[MAX_SPANS];
+
+    count = std::min(count, MAX_SPANS);
+
+    for (int i = 0; i < count; ++i)
+        iov[i] = {spans[i].data, spans[i].len};
+
+    const ssize_t n = out ? ::writev(fd, iov, count) : ::readv(fd, iov, count);
+
+    return n < 0 ? -s64(errno) : s64(n);
+}
+
+bool HostFdIo::interactive(u32 fd) const
+{
+    return hostFd(fd) >= 0 && isatty(hostFd(fd));
+}
+
+#else
+
+//> Off POSIX the descriptors can only be the process's own streams
+static s64 host_transfer(bool out, int fd, const IoSpan* spans, int count)
+{
+    FILE* f   = fd == 0 ? stdin : fd == 1 ? stdout : fd == 2 ? stderr : nullptr;
+    s64  done = 0;
+
+    if (!f)
+        return -EBADF;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const size_t n = out ? std::fwrite(spans[i].data, 1, spans[i].len, f)
+                             : std::fread(spans[i].data, 1, spans[i].len, f);
+        done += s64(n);
+
+        if (n < spans[i].len)
+            return done || !std::ferror(f) ? done : -EIO;
+    }
+
+    if (out)
+        std::fflush(f);
+
+    return done;
+}
+
+bool HostFdIo::interactive(u32 fd) const
+{
+    return fd != 0;
+}
+
+#endif
+
+s64 HostFdIo::read(u32 fd, const IoSpan* spans, int count)
+{
+    return host_transfer(false, fd == 0 ? in_fd : -1, spans, count);
+}
+
+s64 HostFdIo::write(u32 fd, const IoSpan* spans, int count)
+{
+    return host_transfer(true, fd == 1 || fd == 2 ? hostFd(fd) : -1, spans, count);
+}
+
+s64 BufferIo::read(u32 fd, const IoSpan* spans, int count)
+{
+    if (fd != 0)
+        return -EBADF;
+
+    s64 done = 0;
+
+    for (int i = 0; i < count && consumed < input.size(); ++i)
+    {
+        const size_t n = std::min(spans[i].len, input.size() - consumed);
+
+        std::memcpy(spans[i].data, input.data() + consumed, n);
+        consumed += n;
+        done     += s64(n);
+    }
+
+    return done;
+}
+
+s64 BufferIo::write(u32 fd, const IoSpan* spans, int count)
+{
+    if (fd != 1 && fd != 2)
+        return -EBADF;
+
+    std::string& to   = fd == 1 ? out : err;
+    s64          done = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        to.append(reinterpret_cast<const char*>(spans[i].data), spans[i].len);
+        done += s64(spans[i].len);
+    }
+
+    return done;
+}
+
+s64 CallbackIo::read(u32 fd, const IoSpan* spans, int count)
+{
+    s64 done = 0;
+
+    for (int i = 0; i < count && on_read; ++i)
+    {
+        const s64 n = on_read(fd, spans[i].data, spans[i].len);
+
+        if (n < 0)
+            return done ? done : n;
+
+        done += n;
+
+        if (size_t(n) < spans[i].len)
+            break;
+    }
+
+    return done;
+}
+
+s64 CallbackIo::write(u32 fd, const IoSpan* spans, int count)
+{
+    s64 done = 0;
+
+    for (int i = 0; i < count; ++i)
+    {
+        const s64 n = on_write ? on_write(fd, spans[i].data, spans[i].len) : s64(spans[i].len);
+
+        if (n < 0)
+            return done ? done : n;
+
+        done += n;
+
+        if (size_t(n) < spans[i].len)
+            break;
+    }
+
+    return done;
+}
+
+} // namespace rv32i
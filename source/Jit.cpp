@@ -0,0 +1,400 @@
+#include <cstring>
+
+#include "Jit.hpp"
+#include "Formats.hpp"
+
+#if RV32I_JIT_SUPPORTED
+#include <sys/mman.h>
+#endif
+
+namespace rv32i {
+
+#if RV32I_JIT_SUPPORTED
+
+namespace {
+
+enum HostReg : u8 { EAX = 0, ECX = 1, EDX = 2 };
+
+//> Just enough x86-64 for the JIT. Guest register r lives at [rbx + 4*r],
+//> r12 holds the InterpreterState* and r13 points at s.pc.
+class Emitter
+{
+    std::vector<u8>& out_;
+
+public:
+
+    explicit Emitter(std::vector<u8>& out) : out_(out) {}
+
+    // One at a time, like imm32: a range insert trips GCC's -Warray-bounds
+    // and -Wstringop-overflow on short lists in Release builds
+    void bytes(std::initializer_list<u8> b)
+    {
+        for (u8 v : b)
+            out_.push_back(v);
+    }
+
+    void imm32(u32 v)
+    {
+        for (int i = 0; i < 4; ++i)
+            out_.push_back(u8(v >> (8 * i)));
+    }
+
+    void imm64(u64 v)
+    {
+        for (int i = 0; i < 8; ++i)
+            out_.push_back(u8(v >> (8 * i)));
+    }
+
+    static u8 slot(u8 guest) { return u8(4 * guest); }
+
+    // mov host, [rbx + 4*guest]
+    void load(HostReg r, u8 guest)  { bytes({0x8B, u8(0x43 | r << 3), slot(guest)}); }
+
+    // mov [rbx + 4*guest], host
+    void store(u8 guest, HostReg r) { bytes({0x89, u8(0x43 | r << 3), slot(guest)}); }
+
+    // mov dword [rbx + 4*guest], imm32
+    void storeImm(u8 guest, u32 v)  { bytes({0xC7, 0x43, slot(guest)}); imm32(v); }
+
+    // mov host, imm32
+    void movImm(HostReg r, u32 v)   { bytes({u8(0xB8 + r)}); imm32(v); }
+
+    // <op> eax, ecx with the r/m-form opcode
+    void aluEcx(u8 opcode)          { bytes({opcode, 0xC8}); }
+
+    // <op> eax, imm32 with the short eax-form opcode
+    void aluImm(u8 opcode, u32 v)   { bytes({opcode}); imm32(v); }
+
+    // shl/shr/sar/rol/ror eax, cl (ext is the /digit)
+    void shiftCl(u8 ext)            { bytes({0xD3, u8(0xC0 | ext << 3)}); }
+
+    void shiftImm(u8 ext, u8 n)     { bytes({0xC1, u8(0xC0 | ext << 3), n}); }
+
+    // setcc al; movzx eax, al
+    void setcc(u8 cc)               { bytes({0x0F, u8(0x90 | cc), 0xC0, 0x0F, 0xB6, 0xC0}); }
+
+    // mov [r13], imm32 / mov [r13], host
+    void setPc(u32 pc)              { bytes({0x41, 0xC7, 0x45, 0x00}); imm32(pc); }
+    void setPc(HostReg r)           { bytes({0x41, 0x89, u8(0x45 | r << 3), 0x00}); }
+
+    void prologue()
+    {
+        bytes({0x53, 0x41, 0x54, 0x41, 0x55}); // push rbx, r12, r13: rsp is 16-aligned again
+        bytes({0x48, 0x89, 0xF3});             // mov rbx, rsi
+        bytes({0x49, 0x89, 0xFC});             // mov r12, rdi
+        bytes({0x49, 0x89, 0xD5});             // mov r13, rdx
+    }
+
+    static constexpr u8 EPILOGUE_SIZE = 6;
+
+    void epilogue() { bytes({0x41, 0x5D, 0x41, 0x5C, 0x5B, 0xC3}); }
+
+    void returnSuccess()
+    {
+        bytes({0x31, 0xC0}); // xor eax, eax (ExecutionStatus::Success)
+        epilogue();
+    }
+
+    //> h(state, info); leaves with *pc = info.pc if it did not succeed
+    void callApply(Handler h, const InstrInfo& info)
+    {
+        bytes({0x4C, 0x89, 0xE7});                         // mov rdi, r12
+        bytes({0x48, 0xBE}); imm64(reinterpret_cast<u64>(&info)); // mov rsi, &info
+        bytes({0x48, 0xB8}); imm64(reinterpret_cast<u64>(h));     // mov rax, h
+        bytes({0xFF, 0xD0});                               // call rax
+
+        bytes({0x85, 0xC0, 0x74, u8(8 + EPILOGUE_SIZE)});  // test eax, eax; jz over
+        setPc(info.pc);
+        epilogue();
+    }
+};
+
+// Condition codes as used by setcc/cmovcc
+constexpr u8 CC_B  = 0x2, CC_AE = 0x3, CC_E = 0x4, CC_NE = 0x5, CC_L = 0xC, CC_GE = 0xD;
+
+// /digit of the shift group
+constexpr u8 SH_ROL = 0, SH_ROR = 1, SH_SHL = 4, SH_SHR = 5, SH_SAR = 7;
+
+//> Format::apply of every straight op, indexed by op id
+const Handler* apply_table()
+{
+    static const Handler table[OP_FIRST_CONTROL] = {
+#define RV32I_APPLY_PTR(FORMAT, OPER) &FORMAT::template apply<OPER>,
+        RV32I_STRAIGHT_OPS(RV32I_APPLY_PTR)
+#undef RV32I_APPLY_PTR
+    };
+
+    return table;
+}
+
+//> rd = rs1 <op> rs2 for the ops that map onto a single host instruction
+bool emitR(Emitter& e, u16 op, const InstrInfo& i)
+{
+    // Writes to x0 have no other side effects, so they emit nothing
+    auto binary = [&](auto body) {
+        if (i.rd == 0)
+            return;
+
+        e.load(EAX, i.rs1);
+        e.load(ECX, i.rs2);
+        body();
+        e.store(i.rd, EAX);
+    };
+
+    // imul rax, rcx; shr rax, 32 on operands already widened in rax/rcx
+    auto high = [&] {
+        e.bytes({0x48, 0x0F, 0xAF, 0xC1});
+        e.bytes({0x48, 0xC1, 0xE8, 0x20});
+    };
+
+    auto sxRax = [&] { e.bytes({0x48, 0x63, 0xC0}); }; // movsxd rax, eax
+    auto sxRcx = [&] { e.bytes({0x48, 0x63, 0xC9}); }; // movsxd rcx, ecx
+
+    switch (op)
+    {
+        case OP_FormatR_AddOp: binary([&] { e.aluEcx(0x01); }); return true;
+        case OP_FormatR_SubOp: binary([&] { e.aluEcx(0x29); }); return true;
+        case OP_FormatR_AndOp: binary([&] { e.aluEcx(0x21); }); return true;
+        case OP_FormatR_OrOp:  binary([&] { e.aluEcx(0x09); }); return true;
+        case OP_FormatR_XorOp: binary([&] { e.aluEcx(0x31); }); return true;
+
+        // x86 masks 32-bit shift counts to five bits, like RISC-V
+        case OP_FormatR_SllOp: binary([&] { e.shiftCl(SH_SHL); }); return true;
+        case OP_FormatR_SrlOp: binary([&] { e.shiftCl(SH_SHR); }); return true;
+        case OP_FormatR_SraOp: binary([&] { e.shiftCl(SH_SAR); }); return true;
+        case OP_FormatR_RolOp: binary([&] { e.shiftCl(SH_ROL); }); return true;
+        case OP_FormatR_RorOp: binary([&] { e.shiftCl(SH_ROR); }); return true;
+
+        case OP_FormatR_SltOp:  binary([&] { e.aluEcx(0x39); e.setcc(CC_L); }); return true;
+        case OP_FormatR_SltuOp: binary([&] { e.aluEcx(0x39); e.setcc(CC_B); }); return true;
+
+        case OP_FormatR_MulOp:
+            binary([&] { e.bytes({0x0F, 0xAF, 0xC1}); }); // imul eax, ecx
+            return true;
+
+        case OP_FormatR_MulhOp:   binary([&] { sxRax(); sxRcx(); high(); }); return true;
+        case OP_FormatR_MulhsuOp: binary([&] { sxRax(); high(); }); return true;
+        case OP_FormatR_MulhuOp:  binary([&] { high(); }); return true;
+
+        default:
+            return false;
+    }
+}
+
+//> rd = rs1 <op> imm
+bool emitI(Emitter& e, u16 op, const InstrInfo& i)
+{
+    const u32 imm = i.imm;
+    const u8  sh  = u8(imm & 31);
+
+    auto unary = [&](auto body) {
+        if (i.rd == 0)
+            return;
+
+        e.load(EAX, i.rs1);
+        body();
+        e.store(i.rd, EAX);
+    };
+
+    switch (op)
+    {
+        case OP_FormatI_AddiOp: unary([&] { e.aluImm(0x05, imm); }); return true;
+        case OP_FormatI_AndiOp: unary([&] { e.aluImm(0x25, imm); }); return true;
+        case OP_FormatI_OriOp:  unary([&] { e.aluImm(0x0D, imm); }); return true;
+        case OP_FormatI_XoriOp: unary([&] { e.aluImm(0x35, imm); }); return true;
+
+        case OP_FormatI_SlliOp: unary([&] { e.shiftImm(SH_SHL, sh); }); return true;
+        case OP_FormatI_SrliOp: unary([&] { e.shiftImm(SH_SHR, sh); }); return true;
+        case OP_FormatI_SraiOp: unary([&] { e.shiftImm(SH_SAR, sh); }); return true;
+        case OP_FormatI_RoriOp: unary([&] { e.shiftImm(SH_ROR, sh); }); return true;
+
+        case OP_FormatI_SltiOp:  unary([&] { e.aluImm(0x3D, imm); e.setcc(CC_L); }); return true;
+        case OP_FormatI_SltiuOp: unary([&] { e.aluImm(0x3D, imm); e.setcc(CC_B); }); return true;
+
+        default:
+            return false;
+    }
+}
+
+bool emitU(Emitter& e, u16 op, const InstrInfo& i)
+{
+    if (op != OP_FormatU_LuiOp && op != OP_FormatU_AuipcOp)
+        return false;
+
+    if (i.rd != 0)
+        e.storeImm(i.rd, op == OP_FormatU_LuiOp ? i.imm : i.pc + i.imm);
+
+    return true;
+}
+
+//> Emits op inline if it has a host-code template, false if it has to be called
+bool emitInline(Emitter& e, u16 op, const InstrInfo& i)
+{
+    if (op == OP_FormatFence_FenceOp)
+        return true;
+
+    return emitR(e, op, i) || emitI(e, op, i) || emitU(e, op, i);
+}
+
+u8 branch_cc(u16 op)
+{
+    switch (op)
+    {
+        case OP_FormatB_BeqOp:  return CC_E;
+        case OP_FormatB_BneOp:  return CC_NE;
+        case OP_FormatB_BltOp:  return CC_L;
+        case OP_FormatB_BgeOp:  return CC_GE;
+        case OP_FormatB_BltuOp: return CC_B;
+        default:                return CC_AE; // bgeu
+    }
+}
+
+//> The block's last op: writes the next pc and returns Success
+void emitExit(Emitter& e, const Block& b, const BlockOp& last)
+{
+    const InstrInfo& i = last.info;
+
+    if (last.op >= OP_FormatB_BeqOp && last.op <= OP_FormatB_BgeuOp)
+    {
+        e.load(EAX, i.rs1);
+        e.bytes({0x3B, 0x43, Emitter::slot(i.rs2)});        // cmp eax, [rs2]
+        e.movImm(ECX, i.pc + 4);
+        e.movImm(EDX, i.pc + i.imm);
+        e.bytes({0x0F, u8(0x40 | branch_cc(last.op)), 0xCA}); // cmovcc ecx, edx
+        e.setPc(ECX);
+    }
+    else if (last.op == OP_FormatJ_JalOp)
+    {
+        if (i.rd != 0)
+            e.storeImm(i.rd, i.pc + 4);
+
+        e.setPc(i.pc + i.imm);
+    }
+    else if (last.op == OP_FormatJalr_JalrOp)
+    {
+        e.load(EAX, i.rs1);
+        e.aluImm(0x05, i.imm);
+        e.bytes({0x83, 0xE0, 0xFE}); // and eax, ~1
+
+        if (i.rd != 0)
+            e.storeImm(i.rd, i.pc + 4);
+
+        e.setPc(EAX);
+    }
+    else // OP_END
+    {
+        e.setPc(b.end_pc);
+    }
+
+    e.returnSuccess();
+}
+
+} // namespace
+
+Jit::Jit()
+{
+    void* p = mmap(nullptr, CODE_SIZE, PROT_READ | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p != MAP_FAILED)
+        code_ = static_cast<u8*>(p);
+    else
+        off_ = true; // nothing to compile into; the threaded engine runs everything
+}
+
+Jit::~Jit()
+{
+    if (code_)
+        munmap(code_, CODE_SIZE);
+}
+
+bool Jit::compile(Block& b)
+{
+    const BlockOp& last = b.ops.back();
+
+    if (off_ || full_ || last.op == OP_EXIT_CALL)
+    {
+        ++stats.rejected;
+        return false;
+    }
+
+    scratch_.clear();
+
+    Emitter e(scratch_);
+    e.prologue();
+
+    const Handler* apply = apply_table();
+
+    for (size_t n = 0; n + 1 < b.ops.size(); ++n)
+    {
+        const BlockOp&   op = b.ops[n];
+        const InstrInfo& i  = op.info;
+        const u16        id = unfused_op(op.op);
+
+        if (!emitInline(e, id, i))
+            e.callApply(apply[id], i);
+    }
+
+    emitExit(e, b, last);
+
+    // Keep code 16-byte aligned
+    const size_t size = (scratch_.size() + 15) & ~size_t(15);
+
+    if (used_ + size > CODE_SIZE)
+    {
+        full_ = true;
+        ++stats.rejected;
+        return false;
+    }
+
+    // Flip only the pages the block lands on to writable for the copy
+    const size_t page  = 4096;
+    u8*          first = code_ + (used_ & ~(page - 1));
+    u8*          end   = code_ + ((used_ + size + page - 1) & ~(page - 1));
+
+    // If the host says no, the first page may have lost exec under blocks
+    // compiled earlier: drop them all once through full() and stay threaded
+    if (mprotect(first, size_t(end - first), PROT_READ | PROT_WRITE) != 0)
+        return disable();
+
+    std::memcpy(code_ + used_, scratch_.data(), scratch_.size());
+
+    if (mprotect(first, size_t(end - first), PROT_READ | PROT_EXEC) != 0)
+        return disable();
+
+    b.native = reinterpret_cast<NativeBlock>(code_ + used_);
+    used_   += size;
+
+    ++stats.compiled;
+    return true;
+}
+
+bool Jit::disable()
+{
+    off_  = true;
+    full_ = true;
+    ++stats.rejected;
+    return false;
+}
+
+void Jit::reset()
+{
+    used_ = 0;
+    full_ = false;
+}
+
+#else // !RV32I_JIT_SUPPORTED
+
+Jit::Jit()  = default;
+Jit::~Jit() = default;
+
+bool Jit::compile(Block&)
+{
+    ++stats.rejected;
+    return false;
+}
+
+void Jit::reset() {}
+
+#endif
+
+} // namespace rv32i
@@ -0,0 +1,125 @@
+#include <fstream>
+#include <iterator>
+#include <map>
+#include <mutex>
+#include <utility>
+
+#include "MappedFile.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define RV32I_FILE_MMAP 1
+#else
+#define RV32I_FILE_MMAP 0
+#endif
+
+namespace rv32i {
+
+#if RV32I_FILE_MMAP
+
+//> Live mappings by (device, inode); guests on other threads map and open too
+static std::mutex                        live_lock;
+static std::map<std::pair<u64, u64>, u32> live;
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+    const int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    return fd < 0 ? nullptr : map(fd);
+}
+
+std::shared_ptr<MappedFile> MappedFile::fromFd(int fd)
+{
+    const int own = fcntl(fd, F_DUPFD_CLOEXEC, 0);
+
+    return own < 0 ? nullptr : map(own);
+}
+
+std::shared_ptr<MappedFile> MappedFile::map(int fd)
+{
+    struct stat st{};
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    void* p = mmap(nullptr, size_t(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+
+    if (p == MAP_FAILED)
+    {
+        ::close(fd);
+        return nullptr;
+    }
+
+    std::shared_ptr<MappedFile> f(new MappedFile);
+
+    f->data_ = static_cast<const u8*>(p);
+    f->size_ = size_t(st.st_size);
+    f->fd_   = fd;
+    f->dev_  = u64(st.st_dev);
+    f->ino_  = u64(st.st_ino);
+
+    std::lock_guard<std::mutex> guard(live_lock);
+    ++live[{f->dev_, f->ino_}];
+
+    return f;
+}
+
+MappedFile::~MappedFile()
+{
+    if (fd_ < 0)
+        return;
+
+    munmap(const_cast<u8*>(data_), size_);
+    ::close(fd_);
+
+    std::lock_guard<std::mutex> guard(live_lock);
+
+    if (auto it = live.find({dev_, ino_}); it != live.end() && --it->second == 0)
+        live.erase(it);
+}
+
+bool MappedFile::mapped(int fd)
+{
+    struct stat st{};
+
+    if (fstat(fd, &st) != 0)
+        return false;
+
+    std::lock_guard<std::mutex> guard(live_lock);
+
+    return live.count({u64(st.st_dev), u64(st.st_ino)}) != 0;
+}
+
+#else
+
+std::shared_ptr<MappedFile> MappedFile::open(const std::string& path)
+{
+    std::ifstream in(path, std::ios::binary);
+
+    if (!in)
+        return nullptr;
+
+    std::shared_ptr<MappedFile> f(new MappedFile);
+
+    f->copy_.assign(std::istreambuf_iterator<char>(in), {});
+    f->data_ = f->copy_.data();
+    f->size_ = f->copy_.size();
+
+    return f;
+}
+
+std::shared_ptr<MappedFile> MappedFile::fromFd(int) { return nullptr; }
+
+bool MappedFile::mapped(int) { return false; }
+
+MappedFile::~MappedFile() = default;
+
+#endif
+
+} // namespace rv32i
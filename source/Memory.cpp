@@ -0,0 +1,676 @@
+#include <algorithm>
+#include <stdexcept>
+
+#include "MappedFile.hpp"
+#include "Memory.hpp"
+
+#if RV32I_FLAT_MEMORY_SUPPORTED
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+namespace rv32i {
+
+#if RV32I_FLAT_MEMORY_SUPPORTED
+
+static constexpr size_t FLAT_SIZE = size_t(1) << 32;
+
+SparseMemory::SparseMemory(MemoryBackend backend)
+{
+    if (backend != MemoryBackend::Flat || !flatSupported())
+        return;
+
+    // Read/write from the start: the host hands out zero pages on first touch,
+    // and nothing is committed up front thanks to MAP_NORESERVE
+    void* p = mmap(nullptr, FLAT_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+
+    if (p == MAP_FAILED)
+        return;
+
+    flat_  = static_cast<u8*>(p);
+    flags_ = std::make_unique<u8[]>(NUM_PAGES);
+}
+
+SparseMemory::~SparseMemory()
+{
+    releaseAll();
+
+    if (flat_)
+        munmap(flat_, FLAT_SIZE);
+}
+
+void SparseMemory::releaseFlat()
+{
+    for (u32 page = 0; page < NUM_PAGES; ++page)
+        if (flags_[page] & PAGE_CODE)
+            firstTouch(page);
+
+    // Drops the committed pages, and any file mapped in; they read as zero again
+    void* p = mmap(flat_, FLAT_SIZE, PROT_READ | PROT_WRITE,
+                   MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+    if (p == MAP_FAILED)
+        madvise(flat_, FLAT_SIZE, MADV_DONTNEED);
+
+    std::memset(flags_.get(), 0, NUM_PAGES);
+    flat_pages_ = 0;
+}
+
+#else
+
+SparseMemory::SparseMemory(MemoryBackend) {}
+
+SparseMemory::~SparseMemory()
+{
+    releaseAll();
+}
+
+void SparseMemory::releaseFlat() {}
+
+#endif
+
+void SparseMemory::releaseAll()
+{
+    // Fork relatives may go on using pools this memory shares pages of: they
+    // have to stop counting it as a holder. No code hooks, the owner is going.
+    for (auto& [index, page] : pages_)
+        releaseSlot(page);
+
+    pages_.clear();
+    dropBaseline();
+}
+
+void SparseMemory::protectPages(u32 first, u64 count, u8 perm)
+{
+    if (!flags_)
+        flags_ = std::make_unique<u8[]>(NUM_PAGES);
+
+    const u8 deny = u8((~perm & PERM_RWX) << DENY_SHIFT);
+
+    for (u64 i = 0; i < count; ++i)
+    {
+        const u32 page = u32((first + i) % NUM_PAGES);
+        u8&       f    = flags_[page];
+
+        // The first change since the baseline remembers what to go back to
+        if (tracking_ && !(f & PAGE_REPROTECTED) && (f & DENY_MASK) != deny)
+        {
+            f = u8(f | PAGE_REPROTECTED);
+            perm_log_.emplace_back(page, u8(f & DENY_MASK));
+        }
+
+        setDenied(page, deny);
+    }
+
+    flushTlbs();
+}
+
+void SparseMemory::setDenied(u32 page_index, u8 deny)
+{
+    u8& f = flags_[page_index];
+
+    // Code decoded from a page it may no longer run, or now may, is dropped
+    if ((f ^ deny) & PAGE_NO_EXEC)
+    {
+        if (flat_ && (f & PAGE_CODE))
+        {
+            f &= u8(~PAGE_CODE);
+
+            if (on_code_write_)
+                on_code_write_(page_index);
+        }
+        else if (!flat_)
+        {
+            auto it = pages_.find(page_index);
+
+            if (it != pages_.end() && it->second.code)
+                codeWritten(page_index, it->second);
+        }
+    }
+
+    f = u8((f & ~DENY_MASK) | deny);
+}
+
+void SparseMemory::forkFrom(SparseMemory& parent)
+{
+    clear();
+
+    if (parent.flags_)
+    {
+        if (!flags_)
+            flags_ = std::make_unique<u8[]>(NUM_PAGES);
+
+        for (u32 page = 0; page < NUM_PAGES; ++page)
+            flags_[page] = u8(parent.flags_[page] & DENY_MASK);
+    }
+
+    if (!flat_ && !parent.flat_)
+    {
+        pages_.reserve(parent.pages_.size());
+
+        for (auto& [index, slot] : parent.pages_)
+        {
+            parent.shareSlot(slot);
+
+            if (slot.from)
+                slot.from->share(slot.data);
+
+            pages_.emplace(index, PageSlot{slot.data, slot.from, false, true});
+        }
+
+        shared_pages_ = pages_.size();
+        file_ranges_  = parent.file_ranges_;
+
+        kept_ = parent.kept_;
+        kept_.push_back(parent.pool_);
+
+        // Parent's pages are snapshots now: its stores have to miss and copy
+        parent.write_tlb_.fill({});
+
+        return;
+    }
+
+    const auto copy = [&](u32 page, const u8* data) {
+        WriteBlock(page * PAGE_SIZE, data, PAGE_SIZE);
+    };
+
+    if (parent.flat_)
+    {
+        for (u32 page = 0; page < NUM_PAGES; ++page)
+            if (parent.flags_[page] & PAGE_TOUCHED)
+                copy(page, parent.flat_ + size_t(page) * PAGE_SIZE);
+    }
+    else
+    {
+        for (const auto& [index, slot] : parent.pages_)
+            copy(index, slot.data);
+
+        for (const FileRange& r : parent.file_ranges_)
+            for (u32 i = 0; i < r.count; ++i)
+                if (!parent.pages_.count(r.first + i))
+                    copy(r.first + i, r.data + size_t(i) * PAGE_SIZE);
+    }
+}
+
+bool SparseMemory::mapFile(u32 addr, std::shared_ptr<const MappedFile> file, u64 offset, u32 len)
+{
+    if (addr % PAGE_SIZE || offset % PAGE_SIZE || len % PAGE_SIZE || offset + len > file->size())
+        return false;
+
+    const u32 first = addr / PAGE_SIZE;
+    const u32 count = len / PAGE_SIZE;
+
+    if (flat_)
+    {
+#if RV32I_FLAT_MEMORY_SUPPORTED
+        if (file->fd() < 0 || sysconf(_SC_PAGESIZE) != long(PAGE_SIZE))
+            return false;
+
+        void* p = mmap(flat_ + addr, len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+                       file->fd(), off_t(offset));
+
+        if (p == MAP_FAILED)
+        {
+            // A failed fixed mapping may have taken the old one with it
+            mmap(flat_ + addr, len, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+            return false;
+        }
+
+        // Counted, and seen by code marks and dirty tracking, like a store
+        for (u32 page = first; page < first + count; ++page)
+            firstTouch(page);
+
+        // The host mapping outlives the descriptor; the file stays mapped() as long
+        keep(std::move(file));
+
+        return true;
+#endif
+    }
+
+    const u8* data = file->data() + offset;
+
+    // A baseline has to see each page change, so it gets a slot now
+    if (tracking_)
+    {
+        for (u32 page = first; page < first + count; ++page)
+            replacePage(page, data + u64(page - first) * PAGE_SIZE);
+    }
+    else
+    {
+        discard(addr, len);
+
+        auto at = std::lower_bound(file_ranges_.begin(), file_ranges_.end(), first,
+                                   [](const FileRange& r, u32 page) { return r.first < page; });
+
+        file_ranges_.insert(at, FileRange{first, count, data});
+        flushTlbs();
+    }
+
+    keep(std::move(file));
+
+    return true;
+}
+
+bool SparseMemory::discard(u32 addr, u32 len)
+{
+    if (addr % PAGE_SIZE || len % PAGE_SIZE || u64(addr) + len > u64(NUM_PAGES) * PAGE_SIZE)
+        return false;
+
+    const u32 first = addr / PAGE_SIZE;
+    const u32 count = len / PAGE_SIZE;
+
+    if (tracking_)
+    {
+        Fill(addr, 0, len);
+        return true;
+    }
+
+    if (flat_)
+    {
+#if RV32I_FLAT_MEMORY_SUPPORTED
+        for (u32 page = first; page < first + count; ++page)
+        {
+            u8& f = flags_[page];
+
+            if (f & PAGE_CODE)
+            {
+                f &= u8(~PAGE_CODE);
+
+                if (on_code_write_)
+                    on_code_write_(page);
+            }
+
+            if (f & PAGE_TOUCHED)
+            {
+                f &= u8(~PAGE_TOUCHED);
+                --flat_pages_;
+            }
+        }
+
+        // A fresh mapping rather than MADV_DONTNEED, which would bring back
+        // a file mapped there
+        void* p = mmap(flat_ + addr, len, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+
+        if (p == MAP_FAILED)
+            madvise(flat_ + addr, len, MADV_DONTNEED);
+#endif
+        return true;
+    }
+
+    if (!file_ranges_.empty())
+    {
+        cutFileRanges(first, count);
+        flushTlbs();
+    }
+
+    auto drop = [&](u32 page, PageSlot& slot) {
+        if (slot.code)
+            codeWritten(page, slot);
+
+        releaseSlot(slot);
+        evict(page);
+    };
+
+    // Whichever is fewer: the pages in the range, or the pages there are
+    if (count <= pages_.size())
+    {
+        for (u32 page = first; page < first + count; ++page)
+        {
+            if (auto it = pages_.find(page); it != pages_.end())
+            {
+                drop(page, it->second);
+                pages_.erase(it);
+            }
+        }
+
+        return true;
+    }
+
+    for (auto it = pages_.begin(); it != pages_.end(); )
+    {
+        if (it->first - first < count)
+        {
+            drop(it->first, it->second);
+            it = pages_.erase(it);
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    return true;
+}
+
+void SparseMemory::cutFileRanges(u32 first, u32 count)
+{
+    const u64 end = u64(first) + count;
+
+    std::vector<FileRange> kept;
+    kept.reserve(file_ranges_.size() + 1);
+
+    for (const FileRange& r : file_ranges_)
+    {
+        const u64 r_end = u64(r.first) + r.count;
+
+        if (r_end <= first || r.first >= end)
+        {
+            kept.push_back(r);
+            continue;
+        }
+
+        if (r.first < first)
+            kept.push_back({r.first, first - r.first, r.data});
+
+        if (r_end > end)
+            kept.push_back({u32(end), u32(r_end - end), r.data + (end - r.first) * PAGE_SIZE});
+    }
+
+    file_ranges_ = std::move(kept);
+}
+
+void SparseMemory::keep(std::shared_ptr<const void> owner)
+{
+    if (owner && std::find(kept_.begin(), kept_.end(), owner) == kept_.end())
+        kept_.push_back(std::move(owner));
+}
+
+void SparseMemory::replacePage(u32 page_index, const u8* data)
+{
+    PageSlot& slot = pages_[page_index];
+
+    if (slot.code)
+        codeWritten(page_index, slot);
+
+    if (slot.data)
+        releaseSlot(slot);
+
+    // Never written through: a store copies the page first
+    slot.data   = const_cast<u8*>(data);
+    slot.from   = nullptr;
+    slot.shared = true;
+
+    ++shared_pages_;
+
+    if (tracking_ && !slot.dirty)
+    {
+        slot.dirty = true;
+        dirty_.push_back(page_index);
+    }
+
+    evict(page_index);
+}
+
+const u8* SparseMemory::zeroPage()
+{
+    alignas(PAGE_SIZE) static const u8 zero[PAGE_SIZE] = {};
+
+    return zero;
+}
+
+size_t SparseMemory::shareZeroPages()
+{
+    size_t shared = 0;
+
+    for (u32 page : privatePages())
+        shared += mergePage(page, zeroPage(), nullptr);
+
+    return shared;
+}
+
+std::vector<u32> SparseMemory::privatePages() const
+{
+    std::vector<u32> out;
+
+    for (const auto& [index, slot] : pages_)
+        if (!slot.shared)
+            out.push_back(index);
+
+    return out;
+}
+
+std::pair<const u8*, std::shared_ptr<PagePool>> SparseMemory::shareOut(u32 page_index)
+{
+    auto it = pages_.find(page_index);
+
+    if (it == pages_.end() || it->second.shared)
+        return {nullptr, nullptr};
+
+    shareSlot(it->second);
+    pool_->share(it->second.data);
+
+    // Its own stores have to miss and copy from now on
+    evict(page_index);
+
+    return {it->second.data, pool_};
+}
+
+bool SparseMemory::mergePage(u32 page_index, const u8* data, std::shared_ptr<PagePool> from)
+{
+    auto it = pages_.find(page_index);
+
+    if (it == pages_.end())
+        return false;
+
+    PageSlot& slot = it->second;
+
+    if (slot.shared || std::memcmp(slot.data, data, PAGE_SIZE) != 0)
+        return false;
+
+    // Same bytes: decoded code and dirty state still hold
+    pool_->release(slot.data);
+
+    if (from)
+        from->share(data);
+
+    slot.data   = const_cast<u8*>(data);
+    slot.from   = from.get();
+    slot.shared = true;
+    ++shared_pages_;
+
+    keep(std::move(from));
+    evict(page_index);
+
+    return true;
+}
+
+void SparseMemory::dropBaseline()
+{
+    // Flat baselines are private copies, page map ones one more holder of
+    // a snapshot: either way the pool gets them back with the last holder
+    for (const auto& [index, page] : baseline_)
+        if (page.from)
+            page.from->release(page.data);
+
+    if (flags_)
+        for (const auto& [page, deny] : perm_log_)
+            flags_[page] &= u8(~PAGE_REPROTECTED);
+
+    baseline_.clear();
+    dirty_.clear();
+    perm_log_.clear();
+    tracking_ = false;
+}
+
+void SparseMemory::markBaseline()
+{
+    dropBaseline();
+    tracking_ = true;
+
+    if (flat_)
+    {
+        for (u32 page = 0; page < NUM_PAGES; ++page)
+        {
+            u8& f = flags_[page];
+
+            if (f & PAGE_TOUCHED)
+            {
+                u8* copy = pool_->allocate();
+
+                std::memcpy(copy, flat_ + size_t(page) * PAGE_SIZE, PAGE_SIZE);
+                baseline_.emplace(page, BaselinePage{copy, pool_.get()});
+            }
+
+            f = u8(f | PAGE_CLEAN);
+        }
+
+        return;
+    }
+
+    baseline_.reserve(pages_.size());
+
+    for (auto& [index, slot] : pages_)
+    {
+        shareSlot(slot);
+
+        if (slot.from)
+            slot.from->share(slot.data);
+
+        slot.dirty = false;
+        baseline_.emplace(index, BaselinePage{slot.data, slot.from});
+    }
+
+    // The first store to each page has to miss to be seen
+    write_tlb_.fill({});
+}
+
+void SparseMemory::resetToBaseline()
+{
+    for (const auto& [page, deny] : perm_log_)
+    {
+        flags_[page] &= u8(~PAGE_REPROTECTED);
+        setDenied(page, deny);
+    }
+
+    if (!perm_log_.empty())
+    {
+        perm_log_.clear();
+        flushTlbs();
+    }
+
+    if (flat_)
+    {
+        for (u32 page : dirty_)
+        {
+            u8& f    = flags_[page];
+            u8* data = flat_ + size_t(page) * PAGE_SIZE;
+
+            if (auto it = baseline_.find(page); it != baseline_.end())
+            {
+                std::memcpy(data, it->second.data, PAGE_SIZE);
+            }
+            else
+            {
+                std::memset(data, 0, PAGE_SIZE);
+
+                if (f & PAGE_TOUCHED)
+                {
+                    f &= u8(~PAGE_TOUCHED);
+                    --flat_pages_;
+                }
+            }
+
+            if (f & PAGE_CODE)
+            {
+                f &= u8(~PAGE_CODE);
+
+                if (on_code_write_)
+                    on_code_write_(page);
+            }
+
+            f = u8(f | PAGE_CLEAN);
+        }
+
+        dirty_.clear();
+        return;
+    }
+
+    for (u32 page : dirty_)
+    {
+        auto it = pages_.find(page);
+
+        if (it == pages_.end())
+            continue;
+
+        PageSlot& slot = it->second;
+
+        if (slot.code)
+            codeWritten(page, slot);
+
+        releaseSlot(slot);
+
+        if (auto b = baseline_.find(page); b != baseline_.end())
+        {
+            if (b->second.from)
+                b->second.from->share(b->second.data);
+
+            slot.data   = b->second.data;
+            slot.from   = b->second.from;
+            slot.shared = true;
+            slot.dirty  = false;
+
+            ++shared_pages_;
+        }
+        else
+        {
+            pages_.erase(it);
+        }
+    }
+
+    dirty_.clear();
+    flushTlbs();
+}
+
+static constexpr char CHECKPOINT_MAGIC[8] = {'R', 'V', '3', '2', 'D', 'I', 'R', 'T'};
+
+void SparseMemory::writeDirtyPages(std::ostream& out) const
+{
+    u8 word[4];
+
+    out.write(CHECKPOINT_MAGIC, sizeof(CHECKPOINT_MAGIC));
+
+    storeLE<u32>(word, u32(dirty_.size()));
+    out.write(reinterpret_cast<const char*>(word), sizeof(word));
+
+    std::array<u8, PAGE_SIZE> data;
+
+    for (u32 page : dirty_)
+    {
+        ReadBlock(page * PAGE_SIZE, data.data(), PAGE_SIZE);
+
+        storeLE<u32>(word, page);
+        out.write(reinterpret_cast<const char*>(word), sizeof(word));
+        out.write(reinterpret_cast<const char*>(data.data()), PAGE_SIZE);
+    }
+}
+
+void SparseMemory::readPages(std::istream& in)
+{
+    char magic[sizeof(CHECKPOINT_MAGIC)];
+    u8   word[4];
+
+    if (!in.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CHECKPOINT_MAGIC))
+        throw std::runtime_error("Not a memory checkpoint");
+
+    if (!in.read(reinterpret_cast<char*>(word), sizeof(word)))
+        throw std::runtime_error("Truncated memory checkpoint");
+
+    const u32 count = loadLE<u32>(word);
+
+    std::array<u8, PAGE_SIZE> data;
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        if (!in.read(reinterpret_cast<char*>(word), sizeof(word)) ||
+            !in.read(reinterpret_cast<char*>(data.data()), PAGE_SIZE))
+            throw std::runtime_error("Truncated memory checkpoint");
+
+        WriteBlock(loadLE<u32>(word) * PAGE_SIZE, data.data(), PAGE_SIZE);
+    }
+}
+
+} // namespace rv32i
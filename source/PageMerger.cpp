@@ -0,0 +1,132 @@
+#include <algorithm>
+#include <cstring>
+
+#include "PageMerger.hpp"
+
+namespace rv32i {
+
+static constexpr u32 PAGE_SIZE = SparseMemory::PAGE_SIZE;
+
+//> FNV-1a over the page's words
+static u64 hash_page(const u8* data)
+{
+    u64 h = 0xCBF29CE484222325ull;
+
+    for (u32 off = 0; off < PAGE_SIZE; off += 8)
+    {
+        u64 w;
+        std::memcpy(&w, data + off, 8);
+
+        h = (h ^ w) * 0x100000001B3ull;
+    }
+
+    return h;
+}
+
+void PageMerger::add(SparseMemory& m)
+{
+    if (std::find(memories_.begin(), memories_.end(), &m) == memories_.end())
+        memories_.push_back(&m);
+}
+
+void PageMerger::remove(SparseMemory& m)
+{
+    memories_.erase(std::remove(memories_.begin(), memories_.end(), &m), memories_.end());
+
+    queue_.erase(std::remove_if(queue_.begin(), queue_.end(),
+                                [&](const auto& q) { return q.first == &m; }),
+                 queue_.end());
+}
+
+size_t PageMerger::mergeOne(SparseMemory& m, u32 page_index)
+{
+    const u8* data = m.peekPage(page_index);
+
+    if (!data)
+        return 0;
+
+    ++stats.scanned;
+
+    if (std::memcmp(data, SparseMemory::zeroPage(), PAGE_SIZE) == 0)
+    {
+        const bool merged = m.mergePage(page_index, SparseMemory::zeroPage(), nullptr);
+
+        stats.zero += merged;
+        return merged;
+    }
+
+    if (!writable && (m.permissions(page_index * PAGE_SIZE) & SparseMemory::PERM_W))
+        return 0;
+
+    const u64 h = hash_page(data);
+
+    auto [first, last] = stable_.equal_range(h);
+
+    for (auto it = first; it != last; ++it)
+    {
+        if (it->second.data == data)
+            return 0;
+
+        if (m.mergePage(page_index, it->second.data, it->second.from))
+        {
+            ++stats.merged;
+            return 1;
+        }
+    }
+
+    // First of its kind: later copies get merged into this one
+    auto [shared, from] = m.shareOut(page_index);
+
+    if (shared)
+        stable_.emplace(h, Stable{shared, std::move(from)});
+
+    return 0;
+}
+
+void PageMerger::forget()
+{
+    for (auto& [h, first] : stable_)
+        first.from->release(const_cast<u8*>(first.data));
+
+    stable_.clear();
+}
+
+size_t PageMerger::scan(size_t max_pages)
+{
+    size_t merged  = 0;
+    bool   refills = false;
+
+    for (size_t n = 0; n < max_pages; ++n)
+    {
+        if (queue_.empty())
+        {
+            // At most one new round per call, so a round with nothing to do ends it
+            if (refills)
+                break;
+
+            for (SparseMemory* m : memories_)
+                for (u32 page : m->privatePages())
+                    queue_.emplace_back(m, page);
+
+            refills = true;
+            ++stats.rounds;
+
+            if (queue_.empty())
+                break;
+        }
+
+        auto [m, page] = queue_.back();
+        queue_.pop_back();
+
+        merged += mergeOne(*m, page);
+    }
+
+    // Merged pages went back to their pools; let the host have them
+    if (merged)
+        for (SparseMemory* m : memories_)
+            m->trimPool();
+
+    return merged;
+}
+
+} // namespace rv32i
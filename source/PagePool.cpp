@@ -0,0 +1,92 @@
+#include <cstdint>
+#include <new>
+
+#include "PagePool.hpp"
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h>
+#define RV32I_POOL_MMAP 1
+#else
+#define RV32I_POOL_MMAP 0
+#endif
+
+namespace rv32i {
+
+PagePool::~PagePool()
+{
+    for (u8* slab : slabs_)
+        freeSlab(slab);
+}
+
+#if RV32I_POOL_MMAP
+
+u8* PagePool::newSlab()
+{
+    // Over-reserve, then trim to a SLAB_SIZE-aligned window. Fresh anonymous
+    // memory is zero and only committed when touched.
+    const size_t span = 2 * SLAB_SIZE;
+
+    void* p = mmap(nullptr, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (p == MAP_FAILED)
+        throw std::bad_alloc();
+
+    u8* raw  = static_cast<u8*>(p);
+    u8* slab = reinterpret_cast<u8*>((reinterpret_cast<uintptr_t>(raw) + SLAB_SIZE - 1) & ~(uintptr_t(SLAB_SIZE) - 1));
+
+    if (slab != raw)
+        munmap(raw, size_t(slab - raw));
+
+    if (slab + SLAB_SIZE != raw + span)
+        munmap(slab + SLAB_SIZE, size_t(raw + span - (slab + SLAB_SIZE)));
+
+#ifdef MADV_HUGEPAGE
+    if (huge_)
+        madvise(slab, SLAB_SIZE, MADV_HUGEPAGE);
+#endif
+
+    return slab;
+}
+
+void PagePool::freeSlab(u8* slab)
+{
+    munmap(slab, SLAB_SIZE);
+}
+
+void PagePool::trim()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // Dropped pages read as zero and are committed again on reuse
+    for (size_t i = free_.size() - untrimmed_; i < free_.size(); ++i)
+        madvise(free_[i], PAGE_SIZE, MADV_DONTNEED);
+
+    untrimmed_ = 0;
+}
+
+#else
+
+u8* PagePool::newSlab()
+{
+    u8* slab = static_cast<u8*>(::operator new(SLAB_SIZE, std::align_val_t(SLAB_SIZE)));
+
+    std::memset(slab, 0, SLAB_SIZE);
+
+    return slab;
+}
+
+void PagePool::freeSlab(u8* slab)
+{
+    ::operator delete(slab, std::align_val_t(SLAB_SIZE));
+}
+
+void PagePool::trim()
+{
+    std::lock_guard<std::mutex> guard(lock_);
+
+    untrimmed_ = 0;
+}
+
+#endif
+
+} // namespace rv32i
@@ -1,24 +1,29 @@
 #include "Runner.hpp"
-#include "Decoder.hpp"
+#include "BlockEngine.hpp"
 #include "Status.hpp"
 namespace rv32i {
 
-ExecutionResult run_program(Interpreter& cpu, size_t cycle_limit)
+ExecutionResult run_program(Interpreter& cpu, size_t cycle_limit, Engine engine)
 {
+    if (engine != Engine::Interpreter)
+        return run_blocks(cpu, cycle_limit, {engine == Engine::Jit || engine == Engine::Tiered,
+                                             engine == Engine::Trace,
+                                             engine == Engine::Tiered});
+
     ExecutionResult res{ExecutionStatus::Success, 0, 0, 0};
 
     for (int cycles = 0; cycles < cycle_limit; ++cycles)
     {
-        u32 instr = cpu.load<u32>(cpu.pc());
-
-        auto [info, key] = Decoder::decode(instr, cpu.pc());
+        const DecodedInstr& d = cpu.fetch(cpu.pc());
 
-        res.pc = info.pc;
+        res.pc = d.info.pc;
 
-        ExecutionStatus st = cpu.dispatch(cpu.state, info, key);
+        ExecutionStatus st = d.handler(cpu.state, d.info);
 
         res.cycles = cycles + 1;
 
+        cpu.tiers().retire(TIER_INTERPRETER, 1);
+
         if (st == ExecutionStatus::ProgramExit)
         {
             res.status    = st;
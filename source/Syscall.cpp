@@ -1,41 +1,140 @@
-#include <cstdio>
+#include <cerrno>
 #include <iostream>
-#include <cstdlib>
+#include <memory>
+#include <string>
 
-#include <iostream>
 #include "Syscall.hpp"
 #include "IntTypes.hpp"
 #include "InterpreterState.hpp"
 
 namespace rv32i {
 
+//> Longest path the guest may pass, with its NUL
+static constexpr u32 PATH_MAX_GUEST = 4096;
+
+//> Guest iovecs handled by one READV/WRITEV, as Linux's IOV_MAX
+static constexpr u32 IOV_MAX_GUEST = 1024;
+
+//> NUL-terminated guest string at addr; false if the guest could not read it
+//> all or it is too long
+static bool read_path(const SparseMemory& m, u32 addr, std::string& out)
+{
+    out.clear();
+
+    for (u32 i = 0; i < PATH_MAX_GUEST; ++i)
+    {
+        if (!m.allows(addr + i, 1, SparseMemory::PERM_R))
+            return false;
+
+        const char c = char(m.LoadU8(addr + i));
+
+        if (c == '\0')
+            return true;
+
+        out += c;
+    }
+
+    return false;
+}
+
+//> READV/WRITEV: each guest iovec {base, len} in turn, stopping at the first
+//> that comes up short
+static u32 transfer_iov(InterpreterState& s, bool out, u32 fd, u32 iov, u32 count)
+{
+    if (count > IOV_MAX_GUEST)
+        return errno_result(EINVAL);
+
+    if (!s.memory.allows(iov, count * 8, SparseMemory::PERM_R))
+        return errno_result(EFAULT);
+
+    u32 total = 0;
+
+    for (u32 i = 0; i < count; ++i)
+    {
+        const u32 base = s.memory.LoadU32(iov + 8 * i);
+        const u32 len  = s.memory.LoadU32(iov + 8 * i + 4);
+
+        if (!s.memory.allows(base, len, out ? SparseMemory::PERM_R : SparseMemory::PERM_W))
+            return total ? total : errno_result(EFAULT);
+
+        const u32 n = out ? s.io.write(s.memory, fd, base, len) : s.io.read(s.memory, fd, base, len);
+
+        if (s32(n) < 0)
+            return total ? total : n;
+
+        total += n;
+
+        if (n < len)
+            break;
+    }
+
+    return total;
+}
+
 ExecutionStatus handle_syscall(InterpreterState& s)
 {
     const u32 syscall_num = s.regs[17]; // a7
     const u32 a0 = s.regs[10]; // arg0
     const u32 a1 = s.regs[11]; // arg1
     const u32 a2 = s.regs[12]; // arg2
+    const u32 a3 = s.regs[13]; // arg3
+    const u32 a4 = s.regs[14]; // arg4
 
     switch (syscall_num)
     {
-        case Syscall::READ:
+        case Syscall::OPENAT:
         {
-            u32 bytesRead = 0;
+            std::string path;
 
-            if (a0 == 0)
-            {
-                for (u32 i = 0; i < a2; ++i)
-                 {
-                    char c;
-                    if (!std::cin.get(c)) break;
+            if (!read_path(s.memory, a1, path))
+                s.regs[10] = errno_result(EFAULT);
+            else
+                s.regs[10] = u32(s.io.files.open(s32(a0), path, a2, a3));
+
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::CLOSE:
+        {
+            s.regs[10] = u32(s.io.close(a0));
+            s.pc += 4;
 
-                    s.memory.StoreU8(a1 + i, static_cast<u8>(c));
+            return ExecutionStatus::Success;
+        }
 
-                    bytesRead++;
-                }
+        case Syscall::LSEEK:
+        {
+            // _llseek(fd, offset_high, offset_low, loff_t* result, whence)
+            const s64 pos = s.io.seek(a0, s64(u64(a1) << 32 | a2), a4);
+
+            if (pos < 0)
+            {
+                s.regs[10] = u32(pos);
+            }
+            else if (!s.memory.allows(a3, 8, SparseMemory::PERM_W))
+            {
+                s.regs[10] = errno_result(EFAULT);
+            }
+            else
+            {
+                s.memory.StoreU32(a3,     u32(pos));
+                s.memory.StoreU32(a3 + 4, u32(u64(pos) >> 32));
+                s.regs[10] = 0;
             }
 
-            s.regs[10] = bytesRead;
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::READ:
+        {
+            if (!s.memory.allows(a1, a2, SparseMemory::PERM_W))
+                s.regs[10] = errno_result(EFAULT);
+            else
+                s.regs[10] = s.io.read(s.memory, a0, a1, a2);
 
             s.pc += 4u;
 
@@ -44,15 +143,61 @@ ExecutionStatus handle_syscall(InterpreterState& s)
 
         case Syscall::WRITE:
         {
-            if (a0 == 1)
-            {
-                for (u32 i = 0; i < a2; ++i)
-                {
-                    char c = static_cast<char>(s.memory.LoadU8(a1 + i));
-                    std::cout.put(c);
-                }
+            if (!s.memory.allows(a1, a2, SparseMemory::PERM_R))
+                s.regs[10] = errno_result(EFAULT);
+            else
+                s.regs[10] = s.io.write(s.memory, a0, a1, a2);
+
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::READV:
+        case Syscall::WRITEV:
+        {
+            s.regs[10] = transfer_iov(s, syscall_num == Syscall::WRITEV, a0, a1, a2);
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::PREAD64:
+        case Syscall::PWRITE64:
+        {
+            const bool out    = syscall_num == Syscall::PWRITE64;
+            const u64  offset = u64(a4) << 32 | a3;
+
+            if (!s.memory.allows(a1, a2, out ? SparseMemory::PERM_R : SparseMemory::PERM_W))
+                s.regs[10] = errno_result(EFAULT);
+            else if (out)
+                s.regs[10] = s.io.pwrite(s.memory, a0, a1, a2, offset);
+            else
+                s.regs[10] = s.io.pread(s.memory, a0, a1, a2, offset);
+
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::FSTAT:
+        {
+            u8 st[FileTable::STAT_SIZE];
+
+            const s32 rc = s.io.stat(a0, st);
 
-                std::cout.flush();
+            if (rc < 0)
+            {
+                s.regs[10] = u32(rc);
+            }
+            else if (!s.memory.allows(a1, FileTable::STAT_SIZE, SparseMemory::PERM_W))
+            {
+                s.regs[10] = errno_result(EFAULT);
+            }
+            else
+            {
+                s.memory.WriteBlock(a1, st, FileTable::STAT_SIZE);
+                s.regs[10] = 0;
             }
 
             s.pc += 4;
@@ -60,8 +205,53 @@ ExecutionStatus handle_syscall(InterpreterState& s)
             return ExecutionStatus::Success;
         }
 
+        case Syscall::BRK:
+        {
+            s.regs[10] = s.vm.brk(s.memory, a0);
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::MMAP:
+        {
+            // mmap2(addr, len, prot, flags, fd, pgoff)
+            std::shared_ptr<const MappedFile> file;
+
+            const s32 rc = a3 & AddressSpace::MAP_ANONYMOUS ? 0 : s.io.files.map(a4, file);
+
+            if (rc < 0)
+                s.regs[10] = u32(rc);
+            else
+                s.regs[10] = s.vm.mmap(s.memory, a0, a1, a2, a3, std::move(file),
+                                       u64(s.regs[15]) * SparseMemory::PAGE_SIZE);
+
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::MUNMAP:
+        {
+            s.regs[10] = u32(s.vm.munmap(s.memory, a0, a1));
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
+        case Syscall::MPROTECT:
+        {
+            s.regs[10] = u32(s.vm.mprotect(s.memory, a0, a1, a2));
+            s.pc += 4;
+
+            return ExecutionStatus::Success;
+        }
+
         case Syscall::EXIT:
+        case Syscall::EXIT_GROUP:
         {
+            s.io.flush();
+
             return ExecutionStatus::ProgramExit;
         }
 
@@ -72,4 +262,3 @@ ExecutionStatus handle_syscall(InterpreterState& s)
 }
 
 } // namespace rv32i
-
@@ -0,0 +1,60 @@
+#include <fstream>
+#include <iostream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "Aot.hpp"
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+
+int main(int argc, char* argv[])
+{
+    if (argc != 4 || std::string(argv[2]) != "-o")
+    {
+        std::cerr << "Usage: " << argv[0] << " <program.elf> -o <out.cpp>\n";
+        return 1;
+    }
+
+    const std::string elf_path = argv[1];
+    const std::string out_path = argv[3];
+
+    std::ifstream elf(elf_path, std::ios::binary);
+
+    if (!elf)
+    {
+        std::cerr << "Failed to open " << elf_path << "\n";
+        return 1;
+    }
+
+    std::vector<rv32i::u8> image((std::istreambuf_iterator<char>(elf)), {});
+
+    rv32i::Interpreter cpu{};
+
+    auto load = rv32i::loadElf(cpu, elf_path, {});
+
+    rv32i::register_all_handlers(cpu);
+
+    rv32i::StaticTranslator aot(cpu, load.text_begin, load.text_end);
+
+    aot.discover(load.entry);
+
+    std::ofstream out(out_path);
+
+    if (!out)
+    {
+        std::cerr << "Failed to create " << out_path << "\n";
+        return 1;
+    }
+
+    aot.emit(out, image, elf_path);
+
+    std::cerr << "aot: blocks="      << aot.stats.blocks
+              << " instructions="    << aot.stats.instructions
+              << " indirect="        << aot.stats.indirect
+              << " resolved="        << aot.stats.resolved
+              << " exits="           << aot.stats.exits << "\n";
+
+    return 0;
+}
@@ -1,4 +1,7 @@
 #include <iostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
 #include <vector>
 
 #include "Handlers.hpp"
@@ -7,25 +10,264 @@
 #include "Status.hpp"
 #include "Runner.hpp"
 
+static void print_usage(const char* self)
+{
+    std::cerr << "Usage: " << self << " [--stats] [--engine=interp|block|trace|jit|tiered] [--warm=N] [--hot=N] [--memory=sparse|flat] [--huge-pages] [--stack-size=N] [--heap-size=N] [--no-protect] [--eager-load] [--output=none|line|full] [--root=DIR] <program.elf> [args...]\n";
+}
+
+//> Reads the N of an option, 0x... allowed; false unless it is all digits and fits in 32 bits
+static bool parse_u32(std::string_view text, rv32i::u32& out)
+{
+    const std::string s(text);
+
+    if (s.empty() || s[0] == '-' || s[0] == '+')
+        return false;
+
+    try
+    {
+        size_t             used  = 0;
+        unsigned long long value = std::stoull(s, &used, 0);
+
+        if (used != s.size() || value > 0xFFFFFFFFull)
+            return false;
+
+        out = static_cast<rv32i::u32>(value);
+        return true;
+    }
+    catch (const std::logic_error&) // invalid_argument, out_of_range
+    {
+        return false;
+    }
+}
+
+static int bad_number(const char* self, std::string_view opt)
+{
+    std::cerr << "Bad number in " << opt << "\n";
+    print_usage(self);
+
+    return 1;
+}
+
+static void print_stats(const rv32i::Interpreter& cpu, const rv32i::ExecutionResult& res)
+{
+    const auto& ic = cpu.icacheStats();
+
+    std::cerr << "icache: hits="        << ic.hits
+              << " misses="             << ic.misses
+              << " invalidations="      << ic.invalidations << "\n";
+
+    const auto& bc = cpu.blocks().stats;
+
+    std::cerr << "blocks: translated="  << bc.translated
+              << " executed="           << bc.executed
+              << " invalidated="        << bc.invalidated
+              << " flushes="            << bc.flushes << "\n";
+
+    std::cerr << "exits: chained="      << bc.chained
+              << " unchained="          << bc.unchained
+              << " indirect="           << bc.indirect << "\n";
+
+    const auto& bp = cpu.predictor().stats;
+
+    std::cerr << "jalr: ras_hits="      << bp.ras_hits
+              << " ras_misses="         << bp.ras_misses
+              << " itc_hits="           << bp.itc_hits
+              << " itc_misses="         << bp.itc_misses << "\n";
+
+    const auto& tr = cpu.recorder().stats;
+
+    std::cerr << "traces: started="     << tr.started
+              << " compiled="           << tr.compiled
+              << " aborted="            << tr.aborted
+              << " entered="            << tr.entered
+              << " loops="              << tr.loops
+              << " side_exits="         << tr.side_exits << "\n";
+
+    const auto& jit = cpu.jit().stats;
+
+    std::cerr << "jit: compiled="       << jit.compiled
+              << " rejected="           << jit.rejected
+              << " executed="           << jit.executed
+              << " flushes="            << jit.flushes
+              << " bytes="              << cpu.jit().codeBytes() << "\n";
+
+    const auto mem = cpu.state.memory.usage();
+
+    std::cerr << "memory: pages="       << mem.pages
+              << " free="               << mem.free_pages
+              << " slabs="              << mem.slabs
+              << " host_kib="           << mem.host_bytes / 1024 << "\n";
+
+    const auto& vm = cpu.state.vm.stats;
+
+    std::cerr << "heap: brk_kib="       << vm.heap_bytes / 1024
+              << " brk_peak_kib="       << vm.heap_peak / 1024
+              << " mmap_kib="           << vm.mapped_bytes / 1024
+              << " mmap_peak_kib="      << vm.mapped_peak / 1024
+              << " file_kib="           << vm.file_bytes / 1024
+              << " calls brk="          << vm.brk_calls
+              << " mmap="               << vm.mmap_calls
+              << " munmap="             << vm.munmap_calls
+              << " failed="             << vm.failed << "\n";
+
+    const auto& tiers = cpu.tiers().stats;
+
+    std::cerr << "tiers: interp="       << tiers.retired[rv32i::TIER_INTERPRETER]
+              << " threaded="           << tiers.retired[rv32i::TIER_THREADED]
+              << " trace="              << tiers.retired[rv32i::TIER_TRACE]
+              << " native="             << tiers.retired[rv32i::TIER_NATIVE]
+              << " promoted="           << tiers.promoted << "\n";
+
+    // Share of retired instructions that ran as half of a fused pair
+    const double rate = res.cycles ? 100.0 * double(2 * bc.fused) / res.cycles : 0.0;
+
+    std::cerr << "fusion: pairs="       << bc.fused
+              << " rate="               << rate << "%\n";
+}
+
 int main(int argc, char* argv[])
 {
-    if (argc < 2)
+    bool stats = false;
+    bool huge  = false;
+    int  first = 1;
+
+    rv32i::u32 warm = rv32i::TierManager::DEFAULT_WARM_THRESHOLD;
+    rv32i::u32 hot  = rv32i::Jit::DEFAULT_HOT_THRESHOLD;
+
+    rv32i::Engine        engine = rv32i::Engine::Interpreter;
+    rv32i::MemoryBackend memory = rv32i::MemoryBackend::Sparse;
+    rv32i::GuestLayout   layout;
+
+    rv32i::OutputBuffering output = rv32i::OutputBuffering::Auto;
+    std::string            root   = ".";
+
+    // Options go before the program path, everything after it belongs to the guest
+    for (; first < argc && std::string_view(argv[first]).starts_with("--"); ++first)
+    {
+        std::string_view opt = argv[first];
+
+        if (opt == "--stats")
+        {
+            stats = true;
+        }
+        else if (opt == "--engine=interp")
+        {
+            engine = rv32i::Engine::Interpreter;
+        }
+        else if (opt == "--engine=block")
+        {
+            engine = rv32i::Engine::Block;
+        }
+        else if (opt == "--engine=trace")
+        {
+            engine = rv32i::Engine::Trace;
+        }
+        else if (opt == "--engine=jit")
+        {
+            if (!rv32i::Jit::supported())
+                std::cerr << "JIT is not available on this host, running threaded blocks\n";
+
+            engine = rv32i::Engine::Jit;
+        }
+        else if (opt == "--engine=tiered")
+        {
+            engine = rv32i::Engine::Tiered;
+        }
+        else if (opt.starts_with("--warm="))
+        {
+            if (!parse_u32(opt.substr(7), warm))
+                return bad_number(argv[0], opt);
+        }
+        else if (opt.starts_with("--hot="))
+        {
+            if (!parse_u32(opt.substr(6), hot))
+                return bad_number(argv[0], opt);
+        }
+        else if (opt == "--memory=sparse")
+        {
+            memory = rv32i::MemoryBackend::Sparse;
+        }
+        else if (opt == "--memory=flat")
+        {
+            if (!rv32i::SparseMemory::flatSupported())
+                std::cerr << "Flat memory is not available on this host, using the page map\n";
+
+            memory = rv32i::MemoryBackend::Flat;
+        }
+        else if (opt == "--huge-pages")
+        {
+            huge = true;
+        }
+        else if (opt.starts_with("--stack-size="))
+        {
+            if (!parse_u32(opt.substr(13), layout.stack_size))
+                return bad_number(argv[0], opt);
+        }
+        else if (opt.starts_with("--heap-size="))
+        {
+            if (!parse_u32(opt.substr(12), layout.heap_size))
+                return bad_number(argv[0], opt);
+        }
+        else if (opt == "--no-protect")
+        {
+            layout.protect = false;
+        }
+        else if (opt == "--eager-load")
+        {
+            layout.demand_paging = false;
+        }
+        else if (opt == "--output=none")
+        {
+            output = rv32i::OutputBuffering::None;
+        }
+        else if (opt == "--output=line")
+        {
+            output = rv32i::OutputBuffering::Line;
+        }
+        else if (opt == "--output=full")
+        {
+            output = rv32i::OutputBuffering::Full;
+        }
+        else if (opt.starts_with("--root="))
+        {
+            root = std::string(opt.substr(7));
+        }
+        else
+        {
+            std::cerr << "Unknown option: " << opt << "\n";
+            return 1;
+        }
+    }
+
+    if (first >= argc)
     {
-        std::cerr << "Usage: " << argv[0] << " <program.elf> [args...]\n";
+        print_usage(argv[0]);
 
         return 1;
     }
 
-    std::vector<std::string> args(argv + 1, argv + argc);
-    rv32i::Interpreter cpu{};
+    std::vector<std::string> args(argv + first, argv + argc);
+    rv32i::Interpreter cpu{memory};
 
+    cpu.tiers().warm_threshold = warm;
+    cpu.jit().hot_threshold    = hot;
+    cpu.state.memory.setHugePages(huge);
+    cpu.state.io.buffering = output;
+    cpu.state.io.files.setRoot(root);
 
-    auto load = rv32i::loadElf(cpu, argv[1], args, 0);
+
+    auto load = rv32i::loadElf(cpu, argv[first], args, layout);
 
     rv32i::register_all_handlers(cpu);
     // register_F_extension(cpu); // later
 
-    auto result = rv32i::run_program(cpu);
+    auto result = rv32i::run_program(cpu, rv32i::DEFAULT_CYCLE_LIMIT, engine);
+
+    // Whatever the guest printed comes before what we have to say about it
+    cpu.state.io.flush();
+
+    if (stats)
+        print_stats(cpu, result);
 
     if (result.status == rv32i::ExecutionStatus::ProgramExit)
         return result.exit_code;
@@ -36,6 +278,15 @@ int main(int argc, char* argv[])
         std::cerr << "Cycles: " << result.cycles << "\n";
     }
 
+    if (result.status == rv32i::ExecutionStatus::TrapLoadFault  ||
+        result.status == rv32i::ExecutionStatus::TrapStoreFault ||
+        result.status == rv32i::ExecutionStatus::TrapFetchFault)
+    {
+        std::cerr << "Access fault at 0x" << std::hex << cpu.state.fault_addr
+                  << " on instruction: 0x" << result.pc << std::dec << "\n";
+        std::cerr << "Cycles: " << result.cycles << "\n";
+    }
+
 
     std::cerr << "Program ended with status " << int(result.status) << "\n";
 
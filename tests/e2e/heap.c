@@ -0,0 +1,104 @@
+#include "api.h"
+#include "lib.h"
+
+// A list of n nodes from the brk heap, a 256 KiB array from its own mmap,
+// then both freed and taken again: the list comes back from the free list
+// without moving the break, the array from fresh zero pages
+
+struct node
+{
+    int          value;
+    struct node* next;
+};
+
+#define BIG 65536
+
+static struct node* build(int n)
+{
+    struct node* head = 0;
+
+    for (int i = n; i >= 1; --i)
+    {
+        struct node* nd = heap_alloc(sizeof(struct node));
+
+        if (!nd)
+            exit(2);
+
+        nd->value = i * i;
+        nd->next  = head;
+        head      = nd;
+    }
+
+    return head;
+}
+
+int main(void)
+{
+    char buf[32];
+    int  nread = read(0, buf, sizeof(buf));
+
+    if (nread <= 0)
+        exit(1);
+
+    int pos = 0;
+    int n   = parse_int(buf, nread, &pos);
+
+    if (n <= 0 || n > 1000)
+        exit(1);
+
+    struct node* list = build(n);
+    int          sum  = 0;
+
+    for (struct node* nd = list; nd; nd = nd->next)
+        sum += nd->value;
+
+    write_int_ln(sum);
+
+    int* big = heap_alloc(BIG * sizeof(int));
+
+    if (!big)
+        exit(3);
+
+    for (int i = 0; i < BIG; ++i)
+        big[i] = (i + n) & 1023;
+
+    // Still readable once it is read-only
+    if (mprotect(big - 2, BIG * sizeof(int) + 8, PROT_READ) != 0)
+        exit(4);
+
+    sum = 0;
+
+    for (int i = 0; i < BIG; ++i)
+        sum += big[i];
+
+    write_int_ln(sum);
+
+    heap_free(big);
+
+    big = heap_alloc(BIG * sizeof(int));
+
+    if (!big)
+        exit(5);
+
+    int nonzero = 0;
+
+    for (int i = 0; i < BIG; ++i)
+        nonzero += big[i] != 0;
+
+    write_int_ln(nonzero);
+
+    char* before = brk(0);
+
+    while (list)
+    {
+        struct node* next = list->next;
+        heap_free(list);
+        list = next;
+    }
+
+    list = build(n);
+
+    write_int_ln(brk(0) == before);
+
+    return 0;
+}
@@ -0,0 +1,101 @@
+#pragma once
+
+//> Hand-assembled guest code for the tests: an encoder per instruction they
+//> use, load_program() to put the words in a fresh Interpreter and the guests
+//> more than one test runs.
+
+#include <vector>
+
+#include "Encoder.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Opcodes.hpp"
+
+namespace rv32i::test {
+
+inline constexpr u32 BASE = 0x1000; // where load_program() puts the code
+inline constexpr u32 DATA = 0x4000; // bubble_sort()'s array
+
+inline u32 r_op(u8 f7, u8 f3, u8 rd, u8 rs1, u8 rs2) { return encode(REncoding{f7, rs2, rs1, f3, rd, Opcode::R_TYPE}); }
+inline u32 i_op(u8 f3, u8 rd, u8 rs1, s32 imm)       { return encode(IEncoding{imm, rs1, f3, rd, Opcode::I_TYPE}); }
+
+inline u32 add(u8 rd, u8 rs1, u8 rs2)    { return r_op(0x00, 0x0, rd, rs1, rs2); }
+inline u32 sub(u8 rd, u8 rs1, u8 rs2)    { return r_op(0x20, 0x0, rd, rs1, rs2); }
+inline u32 sltu(u8 rd, u8 rs1, u8 rs2)   { return r_op(0x00, 0x3, rd, rs1, rs2); }
+inline u32 mul(u8 rd, u8 rs1, u8 rs2)    { return r_op(0x01, 0x0, rd, rs1, rs2); }
+inline u32 addi(u8 rd, u8 rs1, s32 imm)  { return i_op(0x0, rd, rs1, imm); }
+inline u32 slli(u8 rd, u8 rs1, s32 sh)   { return i_op(0x1, rd, rs1, sh); }
+inline u32 sltiu(u8 rd, u8 rs1, s32 imm) { return i_op(0x3, rd, rs1, imm); }
+inline u32 srli(u8 rd, u8 rs1, s32 sh)   { return i_op(0x5, rd, rs1, sh); }
+inline u32 lb(u8 rd, u8 rs1, s32 imm)    { return encode(IEncoding{imm, rs1, 0x0, rd, Opcode::LOAD}); }
+inline u32 lw(u8 rd, u8 rs1, s32 imm)    { return encode(IEncoding{imm, rs1, 0x2, rd, Opcode::LOAD}); }
+inline u32 sw(u8 rs2, u8 rs1, s32 imm)   { return encode(SEncoding{imm, rs2, rs1, 0x2, Opcode::S_TYPE}); }
+inline u32 beq(u8 rs1, u8 rs2, s32 off)  { return encode(BEncoding{off, rs2, rs1, 0x0, Opcode::B_TYPE}); }
+inline u32 bne(u8 rs1, u8 rs2, s32 off)  { return encode(BEncoding{off, rs2, rs1, 0x1, Opcode::B_TYPE}); }
+inline u32 blt(u8 rs1, u8 rs2, s32 off)  { return encode(BEncoding{off, rs2, rs1, 0x4, Opcode::B_TYPE}); }
+inline u32 bgeu(u8 rs1, u8 rs2, s32 off) { return encode(BEncoding{off, rs2, rs1, 0x7, Opcode::B_TYPE}); }
+inline u32 jal(u8 rd, s32 off)           { return encode(JEncoding{off, rd, Opcode::J_TYPE}); }
+inline u32 jalr(u8 rd, u8 rs1, s32 imm)  { return encode(IEncoding{imm, rs1, 0x0, rd, Opcode::I_JALR}); }
+inline u32 lui(u8 rd, s32 imm)           { return encode(UEncoding{imm, rd, Opcode::U_LUI}); }
+inline u32 auipc(u8 rd, s32 imm)         { return encode(UEncoding{imm, rd, Opcode::U_AUIPC}); }
+inline u32 fence()                       { return 0x0FF0000Fu; }
+inline u32 fence_i()                     { return 0x0000100Fu; }
+inline u32 ecall()                       { return 0x00000073u; }
+
+//> Registers every handler, stores the words from BASE on and starts there
+inline void load_program(Interpreter& cpu, const std::vector<u32>& words)
+{
+    register_all_handlers(cpu);
+
+    for (u32 i = 0; i < words.size(); ++i)
+        cpu.state.memory.StoreU32(BASE + 4 * u32(i), words[i]);
+
+    cpu.state.pc = BASE;
+}
+
+//> Fills 24 pseudo-random words at DATA, bubble-sorts them and exits with the
+//> sum of a[i] * i, so both the order and the values are checked
+inline std::vector<u32> bubble_sort()
+{
+    return {
+        lui(8, DATA),           // 0x1000 s0 = array
+        addi(5, 0, 12345),      // 0x1004 t0 = seed
+        addi(6, 0, 0),          // 0x1008 t1 = i
+        addi(9, 0, 24),         // 0x100C s1 = n
+        addi(7, 0, 1103),       // 0x1010 fill:
+        mul(5, 5, 7),           // 0x1014
+        addi(5, 5, 7),          // 0x1018
+        slli(28, 6, 2),         // 0x101C
+        add(28, 28, 8),         // 0x1020
+        srli(29, 5, 20),        // 0x1024
+        sw(29, 28, 0),          // 0x1028
+        addi(6, 6, 1),          // 0x102C
+        blt(6, 9, -32),         // 0x1030 -> fill
+        addi(18, 9, -1),        // 0x1034 s2 = n - 1
+        addi(6, 0, 0),          // 0x1038 outer: t1 = 0
+        addi(30, 8, 0),         // 0x103C t5 = array
+        lw(28, 30, 0),          // 0x1040 inner:
+        lw(29, 30, 4),          // 0x1044
+        bgeu(29, 28, 12),       // 0x1048 -> noswap
+        sw(29, 30, 0),          // 0x104C
+        sw(28, 30, 4),          // 0x1050
+        addi(30, 30, 4),        // 0x1054 noswap:
+        addi(6, 6, 1),          // 0x1058
+        bne(6, 18, -28),        // 0x105C -> inner
+        addi(18, 18, -1),       // 0x1060
+        bne(18, 0, -44),        // 0x1064 -> outer
+        addi(10, 0, 0),         // 0x1068 checksum
+        addi(6, 0, 0),          // 0x106C
+        addi(30, 8, 0),         // 0x1070
+        lw(28, 30, 0),          // 0x1074 sum:
+        mul(28, 28, 6),         // 0x1078
+        add(10, 10, 28),        // 0x107C
+        addi(30, 30, 4),        // 0x1080
+        addi(6, 6, 1),          // 0x1084
+        blt(6, 9, -20),         // 0x1088 -> sum
+        addi(17, 0, 93),        // 0x108C
+        ecall(),                // 0x1090
+    };
+}
+
+} // namespace rv32i::test
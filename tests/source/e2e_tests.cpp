@@ -2,7 +2,19 @@
 
 #include <array>
 #include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <memory>
 #include <string>
+#include <tuple>
+#include <vector>
+
+#include <unistd.h>
+
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Runner.hpp"
 
 #ifndef E2E_BIN_DIR
 #error "E2E_BIN_DIR not defined – check tests/CMakeLists.txt"
@@ -12,12 +24,48 @@
 #error "INTERP_PATH not defined – check tests/CMakeLists.txt"
 #endif
 
-// Run: echo <input> | INTERP_PATH <rv32_bin>, capture stdout.
-static int run_program(const std::string& rv32_bin,
+// Engines run in this process, stdin and stdout in memory; "cli" and "aot" go
+// through a process of their own (see run_process). Files the guest opens are
+// under root.
+static int run_in_process(const std::string& rv32_bin,
+                          rv32i::Engine engine,
+                          const std::string& input,
+                          std::string& output,
+                          const std::string& root = ".")
+{
+    rv32i::Interpreter cpu;
+
+    // What echo would have sent
+    auto io = std::make_shared<rv32i::BufferIo>(input + "\n");
+    cpu.state.io.backend = io;
+    cpu.state.io.files.setRoot(root);
+
+    rv32i::loadElf(cpu, rv32_bin, {rv32_bin});
+    rv32i::register_all_handlers(cpu);
+
+    auto res = rv32i::run_program(cpu, rv32i::DEFAULT_CYCLE_LIMIT, engine);
+
+    cpu.state.io.flush();
+    output = io->out;
+
+    // As the shell would see rv32i exit
+    return res.status == rv32i::ExecutionStatus::ProgramExit ? res.exit_code & 0xFF : 255;
+}
+
+// Run: echo <input> | INTERP_PATH --engine=interp <rv32_bin>, capture stdout.
+// Engine "aot" runs the program's ahead-of-time translation <rv32_bin>.aot instead.
+// Both run in root, which is where the guest's files are.
+static int run_process(const std::string& rv32_bin,
+                       const std::string& engine,
                        const std::string& input,
-                       std::string& output)
+                       std::string& output,
+                       const std::string& root = ".")
 {
-    std::string cmd = "echo '" + input + "' | " INTERP_PATH " " + rv32_bin;
+    std::string cmd = engine == "aot"
+                    ? "echo '" + input + "' | " + rv32_bin.substr(0, rv32_bin.size() - 5) + ".aot"
+                    : "echo '" + input + "' | " INTERP_PATH " --engine=interp " + rv32_bin;
+
+    cmd = "cd '" + root + "' && " + cmd;
 
     std::array<char, 4096> buf{};
     output.clear();
@@ -46,31 +94,94 @@ struct E2ETestCase
     int expected_exit = 0;
 };
 
-class InterpreterE2E : public ::testing::TestWithParam<E2ETestCase> {};
+class InterpreterE2E : public ::testing::TestWithParam<std::tuple<E2ETestCase, const char*>> {};
 
 TEST_P(InterpreterE2E, RunsCorrectly)
 {
-    const auto& tc = GetParam();
+    const auto& [tc, engine] = GetParam();
 
     std::string bin_path = std::string(E2E_BIN_DIR) + "/" +
                            tc.name + std::string(".rv32");
 
+    const std::string name = engine;
+
     std::string output;
-    int exit_code = run_program(bin_path, tc.input, output);
+    int exit_code = name == "interp" ? run_in_process(bin_path, rv32i::Engine::Interpreter, tc.input, output)
+                  : name == "block"  ? run_in_process(bin_path, rv32i::Engine::Block,       tc.input, output)
+                  : name == "trace"  ? run_in_process(bin_path, rv32i::Engine::Trace,       tc.input, output)
+                  : name == "jit"    ? run_in_process(bin_path, rv32i::Engine::Jit,         tc.input, output)
+                  : name == "tiered" ? run_in_process(bin_path, rv32i::Engine::Tiered,      tc.input, output)
+                  :                    run_process(bin_path, name, tc.input, output);
 
-    ASSERT_EQ(exit_code, tc.expected_exit) << "exit code mismatch for " << tc.name;
-    EXPECT_EQ(output, tc.expected_output)  << "stdout mismatch for "    << tc.name;
+    ASSERT_EQ(exit_code, tc.expected_exit) << "exit code mismatch for " << tc.name << " on " << engine;
+    EXPECT_EQ(output, tc.expected_output)  << "stdout mismatch for "    << tc.name << " on " << engine;
 }
 
 INSTANTIATE_TEST_SUITE_P(
     Programs,
     InterpreterE2E,
-    ::testing::Values(
-        E2ETestCase{"echo",       "123",      "123\n", 1},
-        E2ETestCase{"isqrt",      "9\n",        "3\n"},
-        E2ETestCase{"bubblesort", "3 3 1 2\n",  "1 2 3 \n"},
-        E2ETestCase{"fcalc",      "4\n", "2\n"},
-        E2ETestCase{"fib",        "0\n", "0\n"}
-        // add more here
+    ::testing::Combine(
+        ::testing::Values(
+            E2ETestCase{"echo",       "123",      "123\n", 4},
+            E2ETestCase{"isqrt",      "9\n",        "3\n"},
+            E2ETestCase{"bubblesort", "3 3 1 2\n",  "1 2 3 \n"},
+            E2ETestCase{"fcalc",      "4\n", "2\n"},
+            E2ETestCase{"fib",        "0\n", "0\n"},
+            E2ETestCase{"heap",       "1000\n", "333833500\n33521664\n0\n1\n"}
+            // add more here
+        ),
+        ::testing::Values("interp", "block", "trace", "jit", "tiered", "cli", "aot")
     )
 );
+
+// A file much bigger than the guest's buffer, read through openat/fstat/read/
+// pread from a root directory of its own
+TEST(FileSyscallsE2E, ChecksumsALargeFile)
+{
+    const auto dir  = std::filesystem::temp_directory_path() / ("rv32i_e2e_" + std::to_string(getpid()));
+    const auto root = dir / "root";
+    std::filesystem::create_directories(root);
+
+    std::vector<char> data(8u << 20);
+    unsigned a = 1, b = 0;
+
+    for (size_t i = 0; i < data.size(); ++i)
+    {
+        data[i] = char((i * 2654435761u) >> 24);
+
+        a = (a + (unsigned char)data[i]) % 65521;
+        b = (b + a) % 65521;
+    }
+
+    std::ofstream(root / "data.bin", std::ios::binary).write(data.data(), std::streamsize(data.size()));
+    std::ofstream(dir / "secret.bin") << "not for the guest";
+
+    const std::string expected = std::to_string(data.size()) + " " + std::to_string(a) + " " + std::to_string(b) + "\n";
+    const std::string bin      = std::string(E2E_BIN_DIR) + "/checksum.rv32";
+
+    for (rv32i::Engine engine : {rv32i::Engine::Interpreter, rv32i::Engine::Block, rv32i::Engine::Trace,
+                                 rv32i::Engine::Jit, rv32i::Engine::Tiered})
+    {
+        std::string output;
+
+        EXPECT_EQ(run_in_process(bin, engine, "data.bin", output, root.string()), 0) << "engine " << int(engine);
+        EXPECT_EQ(output, expected) << "engine " << int(engine);
+    }
+
+    // The root is the guest's "/": absolute paths start there, ".." stops there
+    std::string output;
+
+    EXPECT_EQ(run_in_process(bin, rv32i::Engine::Block, "/../data.bin", output, root.string()), 0);
+    EXPECT_EQ(output, expected);
+
+    EXPECT_EQ(run_in_process(bin, rv32i::Engine::Block, "../secret.bin", output, root.string()), 2);
+    EXPECT_EQ(output, "");
+
+    for (const char* engine : {"cli", "aot"})
+    {
+        EXPECT_EQ(run_process(bin, engine, "data.bin", output, root.string()), 0) << engine;
+        EXPECT_EQ(output, expected) << engine;
+    }
+
+    std::filesystem::remove_all(dir);
+}
@@ -0,0 +1,313 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <string>
+
+#include "AddressSpace.hpp"
+#include "Interpreter.hpp"
+#include "Syscall.hpp"
+
+using namespace rv32i;
+
+namespace {
+
+constexpr u32 PAGE        = SparseMemory::PAGE_SIZE;
+constexpr u32 IMAGE       = 0x10000;
+constexpr u32 HEAP        = 0x20000;
+constexpr u32 HEAP_LIMIT  = 0x120000;
+constexpr u32 STACK_LIMIT = 0x800000;
+constexpr u32 STACK_TOP   = 0x1000000;
+
+constexpr u32 RW = AddressSpace::PROT_READ | AddressSpace::PROT_WRITE;
+constexpr u32 AP = AddressSpace::MAP_ANONYMOUS | AddressSpace::MAP_PRIVATE;
+
+//> Memory laid out the way the loader leaves it with protect on
+struct Guest
+{
+    SparseMemory m;
+    AddressSpace vm;
+
+    Guest()
+    {
+        m.protectAll(SparseMemory::PERM_NONE);
+        m.protect(IMAGE, HEAP - IMAGE, SparseMemory::PERM_RWX);
+        m.protect(STACK_LIMIT, STACK_TOP - STACK_LIMIT, SparseMemory::PERM_RW);
+
+        vm.reset(IMAGE, HEAP, HEAP_LIMIT, STACK_LIMIT, STACK_TOP, true);
+    }
+};
+
+} // namespace
+
+TEST(AddressSpace, BrkGrowsAndShrinksTheHeapWithinItsLimit)
+{
+    Guest g;
+
+    EXPECT_EQ(g.vm.brk(g.m, 0), HEAP);
+    EXPECT_FALSE(g.m.allows(HEAP, 1, SparseMemory::PERM_R));
+
+    // Not page aligned: the whole last page is the guest's
+    EXPECT_EQ(g.vm.brk(g.m, HEAP + 3 * PAGE + 10), HEAP + 3 * PAGE + 10);
+    EXPECT_TRUE(g.m.allows(HEAP, 4 * PAGE, SparseMemory::PERM_RW));
+    EXPECT_FALSE(g.m.allows(HEAP + 4 * PAGE, 1, SparseMemory::PERM_R));
+
+    g.m.StoreU32(HEAP + 3 * PAGE, 42);
+
+    // Outside [heap start, limit] the break stays put
+    EXPECT_EQ(g.vm.brk(g.m, HEAP_LIMIT + 1), HEAP + 3 * PAGE + 10);
+    EXPECT_EQ(g.vm.brk(g.m, HEAP - 1),       HEAP + 3 * PAGE + 10);
+
+    EXPECT_EQ(g.vm.brk(g.m, HEAP + PAGE), HEAP + PAGE);
+    EXPECT_FALSE(g.m.allows(HEAP + PAGE, 1, SparseMemory::PERM_R));
+
+    // Back up again: the page that was let go comes back zeroed
+    g.vm.brk(g.m, HEAP + 4 * PAGE);
+    EXPECT_EQ(g.m.LoadU32(HEAP + 3 * PAGE), 0u);
+
+    EXPECT_EQ(g.vm.stats.heap_bytes, 4 * PAGE);
+    EXPECT_EQ(g.vm.stats.heap_peak,  4 * PAGE);
+    EXPECT_EQ(g.vm.stats.failed,     2u);
+    EXPECT_EQ(g.vm.areas().size(),   3u);     // image, heap, stack
+}
+
+TEST(AddressSpace, MmapPlacesAreasTopDownAndMunmapGivesPagesBack)
+{
+    Guest g;
+
+    const u32 a = g.vm.mmap(g.m, 0, 3 * PAGE, RW, AP);
+    const u32 b = g.vm.mmap(g.m, 0, 100, AddressSpace::PROT_READ, AP);
+
+    EXPECT_EQ(a, AddressSpace::MMAP_TOP - 3 * PAGE);
+    EXPECT_EQ(b, a - PAGE);
+    EXPECT_EQ(g.vm.areas().size(), 3u);       // image, stack, and the two merged
+
+    EXPECT_TRUE(g.m.allows(a, 3 * PAGE, SparseMemory::PERM_RW));
+    EXPECT_TRUE(g.m.allows(b, PAGE, SparseMemory::PERM_R));
+    EXPECT_FALSE(g.m.allows(b, 1, SparseMemory::PERM_W));
+
+    g.m.StoreU32(a + PAGE, 7);
+    const size_t pages = g.m.numPages();
+
+    // A hole in the middle, which the next mapping that fits takes
+    EXPECT_EQ(g.vm.munmap(g.m, a + PAGE, PAGE), 0);
+    EXPECT_EQ(g.m.numPages(), pages - 1);
+    EXPECT_FALSE(g.m.allows(a + PAGE, 1, SparseMemory::PERM_R));
+    EXPECT_TRUE(g.m.allows(a + 2 * PAGE, 1, SparseMemory::PERM_R));
+
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, RW, AP), a + PAGE);
+    EXPECT_EQ(g.m.LoadU32(a + PAGE), 0u);
+
+    // A free hint is taken as it is; over the heap's room it is not
+    EXPECT_EQ(g.vm.mmap(g.m, 0x40000000, PAGE, RW, AP), 0x40000000u);
+    EXPECT_NE(g.vm.mmap(g.m, HEAP, PAGE, RW, AP), HEAP);
+
+    EXPECT_EQ(g.vm.stats.mapped_bytes, 6 * PAGE);
+    EXPECT_EQ(g.vm.stats.mapped_peak,  6 * PAGE);
+    EXPECT_EQ(g.vm.stats.munmap_calls, 1u);
+}
+
+TEST(AddressSpace, FixedMappingsReplaceOrRefuseAndBadArgumentsFail)
+{
+    Guest g;
+
+    g.vm.brk(g.m, HEAP + 2 * PAGE);
+    g.m.StoreU32(HEAP, 5);
+
+    // Over the heap: NOREPLACE refuses, FIXED takes the range over, zeroed
+    EXPECT_EQ(g.vm.mmap(g.m, HEAP, PAGE, RW, AP | AddressSpace::MAP_FIXED_NOREPLACE), errno_result(EEXIST));
+    EXPECT_EQ(g.m.LoadU32(HEAP), 5u);
+
+    EXPECT_EQ(g.vm.mmap(g.m, HEAP, PAGE, RW, AP | AddressSpace::MAP_FIXED), HEAP);
+    EXPECT_EQ(g.m.LoadU32(HEAP), 0u);
+
+    // ...and the heap can't grow into a mapping
+    g.vm.mmap(g.m, HEAP + 4 * PAGE, PAGE, RW, AP | AddressSpace::MAP_FIXED);
+    EXPECT_EQ(g.vm.brk(g.m, HEAP + 8 * PAGE), HEAP + 2 * PAGE);
+
+    EXPECT_EQ(g.vm.mmap(g.m, 0, 0, RW, AP),                                   errno_result(EINVAL));
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, RW, AddressSpace::MAP_ANONYMOUS),       errno_result(EINVAL));
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, RW, AddressSpace::MAP_PRIVATE),         errno_result(ENODEV));
+    EXPECT_EQ(g.vm.mmap(g.m, 1, PAGE, RW, AP | AddressSpace::MAP_FIXED),      errno_result(EINVAL));
+    EXPECT_EQ(g.vm.mmap(g.m, 0, 0xFFFFFFF0u, RW, AP),                         errno_result(ENOMEM));
+    EXPECT_EQ(g.vm.munmap(g.m, 1, PAGE),                                      -EINVAL);
+    EXPECT_EQ(g.vm.munmap(g.m, 0xFFFFF000u, PAGE),                            -EINVAL);
+}
+
+TEST(AddressSpace, MprotectChangesOnlyMappedRanges)
+{
+    Guest g;
+
+    const u32 a = g.vm.mmap(g.m, 0, 2 * PAGE, RW, AP);
+
+    EXPECT_EQ(g.vm.mprotect(g.m, a, PAGE, AddressSpace::PROT_READ), 0);
+    EXPECT_FALSE(g.m.allows(a, 1, SparseMemory::PERM_W));
+    EXPECT_TRUE(g.m.allows(a + PAGE, 1, SparseMemory::PERM_W));
+
+    // Write-only is read/write, as on Linux
+    EXPECT_EQ(g.vm.mprotect(g.m, a, 2 * PAGE, AddressSpace::PROT_WRITE), 0);
+    EXPECT_TRUE(g.m.allows(a, 2 * PAGE, SparseMemory::PERM_RW));
+
+    EXPECT_EQ(g.vm.mprotect(g.m, a, 3 * PAGE, AddressSpace::PROT_READ), -ENOMEM);
+    EXPECT_EQ(g.vm.mprotect(g.m, a + 1, PAGE, AddressSpace::PROT_READ), -EINVAL);
+    EXPECT_EQ(g.vm.mprotect(g.m, a, 0, AddressSpace::PROT_READ), 0);
+
+    // The image is mapped too
+    EXPECT_EQ(g.vm.mprotect(g.m, IMAGE, PAGE, AddressSpace::PROT_READ), 0);
+    EXPECT_FALSE(g.m.allows(IMAGE, 1, SparseMemory::PERM_X));
+}
+
+TEST(AddressSpace, FileMappingsReadTheFileAndNeverWriteIt)
+{
+    Guest g;
+
+    // Two and a half pages of words counting up
+    const std::string path = ::testing::TempDir() + "rv32i_mmap_file.bin";
+
+    {
+        std::ofstream out(path, std::ios::binary);
+
+        for (u32 i = 0; i < 5 * PAGE / 8; ++i)
+            out.write(reinterpret_cast<const char*>(&i), 4);
+    }
+
+    auto file = MappedFile::open(path);
+    ASSERT_TRUE(file);
+
+    constexpr u32 R  = AddressSpace::PROT_READ;
+    constexpr u32 FP = AddressSpace::MAP_PRIVATE;
+    constexpr u32 FS = AddressSpace::MAP_SHARED;
+
+    // From the second page on: a whole one, the half, and zeros past the end
+    const u32 a = g.vm.mmap(g.m, 0, 3 * PAGE, RW, FP, file, PAGE);
+    ASSERT_EQ(a, AddressSpace::MMAP_TOP - 3 * PAGE);
+
+    EXPECT_EQ(g.m.LoadU32(a),                     PAGE / 4);
+    EXPECT_EQ(g.m.LoadU32(a + PAGE + 4),          PAGE / 2 + 1);
+    EXPECT_EQ(g.m.LoadU32(a + PAGE + PAGE / 2),   0u);
+    EXPECT_EQ(g.m.LoadU32(a + 2 * PAGE),          0u);
+
+    // Private: the guest's writes stay in its own copy
+    g.m.StoreU32(a, 7);
+    EXPECT_EQ(g.m.LoadU32(a), 7u);
+    EXPECT_EQ(file->data()[PAGE], PAGE / 4 % 256);
+
+    // Shared ones are read-only
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, RW, FS, file, 0), errno_result(EACCES));
+
+    const u32 b = g.vm.mmap(g.m, 0, PAGE, R, FS, file, 0);
+    EXPECT_EQ(g.m.LoadU32(b + 8), 2u);
+    EXPECT_FALSE(g.m.allows(b, 1, SparseMemory::PERM_W));
+    EXPECT_EQ(g.vm.mprotect(g.m, b, PAGE, RW), -EACCES);
+    EXPECT_EQ(g.vm.mprotect(g.m, a, PAGE, R),  0);
+
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, R, FP, file, 100), errno_result(EINVAL));
+    EXPECT_EQ(g.vm.mmap(g.m, 0, PAGE, R, FP),             errno_result(ENODEV));
+
+    EXPECT_EQ(g.vm.stats.file_bytes,   4 * PAGE);
+    EXPECT_EQ(g.vm.stats.mapped_bytes, 0u);
+
+    EXPECT_EQ(g.vm.munmap(g.m, a, 3 * PAGE), 0);
+    EXPECT_EQ(g.vm.stats.file_bytes, PAGE);
+    EXPECT_FALSE(g.m.allows(a, 1, SparseMemory::PERM_R));
+
+    std::remove(path.c_str());
+}
+
+TEST(AddressSpace, SyscallsReachItFromTheGuest)
+{
+    Interpreter cpu;
+    InterpreterState& s = cpu.state;
+
+    s.vm.reset(IMAGE, HEAP, HEAP_LIMIT, STACK_LIMIT, STACK_TOP, false);
+
+    auto sys = [&](u32 num, u32 a0, u32 a1 = 0, u32 a2 = 0, u32 a3 = 0) {
+        s.regs[17] = num;
+        s.regs[10] = a0;
+        s.regs[11] = a1;
+        s.regs[12] = a2;
+        s.regs[13] = a3;
+        s.regs[14] = u32(-1);
+        s.regs[15] = 0;
+
+        EXPECT_EQ(int(handle_syscall(s)), int(ExecutionStatus::Success));
+        return s.regs[10];
+    };
+
+    EXPECT_EQ(sys(Syscall::BRK, 0),                HEAP);
+    EXPECT_EQ(sys(Syscall::BRK, HEAP + 100),       HEAP + 100);
+
+    const u32 a = sys(Syscall::MMAP, 0, PAGE, RW, AP);
+    EXPECT_EQ(a, AddressSpace::MMAP_TOP - PAGE);
+
+    EXPECT_EQ(sys(Syscall::MPROTECT, a, PAGE, AddressSpace::PROT_READ), 0u);
+    EXPECT_EQ(sys(Syscall::MUNMAP, a, PAGE), 0u);
+    EXPECT_TRUE(s.vm.areas().count(a) == 0);
+
+    EXPECT_EQ(s.vm.stats.brk_calls,  2u);
+    EXPECT_EQ(s.vm.stats.mmap_calls, 1u);
+}
+
+TEST(AddressSpace, BaselinesAndForksCarryTheMappings)
+{
+    Interpreter cpu;
+    InterpreterState& s = cpu.state;
+
+    s.memory.protectAll(SparseMemory::PERM_NONE);
+    s.memory.protect(IMAGE, HEAP - IMAGE, SparseMemory::PERM_RWX);
+    s.vm.reset(IMAGE, HEAP, HEAP_LIMIT, STACK_LIMIT, STACK_TOP, true);
+
+    auto sys = [](InterpreterState& st, u32 num, u32 a0, u32 a1 = 0, u32 a2 = 0, u32 a3 = 0) {
+        st.regs[17] = num;
+        st.regs[10] = a0;
+        st.regs[11] = a1;
+        st.regs[12] = a2;
+        st.regs[13] = a3;
+        st.regs[14] = u32(-1);
+        st.regs[15] = 0;
+
+        EXPECT_EQ(int(handle_syscall(st)), int(ExecutionStatus::Success));
+        return st.regs[10];
+    };
+
+    EXPECT_EQ(sys(s, Syscall::BRK, HEAP + 2 * PAGE), HEAP + 2 * PAGE);
+    s.memory.StoreU32(HEAP, 1);
+
+    cpu.markBaseline();
+
+    // Grow, map, reprotect and write, then take it all back
+    EXPECT_EQ(sys(s, Syscall::BRK, HEAP + 8 * PAGE), HEAP + 8 * PAGE);
+    EXPECT_TRUE(s.memory.TryStore<u32>(HEAP + 5 * PAGE, 5));
+
+    const u32 a = sys(s, Syscall::MMAP, 0, PAGE, RW, AP);
+    ASSERT_EQ(a, AddressSpace::MMAP_TOP - PAGE);
+
+    EXPECT_EQ(sys(s, Syscall::MPROTECT, HEAP, PAGE, AddressSpace::PROT_READ), 0u);
+    EXPECT_FALSE(s.memory.TryStore<u32>(HEAP, 2));
+
+    cpu.resetToBaseline();
+
+    EXPECT_EQ(sys(s, Syscall::BRK, 0), HEAP + 2 * PAGE);
+    EXPECT_FALSE(s.vm.overlaps(a, a + PAGE));
+    EXPECT_FALSE(s.memory.allows(a, 1, SparseMemory::PERM_R));
+    EXPECT_FALSE(s.memory.allows(HEAP + 5 * PAGE, 1, SparseMemory::PERM_R));
+    EXPECT_TRUE(s.memory.TryStore<u32>(HEAP, 3));
+
+    // The same map again, from the same place
+    EXPECT_EQ(sys(s, Syscall::MMAP, 0, PAGE, RW, AP), a);
+
+    // A fork starts with the parent's areas and break, and goes its own way
+    auto child = cpu.fork();
+    InterpreterState& c = child->state;
+
+    EXPECT_EQ(sys(c, Syscall::BRK, 0), HEAP + 2 * PAGE);
+    EXPECT_TRUE(c.vm.overlaps(a, a + PAGE));
+    EXPECT_EQ(sys(c, Syscall::BRK, HEAP + 4 * PAGE), HEAP + 4 * PAGE);
+    EXPECT_EQ(sys(c, Syscall::MMAP, 0, PAGE, RW, AP), a - PAGE);
+    EXPECT_TRUE(c.memory.TryStore<u32>(HEAP + 3 * PAGE, 4));
+
+    EXPECT_EQ(sys(s, Syscall::BRK, 0), HEAP + 2 * PAGE);
+    EXPECT_FALSE(s.vm.overlaps(a - PAGE, a));
+    EXPECT_FALSE(s.memory.allows(HEAP + 3 * PAGE, 1, SparseMemory::PERM_W));
+}
@@ -0,0 +1,52 @@
+#include <gtest/gtest.h>
+
+#include <set>
+#include <sstream>
+#include <vector>
+
+#include "Aot.hpp"
+#include "Interpreter.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+TEST(Aot, DiscoversCallsReturnsAndConstantJumps)
+{
+    const std::vector<u32> p = {
+        addi(5, 0, 3),          // 0x1000
+        jal(1, 16),             // 0x1004 call f (0x1014)
+        auipc(6, 0),            // 0x1008 return site
+        jalr(0, 6, 0x1C),       // 0x100C -> 0x1024, provable
+        0,                      // 0x1010 never reached
+        addi(5, 5, -1),         // 0x1014 f:
+        bne(5, 0, -4),          // 0x1018 -> f
+        jalr(0, 1, 0),          // 0x101C ret
+        0,                      // 0x1020 never reached
+        addi(17, 0, 93),        // 0x1024
+        ecall(),                // 0x1028 last word of the text
+    };
+
+    Interpreter cpu;
+    load_program(cpu, p);
+
+    StaticTranslator aot(cpu, BASE, BASE + 4 * u32(p.size()));
+    aot.discover(BASE);
+
+    EXPECT_EQ(aot.leaders(), (std::set<u32>{0x1000, 0x1008, 0x1014, 0x101C, 0x1024}));
+
+    EXPECT_EQ(aot.stats.instructions, 9u);
+    EXPECT_EQ(aot.stats.indirect,     2u);
+    EXPECT_EQ(aot.stats.resolved,     1u);
+    EXPECT_EQ(aot.stats.exits,        1u);
+
+    std::ostringstream out;
+    aot.emit(out, {}, "test");
+
+    const std::string cpp = out.str();
+
+    EXPECT_NE(cpp.find("goto L_00001014;"),      std::string::npos); // the call
+    EXPECT_NE(cpp.find("case 0x00001024u:"),     std::string::npos); // the jalr target
+    EXPECT_EQ(cpp.find("case 0x00001010u:"),     std::string::npos);
+    EXPECT_NE(cpp.find("s.pc = 0x00001028u;"),   std::string::npos); // ecall left to the interpreter
+}
@@ -0,0 +1,482 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+namespace {
+
+std::vector<u32> exit_with(u8 reg)
+{
+    return { addi(10, reg, 0), addi(17, 0, 93), ecall() };
+}
+
+struct RunResult
+{
+    ExecutionResult       res;
+    std::array<u32, 32>   regs;
+    u32                   pc;
+};
+
+RunResult run_on(Engine engine, const std::vector<u32>& program, size_t limit = 1'000'000)
+{
+    Interpreter cpu;
+    load_program(cpu, program);
+
+    cpu.state.regs[2] = 0x8000;
+
+    // Low enough for every tier to take part in short runs
+    cpu.recorder().hot_loop    = 2;
+    cpu.tiers().warm_threshold = 3;
+    cpu.jit().hot_threshold    = 2;
+
+    auto res = run_program(cpu, limit, engine);
+
+    return {res, cpu.state.regs, cpu.state.pc};
+}
+
+void expect_same(const std::vector<u32>& program, size_t limit = 1'000'000, Engine engine = Engine::Block)
+{
+    RunResult a = run_on(Engine::Interpreter, program, limit);
+    RunResult b = run_on(engine,              program, limit);
+
+    EXPECT_EQ(int(a.res.status), int(b.res.status)) << "limit " << limit;
+    EXPECT_EQ(a.res.cycles,      b.res.cycles)      << "limit " << limit;
+    EXPECT_EQ(a.res.pc,          b.res.pc)          << "limit " << limit;
+    EXPECT_EQ(a.res.exit_code,   b.res.exit_code)   << "limit " << limit;
+    EXPECT_EQ(a.pc,              b.pc)              << "limit " << limit;
+    EXPECT_EQ(a.regs,            b.regs)            << "limit " << limit;
+}
+
+const char* engine_name(Engine engine)
+{
+    switch (engine)
+    {
+        case Engine::Interpreter: return "Interpreter";
+        case Engine::Block:       return "Block";
+        case Engine::Jit:         return "Jit";
+        case Engine::Trace:       return "Trace";
+        case Engine::Tiered:      return "Tiered";
+    }
+
+    return "Unknown";
+}
+
+std::vector<u32> counting_loop()
+{
+    // x1 = 50; loop: x3 += x1; sw x3, 0(sp); lw x4, 0(sp); x1 -= 1; bne x1, x0, loop; exit(x3)
+    std::vector<u32> p = {
+        addi(1, 0, 50),
+        add(3, 3, 1),
+        sw(3, 2, 0),
+        lw(4, 2, 0),
+        addi(1, 1, -1),
+        bne(1, 0, -16),
+    };
+
+    for (u32 w : exit_with(3)) p.push_back(w);
+
+    return p;
+}
+
+} // namespace
+
+TEST(BlockEngine, LoopMatchesInterpreter)
+{
+    RunResult r = run_on(Engine::Block, counting_loop());
+
+    EXPECT_EQ(r.res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(r.res.exit_code, 1275);
+
+    expect_same(counting_loop());
+}
+
+TEST(BlockEngine, CallAndReturnMatchInterpreter)
+{
+    // main: x5 = 7; call f; call f; exit(x5)    f: x5 += x5; ret
+    std::vector<u32> p = {
+        addi(5, 0, 7),
+        jal(1, 20),
+        jal(1, 16),
+        addi(10, 5, 0),
+        addi(17, 0, 93),
+        ecall(),
+        add(5, 5, 5),
+        jalr(0, 1, 0),
+    };
+
+    RunResult r = run_on(Engine::Block, p);
+
+    EXPECT_EQ(r.res.exit_code, 28);
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, IllegalInstructionTrapsMidBlock)
+{
+    std::vector<u32> p = { addi(1, 0, 1), addi(2, 0, 2), 0xFFFFFFFFu, addi(3, 0, 3) };
+
+    RunResult r = run_on(Engine::Block, p);
+
+    EXPECT_EQ(r.res.status, ExecutionStatus::TrapIllegal);
+    EXPECT_EQ(r.res.pc, BASE + 8);
+    EXPECT_EQ(r.res.cycles, 3);
+    EXPECT_EQ(r.regs[3], 0u);
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, StoreIntoCodeRetranslates)
+{
+    // Rewrites the loop body's "addi x3, x3, 1" into "addi x3, x3, 100" on the first pass.
+    const u32 patched = addi(3, 3, 100);
+
+    std::vector<u32> p = {
+        addi(1, 0, 3),                           // 0x1000
+        auipc(6, 0),                             // 0x1004  x6 = 0x1004
+        addi(3, 3, 1),                           // 0x1008  loop:
+        addi(1, 1, -1),                          // 0x100C
+        bne(1, 0, -8),                           // 0x1010
+        jal(0, 8),                               // 0x1014  -> 0x101C
+        0,                                       // 0x1018
+        addi(3, 3, 0),                           // 0x101C  body (patched below)
+        lw(7, 6, 0x3C),                          // 0x1020  x7 = patched word
+        sw(7, 6, 0x18),                          // 0x1024  *body = patched
+        addi(8, 8, 1),                           // 0x1028
+        addi(9, 0, 2),                           // 0x102C
+        bne(8, 9, -20),                          // 0x1030  run body twice
+        addi(10, 3, 0),                          // 0x1034
+        addi(17, 0, 93),                         // 0x1038
+        ecall(),                                 // 0x103C
+        patched,                                 // 0x1040
+    };
+
+    RunResult r = run_on(Engine::Block, p);
+
+    EXPECT_EQ(r.res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(r.res.exit_code, 103);
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, FenceIMakesPatchedCodeVisibleOnEveryEngine)
+{
+    // Every round stores to a data page, except round 100, which stores into
+    // its own loop body instead: x3 += 1 becomes x3 += 100 right after the fence.i
+    std::vector<u32> p = {
+        addi(1, 0, 200),                         // 0x1000
+        auipc(6, 0),                             // 0x1004  x6 = 0x1004
+        lw(5, 6, 0x48),                          // 0x1008  x5 = patched word
+        lui(11, 0x4000),                         // 0x100C  x11 = data
+        addi(13, 6, 0x30),                       // 0x1010
+        sub(12, 13, 11),                         // 0x1014  x12 = body - data
+        addi(9, 1, -100),                        // 0x1018  loop:
+        sltiu(9, 9, 1),                          // 0x101C
+        mul(9, 9, 12),                           // 0x1020
+        add(9, 9, 11),                           // 0x1024  x9 = x1 == 100 ? body : data
+        sw(5, 9, 0),                             // 0x1028
+        fence_i(),                               // 0x102C
+        fence(),                                 // 0x1030
+        addi(3, 3, 1),                           // 0x1034  body
+        addi(1, 1, -1),                          // 0x1038
+        bne(1, 0, -36),                          // 0x103C  -> loop
+        addi(10, 3, 0),                          // 0x1040
+        addi(17, 0, 93),                         // 0x1044
+        ecall(),                                 // 0x1048
+        addi(3, 3, 100),                         // 0x104C
+    };
+
+    for (Engine engine : {Engine::Interpreter, Engine::Block, Engine::Jit, Engine::Trace, Engine::Tiered})
+    {
+        RunResult r = run_on(engine, p);
+
+        EXPECT_EQ(r.res.status, ExecutionStatus::ProgramExit) << int(engine);
+        EXPECT_EQ(r.res.exit_code, 100 + 100 * 100) << int(engine);
+    }
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, LoopBackEdgeIsChained)
+{
+    Interpreter cpu;
+    load_program(cpu, counting_loop());
+
+    cpu.state.regs[2] = 0x8000;
+
+    auto res = run_program(cpu, 1'000'000, Engine::Block);
+
+    const auto& st = cpu.blocks().stats;
+
+    EXPECT_EQ(res.exit_code, 1275);
+    // entry (first iteration included), loop body, exit
+    EXPECT_EQ(st.translated, 3u);
+    // entry -> body, the first body -> body and body -> exit
+    EXPECT_EQ(st.unchained,  3u);
+    // every later back edge
+    EXPECT_EQ(st.chained,   47u);
+
+    // Rewriting the code drops the blocks together with their links
+    cpu.state.memory.StoreU32(BASE, addi(1, 0, 10));
+    EXPECT_EQ(cpu.blocks().find(BASE), nullptr);
+    EXPECT_EQ(cpu.blocks().find(BASE + 4), nullptr);
+
+    cpu.state.pc    = BASE;
+    cpu.state.regs  = {};
+    cpu.state.regs[2] = 0x8000;
+
+    res = run_program(cpu, 1'000'000, Engine::Block);
+
+    EXPECT_EQ(res.exit_code, 55);
+}
+
+TEST(BlockEngine, ReturnsArePredictedAndMispredictionsRecover)
+{
+    // main: x5 = 3; call f; call f; call g; exit(x5)
+    // f:    x5 += 1; ret
+    // g:    ra += 8; ret          (returns past the exit sequence's first instruction)
+    std::vector<u32> p = {
+        addi(5, 0, 3),      // 0x1000
+        jal(1, 28),         // 0x1004 -> f (0x1020)
+        jal(1, 24),         // 0x1008 -> f
+        jal(1, 28),         // 0x100C -> g (0x1028)
+        addi(5, 0, 0),      // 0x1010  skipped by g
+        addi(10, 5, 0),     // 0x1014
+        addi(17, 0, 93),    // 0x1018
+        ecall(),            // 0x101C
+        addi(5, 5, 1),      // 0x1020  f
+        jalr(0, 1, 0),      // 0x1024
+        addi(1, 1, 4),      // 0x1028  g
+        jalr(0, 1, 0),      // 0x102C
+    };
+
+    Interpreter cpu;
+    load_program(cpu, p);
+
+    auto res = run_program(cpu, 1'000, Engine::Block);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(res.exit_code, 5);
+
+    const auto& bp = cpu.predictor().stats;
+
+    EXPECT_EQ(bp.ras_hits,   2u);
+    EXPECT_EQ(bp.ras_misses, 1u);
+    EXPECT_EQ(bp.itc_misses, 1u);
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, ReturnsIntoACallerDroppedMeanwhileRetranslateIt)
+{
+    // main: x5 = 1; call f; exit(x5)
+    // f (next page): stores main's first word back over itself, which drops
+    //                main's blocks, then in a block of its own x5 += 41; ret
+    std::vector<u32> p = {
+        addi(5, 0, 1),      // 0x1000
+        jal(1, 0x1000 - 4), // 0x1004 -> f (0x2000)
+        addi(10, 5, 0),     // 0x1008
+        addi(17, 0, 93),    // 0x100C
+        ecall(),            // 0x1010
+    };
+
+    p.resize(0x1000 / 4, 0);
+
+    for (u32 w : {lui(6, 0x1000), lw(7, 6, 0), sw(7, 6, 0), jal(0, 4), addi(5, 5, 41), jalr(0, 1, 0)})
+        p.push_back(w);
+
+    RunResult r = run_on(Engine::Block, p);
+
+    EXPECT_EQ(r.res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(r.res.exit_code, 42);
+
+    expect_same(p);
+}
+
+TEST(BlockEngine, FusedPairsMatchInterpreter)
+{
+    // The loop re-enters the lui+addi pair at its second instruction
+    std::vector<u32> p = {
+        addi(5, 0, 2),      // 0x1000
+        lui(6, 0x1000),     // 0x1004  li x6 ...
+        addi(6, 6, 1),      // 0x1008  ... loop entry
+        addi(5, 5, -1),     // 0x100C  counter
+        bne(5, 0, -8),      // 0x1010
+        auipc(7, 0),        // 0x1014  la x7, 0x1030
+        addi(7, 7, 28),     // 0x1018
+        sltu(8, 6, 7),      // 0x101C  0x1002 < 0x1030
+        beq(8, 0, 8),       // 0x1020  not taken
+        add(6, 6, 8),       // 0x1024
+        addi(10, 6, 0),     // 0x1028
+        addi(17, 0, 93),    // 0x102C
+        ecall(),            // 0x1030
+    };
+
+    Interpreter cpu;
+    load_program(cpu, p);
+
+    auto res = run_program(cpu, 1'000, Engine::Block);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(res.exit_code, 0x1003);
+
+    // lui+addi and addi+bne, then addi+bne again from the loop entry, then la and sltu+beq
+    EXPECT_EQ(cpu.blocks().stats.fused, 5u);
+
+    expect_same(p);
+
+    for (size_t limit : {2u, 3u, 5u, 6u, 9u})
+        expect_same(p, limit);
+}
+
+TEST(BlockEngine, AccessFaultsTrapWithTheirAddress)
+{
+    struct Case
+    {
+        std::vector<u32> program;
+        ExecutionStatus  status;
+        u32              fault_addr;
+        u32              pc;
+    };
+
+    const std::vector<Case> cases = {
+        { { lui(5, 0x8000), lw(6, 5, 0), sw(6, 5, 4), lui(7, 0x20000), lw(8, 7, 8) },
+          ExecutionStatus::TrapLoadFault, 0x20008, BASE + 16 },
+
+        { { lui(5, 0x1000), addi(6, 0, 1), sw(6, 5, 0x10) },
+          ExecutionStatus::TrapStoreFault, 0x1010, BASE + 8 },
+
+        { { lui(5, 0x8000), jalr(0, 5, 0) },
+          ExecutionStatus::TrapFetchFault, 0x8000, 0x8000 },
+    };
+
+    for (Engine engine : {Engine::Interpreter, Engine::Block, Engine::Jit, Engine::Trace, Engine::Tiered})
+    {
+        for (const Case& c : cases)
+        {
+            Interpreter cpu;
+            load_program(cpu, c.program);
+
+            cpu.state.memory.protectAll(SparseMemory::PERM_NONE);
+            cpu.state.memory.protect(BASE,   0x1000, SparseMemory::PERM_RX);
+            cpu.state.memory.protect(0x8000, 0x1000, SparseMemory::PERM_RW);
+
+            auto res = run_program(cpu, 1000, engine);
+
+            EXPECT_EQ(res.status, c.status)                 << "engine " << int(engine);
+            EXPECT_EQ(cpu.state.fault_addr, c.fault_addr)   << "engine " << int(engine);
+            EXPECT_EQ(cpu.state.pc, c.pc)                   << "engine " << int(engine);
+        }
+    }
+}
+
+TEST(BlockEngine, ForksRunOnTheirOwnThreads)
+{
+    // x5 = [0x8000]; loop x5 times adding x5 into x6; [0x8004] = x6; exit(x6)
+    const std::vector<u32> program = {
+        lui(7, 0x8000),     // 0x1000
+        lw(5, 7, 0),        // 0x1004
+        addi(6, 0, 0),      // 0x1008
+        add(6, 6, 5),       // 0x100C
+        addi(5, 5, -1),     // 0x1010
+        bne(5, 0, -8),      // 0x1014
+        sw(6, 7, 4),        // 0x1018
+        addi(10, 6, 0),     // 0x101C
+        addi(17, 0, 93),    // 0x1020
+        ecall(),            // 0x1024
+    };
+
+    Interpreter parent;
+    load_program(parent, program);
+
+    const Engine engines[] = {Engine::Interpreter, Engine::Block, Engine::Jit, Engine::Trace, Engine::Tiered};
+
+    std::vector<std::unique_ptr<Interpreter>> children;
+
+    for (u32 n = 1; n <= 5; ++n)
+    {
+        parent.state.memory.StoreU32(0x8000, n * 100);
+        children.push_back(parent.fork());
+    }
+
+    std::vector<ExecutionResult> results(children.size());
+    std::vector<std::thread>     threads;
+
+    for (size_t i = 0; i < children.size(); ++i)
+        threads.emplace_back([&, i] { results[i] = run_program(*children[i], 1'000'000, engines[i]); });
+
+    for (auto& t : threads)
+        t.join();
+
+    for (u32 i = 0; i < children.size(); ++i)
+    {
+        const u32 n   = (i + 1) * 100;
+        const u32 sum = n * (n + 1) / 2;
+
+        EXPECT_EQ(results[i].status,    ExecutionStatus::ProgramExit);
+        EXPECT_EQ(results[i].exit_code, int(sum));
+        EXPECT_EQ(children[i]->state.memory.LoadU32(0x8004), sum);
+    }
+
+    EXPECT_EQ(parent.state.memory.LoadU32(0x8004), 0u);
+}
+
+TEST(BlockEngine, ResetToBaselineRunsAgainFromTheSameState)
+{
+    // [0x8000] += 1; exit([0x8000]), with x6 clobbered on the way
+    const std::vector<u32> program = {
+        lui(7, 0x8000), lw(5, 7, 0), addi(5, 5, 1), sw(5, 7, 0), addi(6, 0, 99),
+        addi(10, 5, 0), addi(17, 0, 93), ecall(),
+    };
+
+    Interpreter cpu;
+    load_program(cpu, program);
+
+    cpu.state.memory.StoreU32(0x8000, 41);
+
+    cpu.markBaseline();
+
+    for (Engine engine : {Engine::Interpreter, Engine::Block, Engine::Jit})
+    {
+        auto res = run_program(cpu, 1000, engine);
+
+        EXPECT_EQ(res.exit_code, 42);
+        EXPECT_EQ(cpu.state.memory.dirtyPages(), std::vector<u32>{8});
+
+        cpu.resetToBaseline();
+
+        EXPECT_EQ(cpu.state.pc,      BASE);
+        EXPECT_EQ(cpu.state.regs[6], 0u);
+        EXPECT_EQ(cpu.state.memory.LoadU32(0x8000), 41u);
+    }
+}
+
+//> Every engine that runs blocks against the interpreter, to the instruction
+class EngineTest : public ::testing::TestWithParam<Engine> {};
+
+TEST_P(EngineTest, MatchesInterpreter)
+{
+    expect_same(counting_loop(), 1'000'000, GetParam());
+    expect_same(bubble_sort(),   1'000'000, GetParam());
+}
+
+TEST_P(EngineTest, CycleLimitIsExact)
+{
+    for (size_t limit : {1u, 5u, 17u, 100u, 153u})
+        expect_same(counting_loop(), limit, GetParam());
+
+    for (size_t limit : {1u, 50u, 123u, 400u, 1001u, 2500u})
+        expect_same(bubble_sort(), limit, GetParam());
+}
+
+INSTANTIATE_TEST_SUITE_P(Engines, EngineTest,
+                         ::testing::Values(Engine::Block, Engine::Jit, Engine::Trace, Engine::Tiered),
+                         [](const auto& p) { return std::string(engine_name(p.param)); });
@@ -0,0 +1,77 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "Encoder.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Opcodes.hpp"
+#include "Runner.hpp"
+
+using namespace rv32i;
+
+class DecodeCacheTest : public ::testing::Test
+{
+protected:
+    Interpreter cpu;
+
+    void SetUp() override
+    {
+        register_all_handlers(cpu);
+        cpu.state.pc = 0x1000;
+    }
+
+    void place(u32 addr, const std::vector<u32>& words)
+    {
+        for (u32 i = 0; i < words.size(); ++i)
+            cpu.state.memory.StoreU32(addr + 4 * i, words[i]);
+    }
+};
+
+TEST_F(DecodeCacheTest, LoopDecodesEachInstructionOnce)
+{
+    // x1 = 100; loop: x2 += 3; x1 -= 1; bne x1, x0, loop; ecall(exit)
+    place(0x1000, {
+        encode(IEncoding{100, 0, 0x0, 1, Opcode::I_TYPE}),
+        encode(IEncoding{3,   2, 0x0, 2, Opcode::I_TYPE}),
+        encode(IEncoding{-1,  1, 0x0, 1, Opcode::I_TYPE}),
+        encode(BEncoding{-8,  0, 1, 0x1, Opcode::B_TYPE}),
+        encode(IEncoding{93,  0, 0x0, 17, Opcode::I_TYPE}),
+        0x00000073u,
+    });
+
+    auto res = run_program(cpu, 10'000);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(cpu.state.regs[2], 300u);
+    EXPECT_EQ(cpu.icacheStats().misses, 6u);
+    EXPECT_EQ(cpu.icacheStats().hits, u64(res.cycles) - 6u);
+}
+
+TEST_F(DecodeCacheTest, StoreToCodePageInvalidates)
+{
+    place(0x1000, { encode(IEncoding{5, 0, 0x0, 1, Opcode::I_TYPE}) }); // addi x1, x0, 5
+
+    const DecodedInstr& first = cpu.fetch(0x1000);
+    first.handler(cpu.state, first.info);
+    EXPECT_EQ(cpu.state.regs[1], 5u);
+
+    place(0x1000, { encode(IEncoding{9, 0, 0x0, 1, Opcode::I_TYPE}) }); // addi x1, x0, 9
+
+    EXPECT_EQ(cpu.icacheStats().invalidations, 1u);
+
+    const DecodedInstr& second = cpu.fetch(0x1000);
+    second.handler(cpu.state, second.info);
+    EXPECT_EQ(cpu.state.regs[1], 9u);
+    EXPECT_EQ(cpu.icacheStats().misses, 2u);
+}
+
+TEST_F(DecodeCacheTest, UnknownEncodingStaysIllegal)
+{
+    place(0x1000, { 0xFFFFFFFFu });
+
+    const DecodedInstr& d = cpu.fetch(0x1000);
+
+    EXPECT_EQ(d.handler(cpu.state, d.info), ExecutionStatus::TrapIllegal);
+    EXPECT_EQ(run_program(cpu, 10).status, ExecutionStatus::TrapIllegal);
+}
@@ -0,0 +1,83 @@
+#include <gtest/gtest.h>
+
+#include "DispatchTable.hpp"
+#include "Decoder.hpp"
+#include "Encoder.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Opcodes.hpp"
+#include "Zbb.hpp"
+
+using namespace rv32i;
+
+class DispatchTest : public ::testing::Test
+{
+protected:
+    Interpreter cpu;
+
+    void SetUp() override
+    {
+        register_all_handlers(cpu);
+        cpu.state.pc = 0x1000;
+    }
+};
+
+TEST_F(DispatchTest, UnknownKeysAreIllegal)
+{
+    InstrInfo info{};
+    info.pc = 0x1000;
+
+    EXPECT_EQ(cpu.dispatch(cpu.state, info, 0x7Fu), ExecutionStatus::TrapIllegal);
+    EXPECT_EQ(cpu.dispatch(cpu.state, info, 0x007F0733u), ExecutionStatus::TrapIllegal);
+    EXPECT_EQ(cpu.dispatch(cpu.state, info, 0x800001FFu), ExecutionStatus::TrapIllegal);
+    EXPECT_EQ(cpu.dispatch(cpu.state, info, 0xFFFFFFFFu), ExecutionStatus::TrapIllegal);
+}
+
+TEST_F(DispatchTest, ZbbKeysResolve)
+{
+    EXPECT_NE(cpu.handler(ZBB_KEY_CLZ),  nullptr);
+    EXPECT_NE(cpu.handler(ZBB_KEY_REV8), nullptr);
+    EXPECT_NE(cpu.handler(ZBB_KEY_CLZ), cpu.handler(ZBB_KEY_CTZ));
+}
+
+TEST_F(DispatchTest, DecodedKeysMatchRegistration)
+{
+    // add x3, x1, x2 and sub x3, x1, x2 differ only in funct7
+    auto [add_info, add_key] = Decoder::decode(encode(REncoding{0x00, 2, 1, 0x0, 3, Opcode::R_TYPE}), 0x1000);
+    auto [sub_info, sub_key] = Decoder::decode(encode(REncoding{0x20, 2, 1, 0x0, 3, Opcode::R_TYPE}), 0x1000);
+
+    ASSERT_NE(cpu.handler(add_key), nullptr);
+    ASSERT_NE(cpu.handler(sub_key), nullptr);
+    EXPECT_NE(cpu.handler(add_key), cpu.handler(sub_key));
+}
+
+TEST_F(DispatchTest, ForEachVisitsEveryRegistration)
+{
+    size_t count = 0;
+
+    cpu.handlers().for_each([&](u32 key, Handler h) {
+        EXPECT_EQ(cpu.handler(key), h);
+        ++count;
+    });
+
+    EXPECT_GT(count, 100u);
+
+    DispatchTable table;
+    cpu.handlers().for_each([&](u32 key, Handler h) { table.insert(key, h); });
+
+    EXPECT_EQ(table.find(ZBB_KEY_SEXTB), cpu.handler(ZBB_KEY_SEXTB));
+}
+
+TEST_F(DispatchTest, KeysTheTableCanNotHoldAreRefused)
+{
+    const Handler h = cpu.handler(ZBB_KEY_CLZ);
+
+    EXPECT_THROW(cpu.register_handler(0x00800033u, h), std::runtime_error);
+    EXPECT_THROW(cpu.register_handler(0x80000200u, h), std::runtime_error);
+    EXPECT_THROW(cpu.register_handler(0xFFFFFFFFu, h), std::runtime_error);
+
+    // Nothing half-registered: the layout's own keys still resolve as before
+    EXPECT_EQ(cpu.handler(ZBB_KEY_CLZ), h);
+    EXPECT_NO_THROW(cpu.register_handler(0x007F0733u, h));
+    EXPECT_EQ(cpu.handler(0x007F0733u), h);
+}
@@ -0,0 +1,141 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "ElfLoader.hpp"
+#include "Handlers.hpp"
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "Syscall.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+namespace {
+
+template<typename T>
+void put(std::vector<u8>& out, size_t at, T v)
+{
+    for (size_t i = 0; i < sizeof(T); ++i)
+        out[at + i] = u8(u64(v) >> (8 * i));
+}
+
+//> A one-segment ELF with code at offset in the file, loaded at vaddr
+std::vector<u8> tiny_elf(u32 offset, u32 vaddr, const std::vector<u32>& code)
+{
+    std::vector<u8> elf(offset + 4 * code.size());
+
+    const u8 ident[] = {0x7F, 'E', 'L', 'F', 1 /* 32-bit */, 1 /* LE */, 1};
+    std::copy(std::begin(ident), std::end(ident), elf.begin());
+
+    put<u16>(elf, 16, 2);          // ET_EXEC
+    put<u16>(elf, 18, 243);        // EM_RISCV
+    put<u32>(elf, 20, 1);
+    put<u32>(elf, 24, vaddr);      // entry
+    put<u32>(elf, 28, 52);         // phoff
+    put<u16>(elf, 40, 52);
+    put<u16>(elf, 42, 32);
+    put<u16>(elf, 44, 1);          // phnum
+    put<u16>(elf, 46, 40);
+
+    put<u32>(elf, 52 + 0,  1);     // PT_LOAD
+    put<u32>(elf, 52 + 4,  offset);
+    put<u32>(elf, 52 + 8,  vaddr);
+    put<u32>(elf, 52 + 12, vaddr);
+    put<u32>(elf, 52 + 16, u32(4 * code.size()));
+    put<u32>(elf, 52 + 20, u32(4 * code.size()));
+    put<u32>(elf, 52 + 24, 5);     // R+X
+    put<u32>(elf, 52 + 28, 0x1000);
+
+    for (size_t i = 0; i < code.size(); ++i)
+        put<u32>(elf, offset + 4 * i, code[i]);
+
+    return elf;
+}
+
+} // namespace
+
+TEST(ElfLoader, SegmentsInsideOnePageOfTheFileLoadFromAPath)
+{
+    // Laid out the way lld does it: the segment starts mid-page, right after
+    // the headers, and ends in the same page
+    const auto elf = tiny_elf(0xD4, 0x110D4, {addi(10, 0, 7), addi(17, 0, 93), ecall()});
+
+    const std::string path = ::testing::TempDir() + "rv32i_tiny.elf";
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(elf.data()), std::streamsize(elf.size()));
+
+    for (bool demand_paging : {true, false})
+    {
+        Interpreter cpu;
+
+        GuestLayout layout;
+        layout.demand_paging = demand_paging;
+
+        loadElf(cpu, path, {path}, layout);
+        register_all_handlers(cpu);
+
+        auto res = run_program(cpu, 100, Engine::Interpreter);
+
+        EXPECT_EQ(int(res.status), int(ExecutionStatus::ProgramExit));
+        EXPECT_EQ(res.exit_code, 7);
+    }
+
+    std::remove(path.c_str());
+}
+
+TEST(ElfLoader, TheGuestCanNotTruncateTheProgramItRuns)
+{
+    constexpr u32 GUEST_O_TRUNC = 01000;
+
+    // Two pages of code, the second of them mapped straight from the file:
+    // exit(7) from there
+    std::vector<u32> code(0x1000 / 4, addi(0, 0, 0));
+
+    for (u32 w : {addi(10, 0, 7), addi(17, 0, 93), ecall()})
+        code.push_back(w);
+
+    const auto elf = tiny_elf(0x1000, 0x10000, code);
+
+    const std::string root = ::testing::TempDir();
+    const std::string path = root + "rv32i_self.elf";
+    std::ofstream(path, std::ios::binary).write(reinterpret_cast<const char*>(elf.data()), std::streamsize(elf.size()));
+
+    Interpreter cpu;
+
+    loadElf(cpu, path, {path}, GuestLayout{});
+    register_all_handlers(cpu);
+
+    cpu.state.io.files.setRoot(root);
+
+    // The path goes where the guest may read it: under its stack pointer
+    const u32         PATH = cpu.state.regs[2] - 256;
+    const std::string name = "rv32i_self.elf";
+    cpu.state.memory.WriteBlock(PATH, reinterpret_cast<const u8*>(name.c_str()), u32(name.size() + 1));
+
+    // openat(AT_FDCWD, its own path, O_WRONLY | O_TRUNC), between the loader
+    // and the first instruction
+    const auto regs = cpu.state.regs;
+
+    cpu.state.regs[17] = Syscall::OPENAT;
+    cpu.state.regs[10] = u32(FileTable::CWD);
+    cpu.state.regs[11] = PATH;
+    cpu.state.regs[12] = 1 | GUEST_O_TRUNC;
+
+    handle_syscall(cpu.state);
+
+    EXPECT_EQ(cpu.state.regs[10], errno_result(ETXTBSY));
+
+    cpu.state.regs = regs;
+
+    auto res = run_program(cpu, 10'000, Engine::Interpreter);
+
+    EXPECT_EQ(int(res.status), int(ExecutionStatus::ProgramExit));
+    EXPECT_EQ(res.exit_code, 7);
+
+    std::remove(path.c_str());
+}
@@ -56,6 +56,19 @@ TEST_F(Rv32FTest, FLW_LoadsFloatWord)
     EXPECT_EQ(cpu.state.fregs[2], fbits(3.5f));
 }
 
+TEST_F(Rv32FTest, FLW_LoadsIntoF0Too)
+{
+    const u32 base = 0x3000;
+    cpu.state.memory.StoreU32(base + 8, fbits(2.0f));
+    cpu.state.regs[1] = base;
+
+    // flw f0, 8(x1)
+    IEncoding e{8, 1, 0x2, 0, Opcode::F_LOAD};
+    run(encode(e));
+
+    EXPECT_EQ(cpu.state.fregs[0], fbits(2.0f));
+}
+
 TEST_F(Rv32FTest, FSW_StoresFloatWord)
 {
     const u32 base = 0x3000;
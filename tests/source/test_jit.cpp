@@ -0,0 +1,216 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+namespace {
+
+void place(Interpreter& cpu, const std::vector<u32>& program)
+{
+    load_program(cpu, program);
+
+    cpu.state.regs[2] = 0x8000;
+}
+
+//> x5 counts down from 40; every iteration mixes the loop counter into x6..x31
+//> through every inlined op, a few called ones and memory.
+std::vector<u32> alu_mix()
+{
+    std::vector<u32> p = {
+        lui(5, 0),
+        addi(5, 0, 40),
+        lui(6, 0x12345000),
+        addi(6, 6, 0x678),
+        auipc(7, 0x2000),
+    };
+
+    const u32 loop = u32(p.size());
+
+    std::vector<u32> body = {
+        r_op(0x00, 0x0, 8,  6, 5),     // add
+        r_op(0x20, 0x0, 9,  8, 7),     // sub
+        r_op(0x00, 0x1, 10, 6, 5),     // sll
+        r_op(0x00, 0x2, 11, 9, 6),     // slt
+        r_op(0x00, 0x3, 12, 9, 6),     // sltu
+        r_op(0x00, 0x4, 13, 10, 8),    // xor
+        r_op(0x00, 0x5, 14, 9, 5),     // srl
+        r_op(0x20, 0x5, 15, 9, 5),     // sra
+        r_op(0x00, 0x6, 16, 13, 7),    // or
+        r_op(0x00, 0x7, 17, 16, 9),    // and
+        r_op(0x01, 0x0, 18, 9, 6),     // mul
+        r_op(0x01, 0x1, 19, 9, 15),    // mulh
+        r_op(0x01, 0x2, 20, 9, 15),    // mulhsu
+        r_op(0x01, 0x3, 21, 9, 15),    // mulhu
+        r_op(0x01, 0x4, 22, 18, 5),    // div
+        r_op(0x01, 0x7, 23, 18, 0),    // remu by zero
+        r_op(0x09, 0x1, 24, 6, 5),     // rol
+        r_op(0x09, 0x5, 25, 6, 5),     // ror
+        r_op(0x0A, 0x3, 26, 9, 6),     // max
+        i_op(0x2, 27, 9, -5),          // slti
+        i_op(0x3, 28, 5, 17),          // sltiu
+        i_op(0x4, 29, 9, -1),          // xori
+        i_op(0x6, 30, 29, 0x70F),      // ori
+        i_op(0x7, 31, 30, -256),       // andi
+        i_op(0x1, 8, 8, 7),            // slli
+        i_op(0x5, 8, 8, 3),            // srli
+        r_op(0x00, 0x0, 0, 6, 5),      // add into x0
+        sw(18, 2, -4),
+        lb(4, 2, -3),
+        r_op(0x00, 0x0, 6, 6, 4),
+        addi(5, 5, -1),
+        bne(5, 0, 0),                  // patched below
+    };
+
+    for (u32 w : body) p.push_back(w);
+
+    p.back() = bne(5, 0, -s32(4 * (p.size() - 1 - loop)));
+
+    p.push_back(addi(10, 6, 0));
+    p.push_back(addi(17, 0, 93));
+    p.push_back(ecall());
+
+    return p;
+}
+
+//> Recursive sum 1..n with calls through jal/jalr, a blt and a bgeu
+std::vector<u32> recursive_sum()
+{
+    return {
+        addi(10, 0, 30),        // 0x1000 a0 = 30
+        jal(1, 24),             // 0x1004 call sum (0x101C)
+        bgeu(0, 10, 12),        // 0x1008 not taken
+        addi(17, 0, 93),        // 0x100C
+        ecall(),                // 0x1010
+        0,                      // 0x1014
+        0,                      // 0x1018
+        addi(5, 0, 1),          // 0x101C sum:
+        blt(5, 10, 12),         // 0x1020 if 1 < a0 recurse
+        jalr(0, 1, 0),          // 0x1024 ret a0
+        0,                      // 0x1028
+        addi(2, 2, -8),         // 0x102C
+        sw(1, 2, 4),            // 0x1030
+        sw(10, 2, 0),           // 0x1034
+        addi(10, 10, -1),       // 0x1038
+        jal(1, -32),            // 0x103C call sum
+        lw(5, 2, 0),            // 0x1040
+        r_op(0x00, 0x0, 10, 10, 5), // 0x1044 a0 += n
+        lw(1, 2, 4),            // 0x1048
+        addi(2, 2, 8),          // 0x104C
+        jalr(0, 1, 0),          // 0x1050 ret
+    };
+}
+
+//> Runs both engines side by side in slices and compares the whole state after each
+void lockstep(const std::vector<u32>& program, size_t slice)
+{
+    Interpreter ref;
+    Interpreter jit;
+
+    place(ref, program);
+    place(jit, program);
+
+    jit.jit().hot_threshold = 1;
+
+    for (int step = 0; step < 10'000; ++step)
+    {
+        auto a = run_program(ref, slice, Engine::Interpreter);
+        auto b = run_program(jit, slice, Engine::Jit);
+
+        ASSERT_EQ(int(a.status), int(b.status)) << "slice " << step;
+        ASSERT_EQ(a.cycles,      b.cycles)      << "slice " << step;
+        ASSERT_EQ(a.pc,          b.pc)          << "slice " << step;
+        ASSERT_EQ(ref.state.pc,  jit.state.pc)  << "slice " << step;
+        ASSERT_EQ(ref.state.regs, jit.state.regs) << "slice " << step;
+
+        if (a.status == ExecutionStatus::ProgramExit)
+        {
+            EXPECT_EQ(a.exit_code, b.exit_code);
+            return;
+        }
+    }
+
+    FAIL() << "program did not finish";
+}
+
+} // namespace
+
+class JitTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        if (!Jit::supported())
+            GTEST_SKIP() << "no JIT on this host";
+    }
+};
+
+TEST_F(JitTest, AluMixMatchesInterpreterInLockstep)
+{
+    for (size_t slice : {1u, 7u, 33u, 1000u})
+        lockstep(alu_mix(), slice);
+}
+
+TEST_F(JitTest, CallsAndReturnsMatchInterpreterInLockstep)
+{
+    for (size_t slice : {3u, 10u, 64u, 1000u})
+        lockstep(recursive_sum(), slice);
+}
+
+TEST_F(JitTest, HotBlocksRunNatively)
+{
+    Interpreter cpu;
+    place(cpu, alu_mix());
+
+    auto res = run_program(cpu, 1'000'000, Engine::Jit);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+
+    const auto& st = cpu.jit().stats;
+
+    // Only the loop body gets hot: the entry block runs the first iteration and
+    // the body's other 39 start threaded until the threshold is reached
+    EXPECT_EQ(st.compiled, 1u);
+    EXPECT_EQ(st.executed, 39u - Jit::DEFAULT_HOT_THRESHOLD);
+}
+
+TEST_F(JitTest, StoreIntoCompiledCodeDropsIt)
+{
+    // x1 = 3; loop: x3 += 1; x1 -= 1; bne x1, x0, loop; then patch the loop and run it again
+    std::vector<u32> p = {
+        addi(1, 0, 3),      // 0x1000
+        addi(3, 3, 1),      // 0x1004 loop:
+        addi(1, 1, -1),     // 0x1008
+        bne(1, 0, -8),      // 0x100C
+        auipc(6, 0),        // 0x1010
+        lw(7, 6, 0x24),     // 0x1014 x7 = patched word (0x1034)
+        sw(7, 6, -12),      // 0x1018 *0x1004 = patched
+        addi(8, 8, 1),      // 0x101C
+        addi(1, 0, 3),      // 0x1020
+        addi(9, 0, 2),      // 0x1024
+        bne(8, 9, -36),     // 0x1028 second round
+        addi(10, 3, 0),     // 0x102C
+        jal(0, 12),         // 0x1030 -> 0x103C
+        addi(3, 3, 100),    // 0x1034 patched
+        0,                  // 0x1038
+        addi(17, 0, 93),    // 0x103C
+        ecall(),            // 0x1040
+    };
+
+    Interpreter cpu;
+    place(cpu, p);
+    cpu.jit().hot_threshold = 1;
+
+    auto res = run_program(cpu, 1'000, Engine::Jit);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(res.exit_code, 303);
+    EXPECT_GT(cpu.jit().stats.executed, 0u);
+
+    lockstep(p, 5);
+}
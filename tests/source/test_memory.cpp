@@ -0,0 +1,709 @@
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <fstream>
+#include <memory>
+#include <sstream>
+#include <stdexcept>
+#include <vector>
+
+#include "MappedFile.hpp"
+#include "Memory.hpp"
+#include "PageMerger.hpp"
+#include "PagePool.hpp"
+
+using namespace rv32i;
+
+class MemoryTest : public ::testing::TestWithParam<MemoryBackend>
+{
+protected:
+    void SetUp() override
+    {
+        if (GetParam() == MemoryBackend::Flat && !SparseMemory::flatSupported())
+            GTEST_SKIP() << "no flat memory on this host";
+    }
+};
+
+TEST_P(MemoryTest, UntouchedReadsZero)
+{
+    SparseMemory m(GetParam());
+
+    EXPECT_EQ(m.backend(), GetParam());
+
+    EXPECT_EQ(m.LoadU8(0),              0u);
+    EXPECT_EQ(m.LoadU16(0x12345),       0u);
+    EXPECT_EQ(m.LoadU32(0x80000000u),   0u);
+    EXPECT_EQ(m.LoadU32(0xFFFFFFFCu),   0u);
+    EXPECT_EQ(m.numPages(),             0u);
+}
+
+TEST_P(MemoryTest, WordsCrossPagesAndWrapAround)
+{
+    SparseMemory m(GetParam());
+
+    m.StoreU32(0x1FFE, 0xAABBCCDDu);          // straddles pages 1 and 2
+    m.StoreU16(0x3000, 0x1234);
+    m.StoreU8 (0x3002, 0x56);
+    m.StoreU32(0xFFFFFFFEu, 0x11223344u);     // wraps to address 0
+
+    EXPECT_EQ(m.LoadU32(0x1FFE), 0xAABBCCDDu);
+    EXPECT_EQ(m.LoadU8 (0x1FFF), 0xCCu);
+    EXPECT_EQ(m.LoadU16(0x2000), 0xAABBu);
+    EXPECT_EQ(m.LoadU32(0x3000), 0x00561234u);
+    EXPECT_EQ(m.LoadU16(0xFFFFFFFEu), 0x3344u);
+    EXPECT_EQ(m.LoadU16(0),           0x1122u);
+    EXPECT_EQ(m.LoadU32(0xFFFFFFFEu), 0x11223344u);
+
+    EXPECT_EQ(m.numPages(), 5u); // 1, 2, 3, the last one and 0
+}
+
+TEST_P(MemoryTest, CodeWritesFireOncePerMark)
+{
+    SparseMemory m(GetParam());
+
+    std::vector<u32> fired;
+    m.setCodeWriteHook([&](u32 page) { fired.push_back(page); });
+
+    m.StoreU32(0x5000, 1);
+    m.markCode(0x5004);
+    m.markCode(0x7000);
+
+    EXPECT_EQ(m.numPages(), 2u);
+
+    m.StoreU32(0x5008, 2);
+    m.StoreU8 (0x500C, 3);
+
+    EXPECT_EQ(fired, std::vector<u32>{5});
+
+    m.clear();
+
+    EXPECT_EQ(fired, (std::vector<u32>{5, 7}));
+    EXPECT_EQ(m.numPages(),     0u);
+    EXPECT_EQ(m.LoadU32(0x5000), 0u);
+}
+
+TEST_P(MemoryTest, ReadsSeePagesCreatedAfterAMiss)
+{
+    SparseMemory m(GetParam());
+
+    // 0x9000 and 0x49000 share a slot in the sparse backend's TLBs
+    EXPECT_EQ(m.LoadU32(0x9000),  0u);
+    EXPECT_EQ(m.LoadU32(0x49000), 0u);
+
+    m.StoreU32(0x9000,  7);
+    m.StoreU32(0x49000, 9);
+
+    EXPECT_EQ(m.LoadU32(0x9000),  7u);
+    EXPECT_EQ(m.LoadU32(0x49000), 9u);
+    EXPECT_EQ(m.LoadU8 (0x9000),  7u);
+
+    m.clear();
+
+    EXPECT_EQ(m.LoadU32(0x9000), 0u);
+
+    m.StoreU16(0x9002, 0xBEEF);
+
+    EXPECT_EQ(m.LoadU32(0x9000), 0xBEEF0000u);
+}
+
+TEST_P(MemoryTest, BlocksSpanPagesAndZeroFillsStayUntouched)
+{
+    SparseMemory m(GetParam());
+
+    std::vector<u8> data(3 * SparseMemory::PAGE_SIZE);
+
+    for (size_t i = 0; i < data.size(); ++i)
+        data[i] = u8(i * 7 + 1);
+
+    m.WriteBlock(0x10F00, data.data(), u32(data.size())); // pages 0x10..0x13
+
+    EXPECT_EQ(m.numPages(), 4u);
+    EXPECT_EQ(m.LoadU8(0x10F00), data[0]);
+    EXPECT_EQ(m.LoadU32(0x11000), m.LoadU32(0x10F00 + 0x100));
+    EXPECT_EQ(m.Compare(0x10F00, data.data(), u32(data.size())), 0);
+
+    std::vector<u8> back(data.size() + 16, 0xEE);
+    m.ReadBlock(0x10F00, back.data(), u32(back.size()));
+
+    EXPECT_TRUE(std::equal(data.begin(), data.end(), back.begin()));
+    EXPECT_EQ(back.back(), 0u); // past the block: never written
+
+    data[5000] ^= 0xFF;
+    EXPECT_NE(m.Compare(0x10F00, data.data(), u32(data.size())), 0);
+
+    // Zero over a mostly untouched range only writes to the pages that exist
+    m.Fill(0x11000, 0, 0x100000);
+
+    EXPECT_EQ(m.numPages(), 4u);
+    EXPECT_EQ(m.LoadU8(0x10FFF), data[0xFF]);
+    EXPECT_EQ(m.LoadU32(0x13800), 0u);
+
+    const std::vector<u8> zeros(64);
+    EXPECT_EQ(m.Compare(0x200000, zeros.data(), u32(zeros.size())), 0);
+    EXPECT_GT(m.Compare(0x10F00, zeros.data(), u32(zeros.size())), 0);
+
+    m.Fill(0xFFFFFFF0u, 0xAB, 0x20); // wraps to address 0
+    EXPECT_EQ(m.LoadU8(0xFFFFFFFFu), 0xABu);
+    EXPECT_EQ(m.LoadU8(0xF),         0xABu);
+    EXPECT_EQ(m.LoadU8(0x10),        0u);
+}
+
+TEST_P(MemoryTest, BlockWritesFireTheCodeHookPerPage)
+{
+    SparseMemory m(GetParam());
+
+    std::vector<u32> fired;
+    m.setCodeWriteHook([&](u32 page) { fired.push_back(page); });
+
+    m.markCode(0x4000);
+    m.markCode(0x6000);
+
+    m.Fill(0x3FF0, 0, 0x20);           // zeroes part of page 4: still a write
+    m.Fill(0x5000, 1, 0x2000);         // pages 5 and 6
+
+    EXPECT_EQ(fired, (std::vector<u32>{4, 6}));
+}
+
+TEST_P(MemoryTest, GuestAccessesHonourPagePermissions)
+{
+    SparseMemory m(GetParam());
+
+    u32 v = 0;
+
+    EXPECT_TRUE(m.TryStore<u32>(0x1000, 5));   // nothing protected yet
+    EXPECT_TRUE(m.TryLoad(0x1000, v));
+    EXPECT_EQ(v, 5u);
+
+    m.protectAll(SparseMemory::PERM_NONE);
+    m.protect(0x2000, 0x1000, SparseMemory::PERM_RW);
+    m.protect(0x3000, 0x1000, SparseMemory::PERM_RX);
+
+    // Cached translations of page 1 must not outlive the change
+    EXPECT_FALSE(m.TryLoad(0x1000, v));
+    EXPECT_FALSE(m.TryStore<u32>(0x1000, 6));
+    EXPECT_EQ(m.LoadU32(0x1000), 5u);           // the host still sees it
+
+    EXPECT_TRUE(m.TryStore<u32>(0x2FFC, 0xAABBCCDDu));
+    EXPECT_TRUE(m.TryLoad(0x2FFC, v));
+    EXPECT_EQ(v, 0xAABBCCDDu);
+
+    EXPECT_FALSE(m.TryStore<u32>(0x2FFE, 1));   // half of it lands on read-only code
+    EXPECT_EQ(m.LoadU16(0x2FFE), 0xAABBu);
+
+    u16 h = 0;
+    EXPECT_TRUE(m.TryLoad(0x2FFE, h));          // both halves readable
+    EXPECT_FALSE(m.TryLoad(0x3FFF, h));         // runs into page 4
+
+    m.StoreU32(0x3000, 7);                      // the loader writes code
+    EXPECT_TRUE(m.TryLoad(0x3000, v));
+    EXPECT_EQ(v, 7u);
+    EXPECT_FALSE(m.TryStore<u8>(0x3000, 1));
+
+    EXPECT_EQ(m.permissions(0x3123), SparseMemory::PERM_RX);
+    EXPECT_TRUE (m.allows(0x2000, 0x2000, SparseMemory::PERM_R));
+    EXPECT_FALSE(m.allows(0x2000, 0x2000, SparseMemory::PERM_W));
+    EXPECT_FALSE(m.allows(0x3000, 0x1001, SparseMemory::PERM_R));
+
+    m.clear();
+
+    EXPECT_TRUE(m.TryStore<u32>(0x1000, 6));    // a fresh memory is open again
+}
+
+TEST_P(MemoryTest, ForksSeeTheParentAndNotEachOther)
+{
+    SparseMemory parent(GetParam());
+
+    parent.StoreU32(0x1000, 1);
+    parent.StoreU32(0x2000, 2);
+    parent.protect(0x3000, 0x1000, SparseMemory::PERM_R);
+
+    SparseMemory child(GetParam());
+    child.StoreU32(0x9000, 9);                  // dropped by the fork
+    child.forkFrom(parent);
+
+    EXPECT_EQ(child.numPages(),      2u);
+    EXPECT_EQ(child.LoadU32(0x1000), 1u);
+    EXPECT_EQ(child.LoadU32(0x9000), 0u);
+    EXPECT_EQ(child.permissions(0x3000), SparseMemory::PERM_R);
+
+    const bool cow = GetParam() == MemoryBackend::Sparse;
+
+    EXPECT_EQ(child.usage().shared,  cow ? 2u : 0u);
+    EXPECT_EQ(parent.usage().shared, cow ? 2u : 0u);
+
+    child.StoreU32(0x1004, 5);
+    parent.StoreU32(0x2000, 7);
+
+    EXPECT_EQ(child.LoadU32(0x1004),  5u);
+    EXPECT_EQ(parent.LoadU32(0x1004), 0u);
+    EXPECT_EQ(child.LoadU32(0x2000),  2u);
+    EXPECT_EQ(parent.LoadU32(0x2000), 7u);
+    EXPECT_EQ(child.LoadU32(0x1000),  1u);   // the rest of the page came along
+
+    EXPECT_EQ(child.usage().shared,  cow ? 1u : 0u);
+    EXPECT_EQ(parent.usage().shared, cow ? 1u : 0u);
+
+    // A fork of a fork, outliving both
+    auto grandchild = std::make_unique<SparseMemory>(GetParam());
+    grandchild->forkFrom(child);
+
+    child.clear();
+    parent.clear();
+
+    EXPECT_EQ(grandchild->LoadU32(0x1004), 5u);
+    EXPECT_EQ(grandchild->LoadU32(0x2000), 2u);
+}
+
+TEST_P(MemoryTest, ResetPutsBackOnlyTheDirtyPages)
+{
+    SparseMemory m(GetParam());
+
+    std::vector<u32> fired;
+    m.setCodeWriteHook([&](u32 page) { fired.push_back(page); });
+
+    for (u32 page = 1; page <= 8; ++page)
+        m.StoreU32(page * SparseMemory::PAGE_SIZE, page);
+
+    m.markBaseline();
+
+    for (int round = 0; round < 2; ++round)
+    {
+        m.StoreU32(0x3000, 33);
+        m.StoreU32(0x3004, 34);                  // same page, recorded once
+        m.StoreU8 (0x20000, 1);                  // a page the baseline did not have
+        m.StoreU32(0x5000, 55);
+        m.markCode(0x5000);                      // the new code got decoded
+
+        EXPECT_EQ(m.dirtyPages(), (std::vector<u32>{3, 0x20, 5}));
+        EXPECT_EQ(m.numPages(), 9u);
+
+        fired.clear();
+        m.resetToBaseline();
+
+        EXPECT_TRUE(m.dirtyPages().empty());
+        EXPECT_EQ(m.numPages(),        8u);
+        EXPECT_EQ(m.LoadU32(0x3000),   3u);
+        EXPECT_EQ(m.LoadU32(0x3004),   0u);
+        EXPECT_EQ(m.LoadU32(0x5000),   5u);
+        EXPECT_EQ(m.LoadU8 (0x20000),  0u);
+        EXPECT_EQ(fired, std::vector<u32>{5});   // and the reset took it away again
+        EXPECT_EQ(m.LoadU32(0x8000),   8u);
+    }
+}
+
+TEST_P(MemoryTest, DirtyPagesStreamAsCheckpoints)
+{
+    SparseMemory m(GetParam());
+
+    m.StoreU32(0x1000, 1);
+    m.markBaseline();
+
+    m.StoreU32(0x1FFC, 0xAB);
+    m.StoreU32(0x7000, 7);
+
+    std::stringstream checkpoint;
+    m.writeDirtyPages(checkpoint);
+
+    SparseMemory copy(GetParam());
+    copy.StoreU32(0x1000, 1);
+    copy.readPages(checkpoint);
+
+    EXPECT_EQ(copy.LoadU32(0x1000), 1u);
+    EXPECT_EQ(copy.LoadU32(0x1FFC), 0xABu);
+    EXPECT_EQ(copy.LoadU32(0x7000), 7u);
+    EXPECT_EQ(copy.numPages(),      2u);
+
+    std::stringstream junk("not a checkpoint");
+    EXPECT_THROW(copy.readPages(junk), std::runtime_error);
+}
+
+TEST_P(MemoryTest, MappedFilePagesCopyOnFirstWrite)
+{
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+    const std::string path = ::testing::TempDir() + "rv32i_mapped_file.bin";
+
+    {
+        std::ofstream out(path, std::ios::binary);
+
+        for (u32 i = 0; i < 3 * PAGE / 4; ++i)
+            out.write(reinterpret_cast<const char*>(&i), 4);
+    }
+
+    auto file = MappedFile::open(path);
+    ASSERT_TRUE(file);
+
+    SparseMemory m(GetParam());
+    m.StoreU32(0x10000, 0xDEAD);
+
+    EXPECT_FALSE(m.mapFile(0x10001, file, 0,        PAGE));
+    EXPECT_FALSE(m.mapFile(0x10000, file, 4,        PAGE));
+    EXPECT_FALSE(m.mapFile(0x10000, file, 2 * PAGE, 2 * PAGE));
+    EXPECT_EQ(m.LoadU32(0x10000), 0xDEADu);
+
+    ASSERT_TRUE(m.mapFile(0x10000, file, PAGE, 2 * PAGE));
+
+    EXPECT_EQ(m.LoadU32(0x10000),            PAGE / 4);
+    EXPECT_EQ(m.LoadU32(0x10000 + PAGE + 4), PAGE / 2 + 1);
+
+    m.StoreU32(0x10000, 7);
+
+    EXPECT_EQ(m.LoadU32(0x10000), 7u);
+    EXPECT_EQ(m.LoadU32(0x10004), PAGE / 4 + 1);
+    EXPECT_EQ(file->data()[PAGE], PAGE / 4 % 256); // the file is never written
+
+    // A fresh mapping of the same file still sees it unchanged
+    SparseMemory other(GetParam());
+    ASSERT_TRUE(other.mapFile(0, file, PAGE, PAGE));
+    EXPECT_EQ(other.LoadU32(0), PAGE / 4);
+
+    std::remove(path.c_str());
+}
+
+TEST_P(MemoryTest, DiscardedPagesReadZeroAndCostNothing)
+{
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+    SparseMemory m(GetParam());
+
+    std::vector<u32> fired;
+    m.setCodeWriteHook([&](u32 page) { fired.push_back(page); });
+
+    for (u32 page = 0x10; page < 0x18; ++page)
+        m.StoreU32(page * PAGE, page);
+
+    m.markCode(0x12 * PAGE);
+
+    EXPECT_FALSE(m.discard(0x10001, PAGE));
+    EXPECT_FALSE(m.discard(0x10000, 100));
+
+    ASSERT_TRUE(m.discard(0x11 * PAGE, 4 * PAGE));
+
+    EXPECT_EQ(m.numPages(),             4u);
+    EXPECT_EQ(m.LoadU32(0x10 * PAGE),   0x10u);
+    EXPECT_EQ(m.LoadU32(0x12 * PAGE),   0u);
+    EXPECT_EQ(m.LoadU32(0x15 * PAGE),   0x15u);
+    EXPECT_EQ(fired, std::vector<u32>{0x12});
+
+    // Written again, a page starts from zeros
+    m.StoreU8(0x13 * PAGE, 1);
+    EXPECT_EQ(m.LoadU32(0x13 * PAGE), 1u);
+
+    // With a baseline the discard is a write of zeros the reset undoes
+    m.markBaseline();
+    ASSERT_TRUE(m.discard(0x10 * PAGE, PAGE));
+    EXPECT_EQ(m.LoadU32(0x10 * PAGE), 0u);
+
+    m.resetToBaseline();
+    EXPECT_EQ(m.LoadU32(0x10 * PAGE), 0x10u);
+}
+
+INSTANTIATE_TEST_SUITE_P(Backends, MemoryTest,
+                         ::testing::Values(MemoryBackend::Sparse, MemoryBackend::Flat),
+                         [](const auto& p) {
+                             return p.param == MemoryBackend::Flat ? "Flat" : "Sparse";
+                         });
+
+TEST(PagePool, ReusesReleasedPagesZeroed)
+{
+    PagePool pool;
+
+    u8* a = pool.allocate();
+    u8* b = pool.allocate();
+
+    EXPECT_EQ(pool.slabs(), 1u);
+    EXPECT_EQ(b - a, ptrdiff_t(PagePool::PAGE_SIZE));
+    EXPECT_EQ(reinterpret_cast<uintptr_t>(a) % PagePool::SLAB_SIZE, 0u);
+
+    a[0] = 0xAA;
+    a[PagePool::PAGE_SIZE - 1] = 0xBB;
+
+    pool.release(a);
+
+    EXPECT_EQ(pool.freePages(), 1u);
+
+    u8* c = pool.allocate();
+
+    EXPECT_EQ(c, a);
+    EXPECT_EQ(c[0], 0u);
+    EXPECT_EQ(c[PagePool::PAGE_SIZE - 1], 0u);
+    EXPECT_EQ(pool.inUse(), 2u);
+
+    // A full slab's worth more spills into a second one
+    for (size_t i = 0; i < PagePool::SLAB_PAGES; ++i)
+        pool.allocate();
+
+    EXPECT_EQ(pool.slabs(), 2u);
+}
+
+TEST(PagePool, SharedPagesGoBackWithTheLastHolder)
+{
+    PagePool pool;
+
+    u8* a = pool.allocate();
+
+    pool.share(a);
+    pool.share(a);
+
+    pool.release(a);
+    pool.release(a);
+
+    EXPECT_EQ(pool.freePages(), 0u);
+    EXPECT_EQ(pool.inUse(),     1u);
+
+    pool.release(a);
+
+    EXPECT_EQ(pool.freePages(), 1u);
+    EXPECT_EQ(pool.inUse(),     0u);
+
+    // Handed out again, it has one holder like any other page
+    EXPECT_EQ(pool.allocate(), a);
+
+    pool.release(a);
+    EXPECT_EQ(pool.freePages(), 1u);
+}
+
+TEST(Memory, ClearKeepsPagesForTheNextRun)
+{
+    SparseMemory m;
+
+    for (u32 page = 0; page < 100; ++page)
+        m.StoreU32(page * SparseMemory::PAGE_SIZE, page + 1);
+
+    auto before = m.usage();
+
+    EXPECT_EQ(before.pages,      100u);
+    EXPECT_EQ(before.free_pages, 0u);
+    EXPECT_EQ(before.slabs,      1u);
+    EXPECT_EQ(before.host_bytes, PagePool::SLAB_SIZE);
+
+    m.clear();
+
+    EXPECT_EQ(m.usage().pages,      0u);
+    EXPECT_EQ(m.usage().free_pages, 100u);
+
+    for (u32 page = 0; page < 100; ++page)
+        EXPECT_EQ(m.LoadU32(page * SparseMemory::PAGE_SIZE), 0u);
+
+    for (u32 page = 200; page < 300; ++page)
+        m.StoreU8(page * SparseMemory::PAGE_SIZE + 1, 1);
+
+    EXPECT_EQ(m.usage().pages,      100u);
+    EXPECT_EQ(m.usage().free_pages, 0u);
+    EXPECT_EQ(m.usage().slabs,      1u);
+    EXPECT_EQ(m.LoadU32(200 * SparseMemory::PAGE_SIZE), 0x100u); // zeroed before reuse
+}
+
+TEST(Memory, ForkedPagesGoBackOnceNoRelativeHoldsThem)
+{
+    constexpr u32 PAGE  = SparseMemory::PAGE_SIZE;
+    constexpr u32 PAGES = 64;
+
+    SparseMemory parent;
+    SparseMemory child;
+
+    for (u32 page = 0; page < PAGES; ++page)
+        parent.StoreU32(page * PAGE, page);
+
+    SparseMemory::Usage first{};
+
+    // Both sides copy every page they write, then the child is forked again
+    // or cleared, and a short-lived sibling comes and goes: the snapshots
+    // left behind have nobody holding them
+    for (u32 round = 0; round < 150; ++round)
+    {
+        child.forkFrom(parent);
+
+        if (round % 2)
+            std::make_unique<SparseMemory>()->forkFrom(parent);
+
+        for (u32 page = 0; page < PAGES; ++page)
+        {
+            child.StoreU32(page * PAGE + 4, round);
+            parent.StoreU32(page * PAGE + 8, round);
+        }
+
+        if (round % 3 == 1)
+            child.clear();
+
+        if (round == 0)
+            first = parent.usage();
+    }
+
+    EXPECT_EQ(parent.usage().slabs,  first.slabs);
+    EXPECT_EQ(parent.usage().shared, 0u);
+    EXPECT_EQ(child.usage().slabs,   1u);
+    EXPECT_EQ(parent.usage().pages,  PAGES);
+    EXPECT_EQ(parent.LoadU32(8),    149u);
+}
+
+TEST(Memory, BaselinesGiveTheirPagesBackWhenReplaced)
+{
+    constexpr u32 PAGE  = SparseMemory::PAGE_SIZE;
+    constexpr u32 PAGES = 64;
+
+    SparseMemory m;
+
+    size_t slabs = 0;
+
+    // Every round takes a new baseline over pages the last one still holds
+    for (u32 round = 0; round < 150; ++round)
+    {
+        m.markBaseline();
+
+        for (u32 page = 0; page < PAGES; ++page)
+            m.StoreU32(page * PAGE, round + page);
+
+        if (round % 2)
+        {
+            m.resetToBaseline();
+            m.StoreU32(0, round);
+        }
+
+        if (round == 0)
+            slabs = m.usage().slabs;
+    }
+
+    EXPECT_EQ(m.usage().slabs, slabs);
+    EXPECT_EQ(m.LoadU32(0),    149u);
+    EXPECT_EQ(m.LoadU32(PAGE), 149u);   // round 148 wrote it, the reset put it back
+}
+
+TEST(Memory, AllZeroPagesShareTheZeroPage)
+{
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+    SparseMemory m;
+
+    m.StoreU32(0 * PAGE, 1);
+    m.StoreU32(1 * PAGE, 0);
+    m.StoreU32(2 * PAGE, 2);
+    m.StoreU32(2 * PAGE, 0);
+    m.StoreU32(3 * PAGE, 3);
+
+    EXPECT_EQ(m.shareZeroPages(), 2u);
+    EXPECT_EQ(m.usage().shared,   2u);
+    EXPECT_EQ(m.usage().free_pages, 2u);
+
+    // A whole page cleared goes straight to it
+    m.Fill(3 * PAGE, 0, PAGE);
+    EXPECT_EQ(m.usage().shared, 3u);
+
+    m.StoreU8(PAGE + 5, 7);
+
+    EXPECT_EQ(m.LoadU8(PAGE + 5),     7u);
+    EXPECT_EQ(m.LoadU32(2 * PAGE),    0u);
+    EXPECT_EQ(m.LoadU32(3 * PAGE),    0u);
+    EXPECT_EQ(m.LoadU32(0),           1u);
+    EXPECT_EQ(SparseMemory::zeroPage()[5], 0u);
+}
+
+TEST(Memory, MappedFilePagesCostNothingUntilWritten)
+{
+    constexpr u32 PAGE  = SparseMemory::PAGE_SIZE;
+    constexpr u32 PAGES = 64;
+
+    const std::string path = ::testing::TempDir() + "rv32i_lazy_file.bin";
+
+    {
+        std::ofstream out(path, std::ios::binary);
+
+        for (u32 i = 0; i < PAGES * PAGE / 4; ++i)
+            out.write(reinterpret_cast<const char*>(&i), 4);
+    }
+
+    auto file = MappedFile::open(path);
+    ASSERT_TRUE(file);
+
+    SparseMemory m;
+    m.StoreU32(0x40000, 1);
+
+    // Over a written page too: the file takes its place
+    ASSERT_TRUE(m.mapFile(0x40000, file, 0, PAGES * PAGE));
+
+    EXPECT_EQ(m.numPages(), 0u);
+    EXPECT_EQ(m.LoadU32(0x40000),              0u);
+    EXPECT_EQ(m.LoadU32(0x40000 + 63 * PAGE),  63 * PAGE / 4);
+
+    m.StoreU32(0x40000 + PAGE, 7);
+
+    EXPECT_EQ(m.numPages(), 1u);
+    EXPECT_EQ(m.LoadU32(0x40000 + PAGE),     7u);
+    EXPECT_EQ(m.LoadU32(0x40000 + PAGE + 4), PAGE / 4 + 1);
+
+    // A hole in the middle reads as zero; the file shows on either side
+    ASSERT_TRUE(m.discard(0x40000 + 10 * PAGE, 4 * PAGE));
+
+    EXPECT_EQ(m.LoadU32(0x40000 + 10 * PAGE), 0u);
+    EXPECT_EQ(m.LoadU32(0x40000 + 9 * PAGE),  9 * PAGE / 4);
+    EXPECT_EQ(m.LoadU32(0x40000 + 14 * PAGE), 14 * PAGE / 4);
+
+    // A fork sees the file and the page written over it
+    SparseMemory child;
+    child.forkFrom(m);
+
+    EXPECT_EQ(child.LoadU32(0x40000 + 20 * PAGE), 20 * PAGE / 4);
+    EXPECT_EQ(child.LoadU32(0x40000 + PAGE),      7u);
+
+    // A baseline reset brings the file back under a page written since
+    m.markBaseline();
+    m.StoreU32(0x40000 + 30 * PAGE, 5);
+    m.resetToBaseline();
+
+    EXPECT_EQ(m.LoadU32(0x40000 + 30 * PAGE), 30 * PAGE / 4);
+
+    m.clear();
+    EXPECT_EQ(m.LoadU32(0x40000 + 20 * PAGE), 0u);
+
+    std::remove(path.c_str());
+}
+
+TEST(PageMerger, MergesReadOnlyPagesAcrossGuests)
+{
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+    SparseMemory a, b, c;
+
+    for (SparseMemory* m : {&a, &b, &c})
+    {
+        for (u32 off = 0; off < 2 * PAGE; off += 4)
+            m->StoreU32(0x10000 + off, off * 3);     // same text in everyone
+
+        m->StoreU32(0x20000, 1 + u32(m == &c));      // writable data
+        m->StoreU32(0x30000, 0);                     // zeroed
+        m->protect(0x10000, 2 * PAGE, SparseMemory::PERM_RX);
+    }
+
+    b.StoreU32(0x10000 + PAGE, 5); // and one page of b's text differs
+
+    PageMerger merger;
+
+    for (SparseMemory* m : {&a, &b, &c})
+        merger.add(*m);
+
+    // Two text pages in a first copy each, three merged into them, three zero pages
+    EXPECT_EQ(merger.scan(), 6u);
+    EXPECT_EQ(merger.stats.merged, 3u);
+    EXPECT_EQ(merger.stats.zero,   3u);
+    EXPECT_EQ(merger.stats.savedBytes(), 6u * PAGE);
+
+    // The data pages are writable and differ anyway; a second round finds nothing new
+    EXPECT_EQ(merger.scan(), 0u);
+
+    for (SparseMemory* m : {&a, &b, &c})
+    {
+        EXPECT_EQ(m->LoadU32(0x10000 + 8), 24u);
+        EXPECT_EQ(m->LoadU32(0x20000),     1 + u32(m == &c));
+    }
+
+    EXPECT_EQ(b.LoadU32(0x10000 + PAGE), 5u);
+    EXPECT_EQ(c.LoadU32(0x10000 + PAGE), 3 * PAGE);
+
+    // Writing a merged page copies it for that guest only
+    a.StoreU32(0x10000, 99);
+    EXPECT_EQ(a.LoadU32(0x10000), 99u);
+    EXPECT_EQ(b.LoadU32(0x10000), 0u);
+    EXPECT_EQ(c.LoadU32(0x10000), 0u);
+}
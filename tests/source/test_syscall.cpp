@@ -0,0 +1,433 @@
+#include <gtest/gtest.h>
+
+#include <cerrno>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "Syscall.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+namespace {
+
+constexpr u32 BUFFER = 0x20000FF0; // straddles a page
+
+//> read(0, BUFFER, 64), write(1, ...) its first 18 bytes six at a time, then
+//> exit(what read returned)
+std::vector<u32> echo_program()
+{
+    std::vector<u32> p = {
+        lui(11, 0x20001000), addi(11, 11, -16),             // a1 = BUFFER
+        addi(10, 0, 0), addi(12, 0, 64), addi(17, 0, 63), ecall(),
+        addi(5, 10, 0),                                     // t0 = bytes read
+    };
+
+    for (s32 at : {0, 6, 12})
+    {
+        p.push_back(lui(11, 0x20001000));
+        p.push_back(addi(11, 11, -16 + at));
+        p.push_back(addi(10, 0, 1));
+        p.push_back(addi(12, 0, 6));
+        p.push_back(addi(17, 0, 64));
+        p.push_back(ecall());
+    }
+
+    for (u32 w : {addi(10, 5, 0), addi(17, 0, 93), ecall()})
+        p.push_back(w);
+
+    return p;
+}
+
+//> The syscall an ecall with these registers makes; what it left in a0
+u32 sys(Interpreter& cpu, u32 num, u32 a0 = 0, u32 a1 = 0, u32 a2 = 0, u32 a3 = 0, u32 a4 = 0)
+{
+    auto& r = cpu.state.regs;
+
+    r[17] = num;
+    r[10] = a0;
+    r[11] = a1;
+    r[12] = a2;
+    r[13] = a3;
+    r[14] = a4;
+
+    handle_syscall(cpu.state);
+
+    return r[10];
+}
+
+void put_string(SparseMemory& m, u32 addr, const std::string& s)
+{
+    m.WriteBlock(addr, reinterpret_cast<const u8*>(s.c_str()), u32(s.size() + 1));
+}
+
+std::string drain(int fd)
+{
+    std::string out;
+    char        buf[256];
+
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+
+    for (ssize_t n; (n = ::read(fd, buf, sizeof(buf))) > 0; )
+        out.append(buf, size_t(n));
+
+    return out;
+}
+
+} // namespace
+
+TEST(GuestIO, ReadsAndWritesGuestPagesStraightThroughDescriptors)
+{
+    for (OutputBuffering mode : {OutputBuffering::None, OutputBuffering::Line, OutputBuffering::Full})
+    {
+        int in[2], out[2];
+        ASSERT_EQ(pipe(in),  0);
+        ASSERT_EQ(pipe(out), 0);
+
+        const std::string input = "hello\nworld!rest, and more";
+        ASSERT_EQ(::write(in[1], input.data(), input.size()), ssize_t(input.size()));
+        ::close(in[1]);
+
+        std::string before_exit;
+
+        {
+            Interpreter cpu;
+            load_program(cpu, echo_program());
+
+            cpu.state.io.backend   = std::make_shared<HostFdIo>(in[0], out[1]);
+            cpu.state.io.buffering = mode;
+
+            // Stop right before the exit: what got out by then depends on the mode
+            run_program(cpu, 7 + 3 * 6, Engine::Interpreter);
+
+            before_exit = drain(out[0]);
+
+            auto res = run_program(cpu, 10, Engine::Interpreter);
+            EXPECT_EQ(int(res.status), int(ExecutionStatus::ProgramExit));
+            EXPECT_EQ(res.exit_code, int(input.size()));
+            EXPECT_EQ(cpu.state.memory.Compare(BUFFER, reinterpret_cast<const u8*>(input.data()),
+                                               u32(input.size())), 0);
+        }
+
+        const std::string expected = input.substr(0, 18);
+
+        if (mode == OutputBuffering::None)
+            EXPECT_EQ(before_exit, expected);
+        else if (mode == OutputBuffering::Line)
+            EXPECT_EQ(before_exit, "hello\n");
+        else
+            EXPECT_EQ(before_exit, "");
+
+        EXPECT_EQ(before_exit + drain(out[0]), expected);
+
+        ::close(in[0]);
+        ::close(out[0]);
+        ::close(out[1]);
+    }
+}
+
+TEST(GuestIO, InMemoryAndCallbackBackendsRunTheGuestInProcess)
+{
+    const std::string input = "hello\nworld!rest, and more";
+
+    auto buffers = std::make_shared<BufferIo>(input);
+
+    // Hands out a byte at a time, so the read has to keep asking
+    size_t      fed = 0;
+    std::string written;
+
+    auto callbacks = std::make_shared<CallbackIo>(
+        [&](u32 fd, u8* data, size_t len) -> s64 {
+            if (fd != 0 || len == 0 || fed == input.size())
+                return 0;
+
+            *data = u8(input[fed++]);
+            return 1;
+        },
+        [&](u32 fd, const u8* data, size_t len) -> s64 {
+            if (fd == 1)
+                written.append(reinterpret_cast<const char*>(data), len);
+
+            return s64(len);
+        });
+
+    for (std::shared_ptr<IoBackend> backend : {std::shared_ptr<IoBackend>(buffers),
+                                               std::shared_ptr<IoBackend>(callbacks)})
+    {
+        Interpreter cpu;
+        load_program(cpu, echo_program());
+
+        cpu.state.io.backend = backend;
+
+        auto res = run_program(cpu, 100, Engine::Block);
+
+        EXPECT_EQ(int(res.status), int(ExecutionStatus::ProgramExit));
+        EXPECT_EQ(res.exit_code, int(input.size()));
+    }
+
+    EXPECT_EQ(buffers->out, input.substr(0, 18));
+    EXPECT_EQ(buffers->consumed, input.size());
+    EXPECT_EQ(written, input.substr(0, 18));
+}
+
+TEST(GuestIO, BadDescriptorsAndBuffersFailWithErrno)
+{
+    Interpreter cpu;
+    load_program(cpu, {ecall()});
+
+    EXPECT_EQ(cpu.state.io.read(cpu.state.memory, 5, BUFFER, 4),  errno_result(EBADF));
+    EXPECT_EQ(cpu.state.io.write(cpu.state.memory, 0, BUFFER, 4), errno_result(EBADF));
+
+    cpu.state.memory.protect(BUFFER & ~0xFFFu, 4096, SparseMemory::PERM_R);
+
+    cpu.state.regs[17] = 63;
+    cpu.state.regs[10] = 0;
+    cpu.state.regs[11] = BUFFER;
+    cpu.state.regs[12] = 4;
+
+    run_program(cpu, 1, Engine::Interpreter);
+
+    EXPECT_EQ(cpu.state.regs[10], errno_result(EFAULT));
+}
+
+TEST(GuestIO, ReadsOnlyClaimThePagesTheyFill)
+{
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+    constexpr u32 BIG  = 1u << 20;
+
+    // A line, as from a terminal, then a little over three pages
+    for (const std::string input : {std::string("hello\n"), std::string(3 * PAGE + 100, 'x')})
+    {
+        Interpreter cpu;
+        cpu.state.io.backend = std::make_shared<BufferIo>(input);
+
+        SparseMemory& m = cpu.state.memory;
+
+        EXPECT_EQ(cpu.state.io.read(m, 0, BUFFER, BIG), u32(input.size()));
+        EXPECT_EQ(m.Compare(BUFFER, reinterpret_cast<const u8*>(input.data()), u32(input.size())), 0);
+
+        // The pages the bytes landed on, and for the long input at most as
+        // many again for the chunk that came up short
+        const size_t filled = (BUFFER % PAGE + input.size() + PAGE - 1) / PAGE;
+
+        EXPECT_GE(m.numPages(), filled);
+        EXPECT_LE(m.numPages(), input.size() < PAGE ? filled : 2 * filled);
+    }
+}
+
+TEST(FileSyscalls, OpenSeekStatAndPositionalIoStayUnderTheRoot)
+{
+    constexpr u32 PATH   = 0x30000000;
+    constexpr u32 DATA   = 0x30001000;
+    constexpr u32 OUT    = 0x30002000;
+    constexpr u32 IOV    = 0x30003000;
+    constexpr u32 RESULT = 0x30004000;
+
+    const auto dir  = std::filesystem::temp_directory_path() / ("rv32i_files_" + std::to_string(getpid()));
+    const auto root = dir / "root";
+    std::filesystem::create_directories(root);
+
+    std::ofstream(root / "notes.txt") << "0123456789abcdef";
+    std::ofstream(dir / "outside.txt") << "secret";
+
+    {
+        Interpreter cpu;
+        SparseMemory& m = cpu.state.memory;
+
+        cpu.state.io.files.setRoot(root.string());
+
+        // Outside the root is the root again, where there is no such file
+        put_string(m, PATH, "../outside.txt");
+        EXPECT_EQ(sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 0, 0), errno_result(ENOENT));
+
+        put_string(m, PATH, "/sub/../notes.txt");
+        const u32 fd = sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 2 /* O_RDWR */, 0);
+        ASSERT_EQ(fd, FileTable::FIRST);
+
+        EXPECT_EQ(sys(cpu, Syscall::FSTAT, fd, DATA), 0u);
+        EXPECT_EQ(m.LoadU32(DATA + 48), 16u);                 // st_size
+        EXPECT_EQ(m.LoadU32(DATA + 16) & 0170000, 0100000u);  // S_IFREG
+
+        // pread leaves the offset where it was for read
+        EXPECT_EQ(sys(cpu, Syscall::PREAD64, fd, DATA, 4, 10, 0), 4u);
+        EXPECT_EQ(m.Compare(DATA, reinterpret_cast<const u8*>("abcd"), 4), 0);
+
+        EXPECT_EQ(sys(cpu, Syscall::READ, fd, DATA, 3), 3u);
+        EXPECT_EQ(m.Compare(DATA, reinterpret_cast<const u8*>("012"), 3), 0);
+
+        // _llseek(fd, high, low, &result, SEEK_END) to two before the end
+        EXPECT_EQ(sys(cpu, Syscall::LSEEK, fd, 0xFFFFFFFFu, u32(-2), RESULT, 2), 0u);
+        EXPECT_EQ(m.LoadU32(RESULT), 14u);
+        EXPECT_EQ(m.LoadU32(RESULT + 4), 0u);
+
+        put_string(m, OUT, "XYZ");
+        m.StoreU32(IOV + 0, OUT);
+        m.StoreU32(IOV + 4, 2);
+        m.StoreU32(IOV + 8, OUT + 2);
+        m.StoreU32(IOV + 12, 1);
+
+        EXPECT_EQ(sys(cpu, Syscall::WRITEV, fd, IOV, 2), 3u);
+        EXPECT_EQ(sys(cpu, Syscall::PWRITE64, fd, OUT, 1, 0, 0), 1u);
+
+        EXPECT_EQ(sys(cpu, Syscall::CLOSE, fd), 0u);
+        EXPECT_EQ(sys(cpu, Syscall::CLOSE, fd), errno_result(EBADF));
+        EXPECT_EQ(sys(cpu, Syscall::READ, fd, DATA, 1), errno_result(EBADF));
+
+        // Streams can't seek; their stat says what they are
+        EXPECT_EQ(sys(cpu, Syscall::LSEEK, 0, 0, 0, RESULT, 0), errno_result(ESPIPE));
+        EXPECT_EQ(sys(cpu, Syscall::FSTAT, 1, DATA), 0u);
+    }
+
+    std::stringstream contents;
+    contents << std::ifstream(root / "notes.txt").rdbuf();
+
+    EXPECT_EQ(contents.str(), "X123456789abcdXYZ");
+
+    std::filesystem::remove_all(dir);
+}
+
+TEST(FileSyscalls, ForkedGuestsKeepTheParentsOpenFiles)
+{
+    constexpr u32 PATH = 0x30000000;
+    constexpr u32 DATA = 0x30001000;
+
+    const auto root = std::filesystem::temp_directory_path() / ("rv32i_fork_" + std::to_string(getpid()));
+    std::filesystem::create_directories(root);
+
+    std::ofstream(root / "notes.txt") << "0123456789";
+
+    {
+        Interpreter parent;
+
+        parent.state.io.files.setRoot(root.string());
+
+        put_string(parent.state.memory, PATH, "notes.txt");
+        const u32 fd = sys(parent, Syscall::OPENAT, u32(FileTable::CWD), PATH, 0, 0);
+        ASSERT_EQ(fd, FileTable::FIRST);
+
+        EXPECT_EQ(sys(parent, Syscall::READ, fd, DATA, 3), 3u);
+
+        auto child = parent.fork();
+        SparseMemory& m = child->state.memory;
+
+        // Same file, same offset, as after fork(2)
+        EXPECT_EQ(sys(*child, Syscall::READ, fd, DATA, 3), 3u);
+        EXPECT_EQ(m.Compare(DATA, reinterpret_cast<const u8*>("345"), 3), 0);
+
+        // Its root comes along, and closing its copy leaves the parent's open
+        put_string(m, PATH, "/notes.txt");
+        EXPECT_EQ(sys(*child, Syscall::OPENAT, u32(FileTable::CWD), PATH, 0, 0), fd + 1);
+        EXPECT_EQ(sys(*child, Syscall::CLOSE, fd), 0u);
+
+        EXPECT_EQ(sys(parent, Syscall::READ, fd, DATA, 4), 4u);
+        EXPECT_EQ(parent.state.memory.Compare(DATA, reinterpret_cast<const u8*>("6789"), 4), 0);
+    }
+
+    std::filesystem::remove_all(root);
+}
+
+TEST(FileSyscalls, MmapMapsAnOpenFileFromAPageOffset)
+{
+    constexpr u32 PATH = 0x30000000;
+    constexpr u32 PAGE = SparseMemory::PAGE_SIZE;
+
+    const auto root = std::filesystem::temp_directory_path() / ("rv32i_mmap_" + std::to_string(getpid()));
+    std::filesystem::create_directories(root);
+
+    std::ofstream(root / "data.bin") << std::string(PAGE, 'a') << "second page";
+    std::ofstream(root / "empty.bin");
+
+    {
+        Interpreter cpu;
+        SparseMemory& m = cpu.state.memory;
+
+        cpu.state.io.files.setRoot(root.string());
+
+        put_string(m, PATH, "data.bin");
+        const u32 fd = sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 0, 0);
+        ASSERT_EQ(fd, FileTable::FIRST);
+
+        put_string(m, PATH, "empty.bin");
+        const u32 empty = sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 0, 0);
+
+        // mmap2(0, PAGE, PROT_READ, MAP_PRIVATE, fd, 1): the offset is in pages
+        cpu.state.regs[15] = 1;
+        const u32 at = sys(cpu, Syscall::MMAP, 0, PAGE, AddressSpace::PROT_READ, AddressSpace::MAP_PRIVATE, fd);
+
+        ASSERT_LT(at, AddressSpace::MMAP_TOP);
+        EXPECT_EQ(m.Compare(at, reinterpret_cast<const u8*>("second page"), 12), 0); // and a zero after
+
+        // Closing the descriptor leaves the mapping be
+        EXPECT_EQ(sys(cpu, Syscall::CLOSE, fd), 0u);
+        EXPECT_EQ(m.LoadU8(at), u8('s'));
+
+        cpu.state.regs[15] = 0;
+        EXPECT_EQ(sys(cpu, Syscall::MMAP, 0, PAGE, AddressSpace::PROT_READ, AddressSpace::MAP_PRIVATE, fd),
+                  errno_result(EBADF));
+        EXPECT_EQ(sys(cpu, Syscall::MMAP, 0, PAGE, AddressSpace::PROT_READ, AddressSpace::MAP_PRIVATE, 1),
+                  errno_result(ENODEV));
+        EXPECT_EQ(sys(cpu, Syscall::MMAP, 0, PAGE, AddressSpace::PROT_READ, AddressSpace::MAP_PRIVATE, empty),
+                  errno_result(ENODEV));
+    }
+
+    std::filesystem::remove_all(root);
+}
+
+TEST(FileSyscalls, MappedFilesCanNotBeTruncatedUnderTheGuest)
+{
+    constexpr u32 PATH    = 0x30000000;
+    constexpr u32 PAGE    = SparseMemory::PAGE_SIZE;
+    constexpr u32 GUEST_O_TRUNC = 01000;
+
+    const auto root = std::filesystem::temp_directory_path() / ("rv32i_trunc_" + std::to_string(getpid()));
+    std::filesystem::create_directories(root);
+
+    for (MemoryBackend backend : {MemoryBackend::Sparse, MemoryBackend::Flat})
+    {
+        std::ofstream(root / "data.bin") << std::string(2 * PAGE, 'a');
+
+        Interpreter cpu(backend);
+        SparseMemory& m = cpu.state.memory;
+
+        cpu.state.io.files.setRoot(root.string());
+
+        put_string(m, PATH, "data.bin");
+        const u32 fd = sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 2 /* O_RDWR */, 0);
+        ASSERT_EQ(fd, FileTable::FIRST);
+
+        cpu.state.regs[15] = 0;
+        const u32 at = sys(cpu, Syscall::MMAP, 0, 2 * PAGE, AddressSpace::PROT_READ, AddressSpace::MAP_PRIVATE, fd);
+        ASSERT_LT(at, AddressSpace::MMAP_TOP);
+
+        EXPECT_EQ(sys(cpu, Syscall::CLOSE, fd), 0u);
+
+        // Shrinking it would leave the mapping with pages past the end of the
+        // file, which the host faults on
+        EXPECT_EQ(sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 1 /* O_WRONLY */ | GUEST_O_TRUNC, 0), errno_result(ETXTBSY));
+        EXPECT_EQ(std::filesystem::file_size(root / "data.bin"), 2u * PAGE);
+        EXPECT_EQ(m.LoadU8(at + PAGE + 1), u8('a'));
+
+        // Writing it is fine, and so is truncating once nothing maps it
+        EXPECT_EQ(sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 1, 0), fd);
+        EXPECT_EQ(sys(cpu, Syscall::CLOSE, fd), 0u);
+
+        m.clear();
+        put_string(m, PATH, "data.bin");
+
+        EXPECT_EQ(sys(cpu, Syscall::OPENAT, u32(FileTable::CWD), PATH, 1 | GUEST_O_TRUNC, 0), fd);
+        EXPECT_EQ(std::filesystem::file_size(root / "data.bin"), 0u);
+    }
+
+    std::filesystem::remove_all(root);
+}
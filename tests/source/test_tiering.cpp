@@ -0,0 +1,80 @@
+#include <gtest/gtest.h>
+
+#include <numeric>
+#include <vector>
+
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+namespace {
+
+u64 retired(const Interpreter& cpu)
+{
+    const auto& r = cpu.tiers().stats.retired;
+
+    return std::accumulate(r.begin(), r.end(), u64(0));
+}
+
+} // namespace
+
+// Registers and cycles against the interpreter: EngineTest in test_block_engine.cpp
+
+TEST(Tiering, PromotesThroughEveryTier)
+{
+    Interpreter cpu;
+    load_program(cpu, bubble_sort());
+
+    cpu.tiers().warm_threshold = 4;
+    cpu.jit().hot_threshold    = 8;
+
+    auto res = run_program(cpu, 1'000'000, Engine::Tiered);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+
+    const auto& st = cpu.tiers().stats;
+
+    EXPECT_EQ(retired(cpu), u64(res.cycles));
+    EXPECT_GT(st.retired[TIER_INTERPRETER], 0u);
+    EXPECT_GT(st.retired[TIER_THREADED],    0u);
+    EXPECT_GT(st.promoted,                  0u);
+
+    if (Jit::supported())
+    {
+        EXPECT_GT(st.retired[TIER_NATIVE], 0u);
+    }
+}
+
+TEST(Tiering, EveryInstructionIsCountedByOneTier)
+{
+    // Also when the limit cuts a block or a native run short
+    for (size_t limit : {1u, 123u, 1001u})
+    {
+        Interpreter cpu;
+        load_program(cpu, bubble_sort());
+
+        cpu.tiers().warm_threshold = 3;
+        cpu.jit().hot_threshold    = 2;
+
+        auto res = run_program(cpu, limit, Engine::Tiered);
+
+        EXPECT_EQ(retired(cpu), u64(res.cycles)) << limit;
+    }
+}
+
+TEST(Tiering, ColdCodeIsNeverTranslated)
+{
+    Interpreter cpu;
+    load_program(cpu, bubble_sort());
+
+    cpu.tiers().warm_threshold = 1'000'000;
+
+    auto res = run_program(cpu, 1'000'000, Engine::Tiered);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(cpu.blocks().stats.translated, 0u);
+    EXPECT_EQ(cpu.tiers().stats.retired[TIER_INTERPRETER], u64(res.cycles));
+}
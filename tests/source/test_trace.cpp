@@ -0,0 +1,119 @@
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <vector>
+
+#include "Block.hpp"
+#include "Interpreter.hpp"
+#include "Runner.hpp"
+#include "TestProgram.hpp"
+
+using namespace rv32i;
+using namespace rv32i::test;
+
+TEST(Trace, BubbleSortRunsItsLoopsAsTraces)
+{
+    // Registers and cycles are compared for every engine in test_block_engine.cpp;
+    // the array the side exits stored into is compared here
+    Interpreter ref;
+    Interpreter tr;
+
+    load_program(ref, bubble_sort());
+    load_program(tr,  bubble_sort());
+    tr.recorder().hot_loop = 4;
+
+    auto a = run_program(ref, 1'000'000, Engine::Interpreter);
+    auto b = run_program(tr,  1'000'000, Engine::Trace);
+
+    EXPECT_EQ(b.status,    ExecutionStatus::ProgramExit);
+    EXPECT_EQ(a.exit_code, b.exit_code);
+
+    for (u32 i = 0; i < 24; ++i)
+        EXPECT_EQ(ref.state.memory.LoadU32(DATA + 4 * i), tr.state.memory.LoadU32(DATA + 4 * i));
+
+    const auto& st = tr.recorder().stats;
+
+    EXPECT_GE(st.compiled, 2u);  // fill and the inner loop at least
+    EXPECT_GT(st.loops, 0u);
+    EXPECT_GT(st.side_exits, 0u); // swaps and the inner loop's exits
+    EXPECT_EQ(st.started, st.compiled + st.aborted);
+}
+
+TEST(Trace, StoreIntoLoopDropsTrace)
+{
+    // x1 = 20; loop: x3 += 1; patch after ten rounds: x3 += 100 from then on
+    const u32 patched = addi(3, 3, 100);
+
+    std::vector<u32> p = {
+        addi(1, 0, 20),         // 0x1000
+        lui(6, 0x1000),         // 0x1004 x6 = code base
+        addi(3, 3, 1),          // 0x1008 loop:
+        addi(1, 1, -1),         // 0x100C
+        addi(7, 0, 10),         // 0x1010
+        bne(1, 7, 12),          // 0x1014 -> skip
+        lw(8, 6, 0x30),         // 0x1018 x8 = patched word
+        sw(8, 6, 0x08),         // 0x101C rewrite the loop's first instruction
+        bne(1, 0, -24),         // 0x1020 skip: -> loop
+        addi(10, 3, 0),         // 0x1024
+        addi(17, 0, 93),        // 0x1028
+        ecall(),                // 0x102C
+        patched,                // 0x1030
+    };
+
+    Interpreter tr;
+    load_program(tr, p);
+    tr.recorder().hot_loop = 2;
+
+    auto res = run_program(tr, 10'000, Engine::Trace);
+
+    EXPECT_EQ(res.status, ExecutionStatus::ProgramExit);
+    EXPECT_EQ(res.exit_code, 10 + 10 * 100);
+    EXPECT_GT(tr.traces().stats.invalidated, 0u);
+}
+
+TEST(Trace, RebuildingATraceKeepsThePageIndexExact)
+{
+    // A trace through pages 1 -> 2 -> 1, as a loop calling into the next page
+    // makes them; every rewrite of page 1 drops it and records it again
+    auto trace_at = [](u32 start, std::vector<u32> pcs) {
+        auto t = std::make_unique<Block>();
+        t->start_pc = start;
+
+        for (u32 pc : pcs)
+        {
+            BlockOp op;
+            op.info.pc = pc;
+            op.op      = OP_FormatJ_JalOp;
+            t->ops.push_back(op);
+        }
+
+        return t;
+    };
+
+    BlockCache cache;
+
+    for (int round = 0; round < 100; ++round)
+    {
+        cache.insert(trace_at(0x1000, {0x1000, 0x1004, 0x2000, 0x2004, 0x1008}));
+
+        EXPECT_EQ(cache.indexed(1), 1u);
+        EXPECT_EQ(cache.indexed(2), 1u);
+
+        cache.invalidatePage(1);
+
+        EXPECT_EQ(cache.find(0x1000), nullptr);
+        EXPECT_EQ(cache.indexed(2), 0u);
+    }
+
+    // Recorded again along another path: a later write to page 2 leaves it alone
+    cache.insert(trace_at(0x1000, {0x1000, 0x1004, 0x3000}));
+    cache.invalidatePage(2);
+
+    EXPECT_NE(cache.find(0x1000), nullptr);
+
+    cache.invalidatePage(3);
+
+    EXPECT_EQ(cache.find(0x1000), nullptr);
+    EXPECT_EQ(cache.indexed(1), 0u);
+    cache.reclaim();
+}